@@ -0,0 +1,46 @@
+#ifndef ARENA_H
+
+#define ARENA_H
+
+#include <stddef.h>
+
+// Size of the blocks an arena grabs from malloc, unless an allocation needs a bigger one
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// Every allocation starts on this byte boundary
+#define ARENA_ALIGN 16
+
+// Structure to represent one malloc'd block of an arena
+typedef struct ArenaBlock
+{
+  struct ArenaBlock *next;                  // next block in the chain, kept across resets
+  size_t size;                              // usable bytes in data
+  _Alignas(ARENA_ALIGN) unsigned char data[]; // storage handed out by arena_alloc
+} ArenaBlock;
+
+// Structure to represent a bump allocator whose memory is all released at once
+typedef struct
+{
+  ArenaBlock *first;  // first block of the chain
+  ArenaBlock *block;  // block currently being allocated from, or NULL before the first allocation
+  size_t used;        // bytes used in the current block
+  size_t blockSize;   // minimum size of a new block
+} Arena;
+
+// Structure to represent a position in an arena that it can be rewound to
+typedef struct
+{
+  ArenaBlock *block;
+  size_t used;
+} ArenaMark;
+
+/* Function prototypes for arena allocation */
+void arena_init(Arena *a, size_t blockSize);
+void arena_clear(Arena *a);
+void *arena_alloc(Arena *a, size_t size);
+ArenaMark arena_mark(Arena *a);
+void arena_release(Arena *a, ArenaMark mark);
+void arena_reset(Arena *a);
+Arena *arena_frame(void);
+
+#endif // ARENA_H
@@ -0,0 +1,24 @@
+#ifndef CLIP_H
+
+#define CLIP_H
+
+#include "line.h"
+#include "polygon.h"
+
+// Outcode bits, one per clipping plane of the view volume
+#define CLIP_LEFT 0x01
+#define CLIP_RIGHT 0x02
+#define CLIP_TOP 0x04
+#define CLIP_BOTTOM 0x08
+#define CLIP_NEAR 0x10
+#define CLIP_FAR 0x20
+
+// Smallest homogeneous coordinate kept by the near plane, just in front of the center of projection
+#define CLIP_NEAR_EPSILON 1e-5
+
+/* Clipping Methods */
+int clip_outcode(Point *p, int rows, int cols);
+Polygon *polygon_clip(Polygon *p, int rows, int cols);
+int line_clip(Line *l, int rows, int cols);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef DISPLAYLIST_H
+
+#define DISPLAYLIST_H
+
+#include "module.h"
+
+// Enumerated type for the kind of primitive in a display list item
+typedef enum
+{
+  DrawItemPoint,
+  DrawItemLine,
+  DrawItemPolygon,
+  DrawItemMesh
+} DrawItemType;
+
+// Structure to represent one primitive of a compiled module
+typedef struct
+{
+  DrawItemType type;
+  int nVertex;        // number of vertices; a mesh's are shared by its triangles
+  int first;          // index of the first vertex in the display list's vertex and normal arrays
+  int nTriangle;      // mesh triangles
+  int firstIndex;     // index of the mesh's first triangle in the index array; indices count from first
+  int oneSided;       // polygon or mesh one-sided flag
+  int zBuffer;        // line, polygon or mesh z-buffer flag
+  int hasColor;       // whether the polygon or mesh carries per-vertex colors in the color array
+  int hasNormal;      // whether the polygon or mesh carries normals in the normal array
+  Color color;        // draw state colors in effect for the primitive
+  Color body;
+  Color surface;
+  float surfaceCoeff;
+} DrawItem;
+
+// Structure to represent a module flattened into world-space primitives
+typedef struct
+{
+  DrawItem *item;     // primitives in drawing order
+  int nItems;
+  int itemCapacity;
+
+  Point *vertex;      // packed world-space vertices of all items
+  Vector *normal;     // packed world-space normals, parallel to vertex
+  Color *color;       // packed per-vertex colors of the polygons that have them, parallel to vertex
+  int nVertex;
+  int vertexCapacity;
+
+  int *index;         // packed triangle indices of the mesh items
+  int nIndex;
+  int indexCapacity;
+
+  int maxVertex;          // largest vertex count of any point, line or polygon item
+  Point *scratchVertex;   // per-draw working arrays sized by maxVertex: screen-space vertices,
+  Vector *scratchNormal;  // world-space normals,
+  Color *scratchColor;    // shaded colors
+  Point *scratchWorld;    // and world-space vertices
+} DisplayList;
+
+/* Function prototypes for display list operations */
+DisplayList *module_compile(Module *md, Matrix *GTM, DrawState *ds);
+void displaylist_delete(DisplayList *dl);
+void displaylist_draw(DisplayList *dl, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src);
+
+#endif // DISPLAYLIST_H
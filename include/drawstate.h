@@ -13,7 +13,8 @@ typedef enum
   ShadeDepth,
   ShadeFlat,
   ShadeGouraud,
-  ShadePhong
+  ShadePhong,
+  ShadeDeferred
 } ShadeMethod;
 
 // Structure to specify how an object is drawn into the image
@@ -3,6 +3,102 @@
 #define FRACTALS_H
 
 #include "image.h"
+#include "threadpool.h"
+
+// Rows of the image handed to a thread at a time by the escape-time renderer
+#define FRACTAL_BAND_ROWS 4
+
+// Side of the square tiles the subdividing renderer hands to a thread at a time
+#define FRACTAL_TILE 128
+
+// Block size of the first, coarsest pass of a progressive render; each later pass halves it
+#define FRACTAL_PROGRESSIVE_BLOCK 16
+
+// Side of the square tiles of samples kept by a FractalCache, as a power of two
+#define FRACTAL_CACHE_SHIFT 6
+#define FRACTAL_CACHE_TILE (1 << FRACTAL_CACHE_SHIFT)
+
+// Sample spacing of level 0 of a FractalCache; level L samples every FRACTAL_CACHE_BASE / 2^L
+#define FRACTAL_CACHE_BASE 4.0
+
+// Enumerated type for the escape-time fractal to render
+typedef enum
+{
+  FractalMandelbrot,
+  FractalJulia
+} FractalType;
+
+// Structure to configure the escape-time renderer
+typedef struct
+{
+  FractalType type;
+  double cx, cy;     // Julia constant
+  int maxIterations; // iteration limit; points still bounded after it are inside the set
+  ThreadPool *pool;  // pool the renderer shares the work across, or NULL to run on the calling thread
+  int periodicity;   // stop iterating once an orbit returns to a point it visited before
+  int subdivide;     // fill rectangles whose border has a single iteration count without iterating inside; approximate
+} FractalParams;
+
+// Structure to hold a progressive render between calls; each pass computes a finer grid of points
+typedef struct
+{
+  FractalParams params;
+  double re0, im0; // point of the top-left pixel
+  double step;     // width of a pixel in the complex plane
+  int rows, cols;
+  int block;       // block size of the last complete pass: 0 before the first, 1 once the render is complete
+  int *counts;     // escape iterations, -1 where not computed yet
+} FractalProgress;
+
+// Structure to represent a real number to about 32 significant digits, as the unevaluated sum hi + lo
+typedef struct
+{
+  double hi, lo;
+} FractalReal;
+
+// Structure to hold the reference orbit of a deep zoom: the Mandelbrot iteration of its center, computed with
+// FractalReal arithmetic; every pixel is then iterated in double as an offset from it
+typedef struct
+{
+  FractalReal re, im; // center of the zoom
+  int length;         // points in the orbit: up to and including the first to escape, or maxIterations + 1
+  double *zr, *zi;    // the orbit, rounded to double
+} FractalOrbit;
+
+// Structure to represent one tile of a FractalCache: the escape iterations of FRACTAL_CACHE_TILE squared samples
+typedef struct FractalCacheTile
+{
+  int level;                     // level of the samples
+  long long tx, ty;              // position of the tile in tiles of the level
+  int lastUsed;                  // last frame that read the tile
+  struct FractalCacheTile *next; // next tile in the same hash bucket
+  int counts[FRACTAL_CACHE_TILE * FRACTAL_CACHE_TILE]; // -1 where not computed yet
+} FractalCacheTile;
+
+// Structure to represent a sample queued to be iterated by a FractalCache
+typedef struct
+{
+  int *slot;       // count in its tile
+  double re, im;   // point, or offset from the center of the orbit
+} FractalCacheSample;
+
+// Structure to hold escape iterations from frame to frame of an animation. The plane is sampled on a grid per
+// level, finer by half at each level; a frame reads the level whose spacing is just below its pixel size and only
+// iterates the samples no earlier frame has.
+typedef struct
+{
+  FractalParams params;
+  const FractalOrbit *orbit;   // reference orbit for deep zooms, or NULL
+  FractalCacheTile **bucket;   // hash table of the tiles
+  int nBuckets;                // size of the table, a power of two
+  int nTiles, maxTiles;        // tiles held, and the count above which tiles unused by the last frame are freed
+  int frame;                   // frames rendered
+  int **slots;                 // count each pixel of the frame reads
+  FractalCacheSample *queue;   // samples to iterate this frame
+  size_t nSlots;               // size of slots and queue
+  long long samples;           // samples iterated so far
+  long long iterations;        // iterations those samples took
+} FractalCache;
 
 // Generate a Mandelbrot set
 void mandelbrot(Image *dst, float x0, float y0, float dx);
@@ -10,6 +106,58 @@ void mandelbrot(Image *dst, float x0, float y0, float dx);
 // Generate a Julia set
 void julia(Image *dst, float x0, float y0, float dx);
 
+// Set the default parameters for a fractal type
+void fractal_params(FractalParams *p, FractalType type);
+
+// Return the escape iteration of the point (re, im), or maxIterations if it is inside the set
+int fractal_escape(FractalParams *p, double re, double im);
+
+// Fill counts (rows x cols, row major) with the escape iterations of the grid of points re0 + j * dre, im0 + i * dim
+void fractal_counts(FractalParams *p, double re0, double im0, double dre, double dim, int rows, int cols, int *counts);
+
+// Color an image from escape iterations, rows x cols in row major order
+void fractal_color(Image *dst, const int *counts, int maxIterations);
+
+// Render a fractal into an image whose top-left pixel is (re0, im0) and whose width in the complex plane is width
+void fractal_render(Image *dst, FractalParams *p, double re0, double im0, double width);
+
+// Start a progressive render of a rows x cols image, placed as by fractal_render; returns 0 on success
+int fractal_progressiveInit(FractalProgress *r, FractalParams *p, int rows, int cols, double re0, double im0,
+                            double width);
+
+// Refine a progressive render until it is complete or seconds have passed, then color dst (if not NULL) from
+// what has been computed; the first pass always completes. Returns the block size reached, 1 when complete.
+int fractal_progressiveRefine(FractalProgress *r, Image *dst, double seconds);
+
+// Free the iteration counts of a progressive render
+void fractal_progressiveFree(FractalProgress *r);
+
+// Convert a decimal string such as "-0.7436438870371587047521915" to a FractalReal
+FractalReal fractal_real(const char *s);
+
+// Compute the reference orbit of a deep zoom centered on (re, im); returns 0 on success
+int fractal_orbit(FractalOrbit *orbit, FractalReal re, FractalReal im, int maxIterations);
+
+// Free a reference orbit
+void fractal_orbitFree(FractalOrbit *orbit);
+
+// As fractal_counts for the Mandelbrot set, with re0 and im0 given as offsets from the center of the orbit
+void fractal_countsDeep(FractalParams *p, const FractalOrbit *orbit, double re0, double im0, double dre, double dim,
+                        int rows, int cols, int *counts);
+
+// Render a Mandelbrot set centered on the center of the orbit; width can go down to about 1e-28
+void fractal_renderDeep(Image *dst, FractalParams *p, const FractalOrbit *orbit, double width);
+
+// Start a cache of escape iterations for an animation; with an orbit, frames are placed as offsets from its center
+// and iterated with perturbation. maxTiles of 0 or less picks a default. Returns 0 on success.
+int fractal_cacheInit(FractalCache *c, FractalParams *p, const FractalOrbit *orbit, int maxTiles);
+
+// Render a frame placed as by fractal_render from the cache, iterating only the samples it does not hold yet
+void fractal_cacheRender(FractalCache *c, Image *dst, double re0, double im0, double width);
+
+// Free the tiles and buffers of a cache
+void fractal_cacheFree(FractalCache *c);
+
 // Generate Perlin noise
 void perlin_noise(Image *img, int seed, float scale);
 
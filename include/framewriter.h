@@ -0,0 +1,50 @@
+#ifndef FRAMEWRITER_H
+
+#define FRAMEWRITER_H
+
+#include <pthread.h>
+#include "image.h"
+#include "gif.h"
+
+// Number of conversion buffers used when the caller does not choose, so one frame is written while the next renders
+#define FRAMEWRITER_BUFFERS 2
+
+// Longest output filename a queued frame can carry
+#define FRAMEWRITER_PATH 256
+
+// Structure to represent a converted frame waiting for the writer thread
+typedef struct
+{
+  Pixel *pixels;                  // 8-bit copy of the frame, borrowed from the buffer pool
+  char filename[FRAMEWRITER_PATH]; // PPM file to write, or empty for none
+} FrameJob;
+
+// Structure to represent a background thread that writes animation frames
+typedef struct
+{
+  int rows;               // frame height
+  int cols;               // frame width
+  int nBuffers;           // number of conversion buffers, which is also the queue capacity
+  Pixel **pool;           // conversion buffers that are not holding a frame
+  int nFree;              // number of buffers in the pool
+  FrameJob *queue;        // ring of frames waiting to be written
+  int head;               // index of the oldest queued frame
+  int count;              // number of queued frames
+  int busy;               // set while the writer thread is writing a frame
+  GifWriter *gif;         // animation that receives every frame, or NULL
+  int nErrors;            // number of frames the GIF writer rejected
+  int threaded;           // zero when the writer thread could not start and frames are written in place
+  int quit;               // set when the writer is being deleted
+  pthread_t thread;       // writer thread
+  pthread_mutex_t lock;   // protects the pool and queue fields
+  pthread_cond_t ready;   // signalled when a frame is queued or the writer is shutting down
+  pthread_cond_t space;   // signalled when a frame has been written and its buffer returned
+} FrameWriter;
+
+/* Function prototypes for asynchronous frame output */
+FrameWriter *framewriter_create(int rows, int cols, int nBuffers, GifWriter *gif);
+int framewriter_write(FrameWriter *fw, Image *src, const char *filename);
+void framewriter_flush(FrameWriter *fw);
+int framewriter_delete(FrameWriter *fw);
+
+#endif // FRAMEWRITER_H
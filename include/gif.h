@@ -1,8 +1,39 @@
+#ifndef GIF_H
+
+#define GIF_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include "image.h"
+#include "ppmIO.h"
+
+// Structure to represent an animated GIF that is written one frame at a time
+typedef struct
+{
+  FILE *fp;                // output file
+  int rows;                // logical screen height
+  int cols;                // logical screen width
+  int delay;               // delay between frames in hundredths of a second
+  int nFrames;             // number of frames written so far
+  Pixel *frame;            // 8-bit conversion of the frame being added
+  Pixel *prev;             // previous frame, used to find the changed rectangle
+  unsigned char *index;    // palette indices of the changed rectangle
+  unsigned int *hist;      // 15-bit color histogram of the changed pixels
+  unsigned int (*sum)[3];  // per-bin sums of the exact 8-bit colors
+  unsigned char *map;      // palette index of each 15-bit color
+  int *entry;              // occupied histogram bins, grouped into median-cut boxes
+} GifWriter;
+
+/* Function prototypes for writing GIF animations */
+GifWriter *gif_begin(const char *filename, int rows, int cols, int delay);
+int gif_addFrame(GifWriter *gw, Image *src);
+int gif_addPixels(GifWriter *gw, Pixel *pixels);
+int gif_end(GifWriter *gw);
 
 /* Function prototypes for creating a GIF from PPM files */
 void list_ppm_files(const char *directory, char ***ppm_files, int *file_count);
-void create_gif(const char *output_gif, char **ppm_files, int file_count, int delay);
\ No newline at end of file
+void create_gif(const char *output_gif, char **ppm_files, int file_count, int delay);
+
+#endif
@@ -8,6 +8,8 @@
 #include "vector.h"
 #include "line.h"
 #include "polygon.h"
+#include "mesh.h"
+#include "clip.h"
 #include "matrix.h"
 #include "view.h"
 #include "lighting.h"
@@ -16,6 +18,7 @@
 #include "module.h"
 #include "swarm.h"
 #include "plyRead.h"
+#include "displaylist.h"
 #include <math.h>
 
 // Common constants
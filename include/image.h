@@ -2,22 +2,102 @@
 
 #define IMAGE_H
 
+#include <stddef.h>
+#include "ppmIO.h"
+
+// Rows of every plane start on this byte boundary
+#define IMAGE_ALIGN 64
+
+// Dirty-tile tracking works on square tiles of 1 << IMAGE_TILE_SHIFT pixels
+#define IMAGE_TILE_SHIFT 5
+#define IMAGE_TILE_SIZE (1 << IMAGE_TILE_SHIFT)
+
+// The hierarchical z-buffer keeps depth bounds for row segments and square tiles of 1 << IMAGE_HIZ_SHIFT pixels
+#define IMAGE_HIZ_SHIFT 3
+#define IMAGE_HIZ_SIZE (1 << IMAGE_HIZ_SHIFT)
+
 // Structure to represent a floating-point pixel with RGB components
 typedef struct
 {
   float rgb[3];
 } FPixel;
 
-// Structure to represent an image with its cols, rows, and pixel data
+// Structure to represent the surface under one pixel, written by deferred shading and lit afterwards
+typedef struct
+{
+  float z;          // depth (1/z) of the sample; 0 when the pixel holds no sample
+  float world[3];   // world-space position
+  float normal[3];  // world-space normal
+  float body[3];    // body color
+  float surface[3]; // surface color
+  float coeff;      // surface coefficient
+  int oneSided;     // whether the surface is lit from the front only
+} GSample;
+
+// Structure to represent an image with its cols, rows, and pixel data.
+// The pixel, alpha, and depth planes and their row tables share one aligned block.
 typedef struct
 {
-  int cols;     // columns
-  int rows;     // rows
-  float **a;     // 2D array of alpha values
-  float **z;     // 2D array of depth values
-  FPixel **data; // 2D array of floating-point pixels
+  int cols;             // columns
+  int rows;             // rows
+  int stride;           // elements from the start of one row to the next, in every plane
+  float **a;            // 2D array of alpha values
+  float **z;            // 2D array of depth values
+  FPixel **data;        // 2D array of floating-point pixels
+  void *block;          // single allocation backing the planes and row tables
+  unsigned char *dirty; // per-tile flags set when a tile is written after a reset; NULL when tracking is off
+  int tilesX;           // tiles per row of the dirty-tile table
+  GSample *gbuf;        // G-buffer for deferred shading, rows * stride samples; NULL when none is attached
+  float *zSeg;          // per row, a lower bound on the depth of each IMAGE_HIZ_SIZE-column segment; NULL when off
+  float *zTile;         // per IMAGE_HIZ_SIZE square tile, a lower bound on its depth
+  int hizX;             // segments per row and tiles per row of the hierarchical z-buffer
 } Image;
 
+// Unchecked span accessors; the caller keeps (row, col) and the span length inside the image
+
+// Pointer to the pixel at (row, col), followed by the rest of the row
+static inline FPixel *image_span(Image *src, int row, int col)
+{
+  return src->data[0] + (size_t)row * src->stride + col;
+}
+
+// Pointer to the alpha value at (row, col), followed by the rest of the row
+static inline float *image_aspan(Image *src, int row, int col)
+{
+  return src->a[0] + (size_t)row * src->stride + col;
+}
+
+// Pointer to the depth value at (row, col), followed by the rest of the row
+static inline float *image_zspan(Image *src, int row, int col)
+{
+  return src->z[0] + (size_t)row * src->stride + col;
+}
+
+// Pointer to the G-buffer sample at (row, col), followed by the rest of the row; the image must have a G-buffer
+static inline GSample *image_gspan(Image *src, int row, int col)
+{
+  return src->gbuf + (size_t)row * src->stride + col;
+}
+
+// Lower bounds on the depth of the segments of a row, when the hierarchical z-buffer is on
+static inline float *image_zsegments(Image *src, int row)
+{
+  return src->zSeg + (size_t)row * src->hizX;
+}
+
+// Record that columns c0 through c1 of a row were written, when dirty-tile tracking is on
+static inline void image_markSpan(Image *src, int row, int c0, int c1)
+{
+  if (src->dirty)
+  {
+    unsigned char *tile = src->dirty + (size_t)(row >> IMAGE_TILE_SHIFT) * src->tilesX;
+    for (int t = c0 >> IMAGE_TILE_SHIFT; t <= c1 >> IMAGE_TILE_SHIFT; t++)
+    {
+      tile[t] = 1;
+    }
+  }
+}
+
 /* Function prototypes for image operations */
 Image *image_create(int rows, int cols);
 void image_free(Image *src);
@@ -25,6 +105,11 @@ void image_init(Image *src);
 int image_alloc(Image *src, int rows, int cols);
 void image_dealloc(Image *src);
 void image_reset(Image *src);
+int image_trackTiles(Image *src, int enable);
+int image_attachGBuffer(Image *src, int enable);
+int image_trackDepth(Image *src, int enable);
+void image_updateDepth(Image *src, int row, int c0, int c1);
+int image_occluded(Image *src, int r0, int c0, int r1, int c1, float z);
 FPixel image_getf(Image *src, int row, int col);
 float image_getc(Image *src, int row, int col);
 float image_geta(Image *src, int row, int col);
@@ -39,5 +124,6 @@ void image_filla(Image *src, float a);
 void image_fillz(Image *src, float z);
 Image *image_read(char *filename);
 int image_write(Image *src, char *filename);
+void image_toPixels(Image *src, Pixel *dst);
 
 #endif
@@ -27,11 +27,39 @@ typedef struct
   float sharpness; // coefficient of the falloff function (power for cosine)
 } Light;
 
+// Number of intervals in a specular power lookup table over [0, 1]
+#define LIGHTING_POW_STEPS 2048
+
+// Number of specular power tables each thread keeps, one per recently used surface coefficient
+#define LIGHTING_POW_TABLES 4
+
+// Structure to represent a light with the constants the batch shader needs precomputed
+typedef struct
+{
+  float pos[3];    // normalized direction of a directional light, or position of a point or spot light
+  float dir[3];    // direction of a spot light
+  float color[3];  // light color
+  float cutoff;    // cosine of the spot light cutoff angle
+  float sharpness; // spot light falloff power
+} LightPrepared;
+
+// Structure to represent the lights grouped by type, ready for shading many vertices
+typedef struct
+{
+  int valid;                        // set by lighting_prepare, cleared whenever a light is added or removed
+  float ambient[3];                 // sum of the ambient light colors
+  int nDirect;                      // directional lights occupy light[0, nDirect)
+  int nPoint;                       // point lights follow the directional lights
+  int nSpot;                        // spot lights follow the point lights
+  LightPrepared light[MAX_LIGHTS];
+} LightingPrepared;
+
 // Structure to represent lighting
 typedef struct
 {
   int nLights;
   Light light[MAX_LIGHTS];
+  LightingPrepared prepared; // cached by lighting_prepare for lighting_shadeVertices
 } Lighting;
 
 /* Function prototypes for lighting operations */
@@ -41,5 +69,9 @@ void lighting_init(Lighting *l);
 void lighting_clear(Lighting *l);                                                                                          // reset a lighting structure to 0 lights
 void lighting_add(Lighting *l, LightType type, Color *c, Vector *dir, Point *pos, float cutoff, float sharpness);          // adds a light to a lighting structure
 void lighting_shading(Lighting *l, Vector *N, Vector *V, Point *P, Color *Cb, Color *CS, float s, int oneSided, Color *c); // computes the shading of a point given the parameters and put the result in c
+void lighting_prepare(Lighting *l);                                                                                         // precomputes per-light constants for batch shading
+void lighting_shadeVertices(Lighting *l, int n, Point *P, Vector *N, Point *viewer, Color *Cb, Color *Cs, float s, int oneSided, Color *c); // shades n vertices at once
+void lighting_shadeGBuffer(Lighting *l, Image *src, Point *viewer, int rowStart, int rowEnd);                              // lights the deferred samples of the given rows
+void lighting_resolveGBuffer(Lighting *l, Image *src, Point *viewer);                                                      // lights every deferred sample, once per frame
 
 #endif // LIGHTING_H
\ No newline at end of file
@@ -9,33 +9,37 @@
 
 typedef struct
 {
-  double m[4][4];
+  Real m[4][4];
 } Matrix;
 
 // Function prototypes
 void matrix_print(Matrix *m, FILE *fp);
 void matrix_clear(Matrix *m);
 void matrix_identity(Matrix *m);
-double matrix_get(Matrix *m, int row, int col);
-void matrix_set(Matrix *m, int row, int col, double val);
+Real matrix_get(Matrix *m, int row, int col);
+void matrix_set(Matrix *m, int row, int col, Real val);
 void matrix_copy(Matrix *to, Matrix *from);
 void matrix_transpose(Matrix *m);
 void matrix_multiply(Matrix *left, Matrix *right, Matrix *result);
+int matrix_isAffine(Matrix *m);
+void matrix_xformPoints(Matrix *m, Point *src, Point *dst, int n);
+void matrix_xformVectors(Matrix *m, Vector *src, Vector *dst, int n);
 void matrix_xformPoint(Matrix *m, Point *p, Point *q);
 void matrix_xformVector(Matrix *m, Vector *v, Vector *q);
 void matrix_xformPolygon(Matrix *m, Polygon *p);
 void matrix_xformPolyline(Matrix *m, Polyline *p);
 void matrix_xformLine(Matrix *m, Line *l);
-void matrix_scale2D(Matrix *m, double sx, double sy);
-void matrix_rotateZ(Matrix *m, double cth, double sth);
-void matrix_translate2D(Matrix *m, double tx, double ty);
-void matrix_shear2D(Matrix *m, double shx, double shy);
-void matrix_translate(Matrix *m, double tx, double ty, double tz);
-void matrix_scale(Matrix *m, double sx, double sy, double sz);
-void matrix_rotateX(Matrix *m, double cth, double sth);
-void matrix_rotateY(Matrix *m, double cth, double sth);
+void matrix_scale2D(Matrix *m, Real sx, Real sy);
+void matrix_rotateZ(Matrix *m, Real cth, Real sth);
+void matrix_translate2D(Matrix *m, Real tx, Real ty);
+void matrix_shear2D(Matrix *m, Real shx, Real shy);
+void matrix_translate(Matrix *m, Real tx, Real ty, Real tz);
+void matrix_scale(Matrix *m, Real sx, Real sy, Real sz);
+void matrix_rotateX(Matrix *m, Real cth, Real sth);
+void matrix_rotateY(Matrix *m, Real cth, Real sth);
 void matrix_rotateXYZ(Matrix *m, Vector *u, Vector *v, Vector *w);
-void matrix_shearZ(Matrix *m, double shx, double shy);
-void matrix_perspective(Matrix *m, double d);
+void matrix_shearZ(Matrix *m, Real shx, Real shy);
+void matrix_perspective(Matrix *m, Real d);
+int matrix_centerOfProjection(Matrix *vtm, Point *cop);
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef MESH_H
+
+#define MESH_H
+
+#include <stdio.h>
+#include "polygon.h"
+
+// Structure to represent an indexed triangle mesh whose vertices are shared by the triangles using them
+typedef struct
+{
+  int oneSided;
+  int zBuffer;
+  int nVertex;
+  Point *vertex;     // vertex buffer
+  Vector *normal;    // per-vertex normals, or NULL
+  Color *color;      // per-vertex colors, or NULL
+  int nTriangle;
+  int *index;        // index buffer, three vertex indices per triangle
+} Mesh;
+
+/* Mesh Methods */
+Mesh *mesh_create(void);
+void mesh_free(Mesh *m);
+void mesh_init(Mesh *m);
+void mesh_clear(Mesh *m);
+int mesh_set(Mesh *m, int numV, Point *vlist, Vector *nlist, Color *clist, int numT, int *ilist);
+void mesh_setSided(Mesh *m, int oneSided);
+void mesh_zBuffer(Mesh *m, int flag);
+void mesh_copy(Mesh *to, Mesh *from);
+int mesh_computeNormals(Mesh *m);
+void mesh_print(Mesh *m, FILE *fp);
+
+#endif // MESH_H
@@ -5,9 +5,12 @@
 #include "point.h"
 #include "shape.h"
 #include "polygon.h"
+#include "mesh.h"
 #include "matrix.h"
 #include "drawstate.h"
 #include "bezier.h"
+#include "raster.h"
+#include "clip.h"
 
 // Enumerated type for the object type method
 typedef enum
@@ -24,7 +27,8 @@ typedef enum
   ObjSurfaceColor,
   ObjSurfaceCoeff,
   ObjLight,
-  ObjModule
+  ObjModule,
+  ObjMesh
 } ObjectType;
 
 // Union to hold the different types of objects
@@ -34,6 +38,7 @@ typedef union
   Line line;
   Polyline polyline;
   Polygon polygon;
+  Mesh mesh;
   Matrix matrix;
   Color color;
   float coeff;
@@ -53,6 +58,14 @@ typedef struct
 {
   Element *head;
   Element *tail;
+  Point boundMin;          // minimum corner of the cached object-space bounding box
+  Point boundMax;          // maximum corner of the cached object-space bounding box
+  int boundEmpty;          // whether the module contains no drawable geometry
+  int boundDepthTested;    // whether everything the module draws is depth tested, so it can be occluded
+  int boundDirty;          // whether the module or a submodule changed since the bounds were cached
+  void **parent;           // modules that include this one, dirtied along with it
+  int nParents;
+  int parentCapacity;
 } Module;
 
 /* Function prototypes for elements */
@@ -71,7 +84,10 @@ void module_translate2D(Module *md, double tx, double ty);
 void module_scale2D(Module *md, double sx, double sy);
 void module_rotateZ(Module *md, double cth, double sth);
 void module_shear2D(Module *md, double shx, double shy);
+int module_bounds(Module *md, Point *min, Point *max);
 void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src);
+void module_drawParallel(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src, Rasterizer *raster);
+void module_drawMesh(Mesh *mesh, Matrix *LTM, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src, Point *cop, Rasterizer *raster);
 
 void module_translate(Module *md, double tx, double ty, double tz);
 void module_scale(Module *md, double sx, double sy, double sz);
@@ -89,6 +105,7 @@ void module_point(Module *md, Point *p);
 void module_line(Module *md, Line *p);
 void module_polyline(Module *md, Polyline *p);
 void module_polygon(Module *md, Polygon *p);
+void module_mesh(Module *md, Mesh *m);
 void module_cube(Module *md, int solid);
 void module_cylinder(Module *md, int sides, int solid);
 void module_sphere(Module *md, int slices, int stacks, int solid);
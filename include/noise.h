@@ -0,0 +1,44 @@
+#ifndef NOISE_H
+
+#define NOISE_H
+
+#include "image.h"
+#include "threadpool.h"
+
+// Number of samples the row evaluator computes at a time, one per vector lane
+#define NOISE_LANES 8
+
+// Rows of the image handed to a thread at a time by noise_fill
+#define NOISE_BAND_ROWS 8
+
+// Structure to represent one Perlin noise generator; each has its own permutation table, so generators can be used
+// from several threads at once
+typedef struct
+{
+  unsigned char perm[512];     // shuffled 0..255, repeated so lookups never wrap
+  unsigned char gradient[512]; // gradient picked by each hash, perm[i] % 12
+} Noise;
+
+// Structure to configure a multi-octave noise fill
+typedef struct
+{
+  int octaves;      // number of octaves summed
+  float frequency;  // noise cells per pixel in the first octave
+  float lacunarity; // frequency multiplier from one octave to the next
+  float gain;       // amplitude multiplier from one octave to the next
+  int turbulence;   // sum the absolute value of each octave instead of the signed value
+  int threeD;       // sample 3D noise in the plane z, e.g. to animate over time
+  float z;          // plane sampled by 3D noise, in noise cells
+  ThreadPool *pool; // pool noise_fill shares the rows across, or NULL to fill on the calling thread
+} NoiseParams;
+
+/* Function prototypes for noise generation */
+void noise_init(Noise *n, unsigned int seed);
+void noise_params(NoiseParams *p);
+float noise_2D(const Noise *n, float x, float y);
+float noise_3D(const Noise *n, float x, float y, float z);
+float noise_fbm(const Noise *n, const NoiseParams *p, float x, float y);
+void noise_row(const Noise *n, const NoiseParams *p, float x0, float y, float dx, int count, float *out);
+void noise_fill(Image *dst, const Noise *n, const NoiseParams *p);
+
+#endif // NOISE_H
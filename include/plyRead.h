@@ -6,12 +6,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include "polygon.h"
+#include "mesh.h"
 
 typedef enum
 {
   type_float32,
   type_uint8,
   type_int32,
+  type_int8,
+  type_int16,
+  type_uint16,
+  type_uint32,
+  type_float64,
   type_list,
   type_none
 } ply_type;
@@ -22,10 +28,12 @@ typedef struct
   ply_type listCardType;
   ply_type listDataType;
   char name[32];
+  int slot; // where the reader stores the value, or -1 if it is skipped
   void *next;
 } ply_property;
 
 ply_type plyType(char *buffer);
 int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int estNormals);
+int readPLYMesh(char filename[], Mesh *mesh, int estNormals);
 
 #endif // PLYREAD_H
\ No newline at end of file
@@ -6,16 +6,24 @@
 #include <math.h>
 #include "color.h"
 
+// Scalar type of points, vectors and matrices. Define GRAPHICS_SINGLE_PRECISION to use float;
+// the library and every program linked with it must be built with the same setting.
+#ifdef GRAPHICS_SINGLE_PRECISION
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 // Structure to represent a point
 typedef struct
 {
-  double val[4]; // four element vector of doubles
+  Real val[4]; // four element vector of reals
 } Point;
 
 /* Function prototypes for point operations */ 
-void point_set2D(Point *p, double x, double y);
-void point_set3D(Point *p, double x, double y, double z);
-void point_set(Point *p, double x, double y, double z, double h);
+void point_set2D(Point *p, Real x, Real y);
+void point_set3D(Point *p, Real x, Real y, Real z);
+void point_set(Point *p, Real x, Real y, Real z, Real h);
 float point_distance(Point *p1, Point *p2);
 void point_add(Point *p1, Point *p2, Point *result);
 void point_scale(Point *p, float scale, Point *result);
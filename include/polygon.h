@@ -4,6 +4,7 @@
 
 #include "vector.h"
 #include "drawstate.h"
+#include "arena.h"
 
 typedef struct
 {
@@ -13,6 +14,7 @@ typedef struct
   Color *color;
   int zBuffer;
   Vector *normal;
+  Point *vertexWorld; // world-space vertex positions for per-pixel shading, or NULL
 } Polygon;
 
 /* Polygon Methods */
@@ -28,12 +30,15 @@ void polygon_setNormals(Polygon *p, int numV, Vector *nlist);
 void polygon_setAll(Polygon *p, int numV, Point *vlist, Color *clist, Vector *nlist, int zBuffer, int oneSided);
 void polygon_zBuffer(Polygon *p, int flag);
 void polygon_copy(Polygon *to, Polygon *from);
+int polygon_copyArena(Polygon *to, Polygon *from, Arena *arena, int withColor);
 void polygon_print(Polygon *p, FILE *fp);
 void polygon_normalize(Polygon *p);
 void polygon_draw(Polygon *p, Image *src, Color c);
 void polygon_drawFill(Polygon *p, Image *src, Color c);
 void polygon_drawFillB(Polygon *p, Image *src, Color c);
 void polygon_shade(Polygon *p, DrawState *ds, Lighting *lighting);
+int polygon_backFacing(Polygon *p, Point *viewer);
 void polygon_drawShade(Polygon *p, Image *src, DrawState *ds, Lighting *lighting);
+void polygon_drawShadeTile(Polygon *p, Image *src, DrawState *ds, Lighting *lighting, int rowStart, int colStart, int rowEnd, int colEnd);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef RASTER_H
+
+#define RASTER_H
+
+#include "polygon.h"
+#include "threadpool.h"
+
+#define RASTER_TILE_SIZE 64
+
+// Structure to represent a screen-space polygon waiting to be rasterized
+typedef struct
+{
+  int nVertex;  // number of vertices
+  int first;    // index of the first vertex in the rasterizer's vertex and color pools
+  int hasColor; // whether the polygon carries per-vertex colors
+  int hasPhong; // whether the polygon carries world-space positions and normals, for Phong or deferred shading
+  int oneSided; // whether the polygon is lit from the front only
+  DrawState ds; // draw state at the time the polygon was submitted
+  Lighting *lighting; // lights for per-pixel shading, or NULL
+} RasterItem;
+
+// Structure to represent a tile-binned rasterizer that fills screen tiles on a thread pool
+typedef struct
+{
+  ThreadPool *pool; // worker threads
+  int tileSize;     // width and height of a tile in pixels, a multiple of IMAGE_TILE_SIZE
+  int rows, cols;   // size of the image the bins were laid out for
+  int tilesX;       // number of tile columns
+  int tilesY;       // number of tile rows
+
+  RasterItem *item; // submitted polygons, in submission order
+  int nItems;
+  int itemCapacity;
+
+  Point *vertex; // vertex pool shared by the submitted polygons
+  Color *color;  // color pool, parallel to the vertex pool
+  Point *world;  // world-space position pool for Phong and deferred polygons, parallel to the vertex pool
+  Vector *normal; // world-space normal pool for Phong and deferred polygons, parallel to the vertex pool
+  int nVertex;
+  int vertexCapacity;
+
+  int **bin;          // per tile, the indices of the items that overlap it
+  int *binCount;      // number of items in each bin
+  int *binCapacity;   // allocated length of each bin
+  Image *target;      // image being rendered during a flush
+} Rasterizer;
+
+/* Function prototypes for rasterizer operations */
+Rasterizer *rasterizer_create(int nThreads, int tileSize);
+void rasterizer_delete(Rasterizer *r);
+void rasterizer_submit(Rasterizer *r, Polygon *p, DrawState *ds, Lighting *lighting, Image *src);
+void rasterizer_flush(Rasterizer *r, Image *src);
+void rasterizer_shadeGBuffer(Rasterizer *r, Image *src, Lighting *lighting, Point *viewer);
+
+#endif // RASTER_H
@@ -2,6 +2,10 @@
 #define SWARM_H
 
 #include "module.h"
+#include "threadpool.h"
+
+// Agents handed to a thread at a time by steer_swarm
+#define SWARM_CHUNK 1024
 
 typedef struct {
     Point position;
@@ -11,8 +15,44 @@ typedef struct {
     float maxForce;
 } Agent;
 
+// Uniform grid of cells hashed into buckets, rebuilt every step; the agents are sorted by bucket, with what the
+// steering rules read copied in that order so a neighbor query reads it contiguously
+typedef struct {
+    float cellSize;  // side of a cell
+    int nBuckets;    // hash table size, a power of two
+    int nAgents;     // agents in the grid
+    int capacity;    // agents the arrays below can hold
+    int *start;      // first sorted agent of each bucket, nBuckets + 1 of them
+    int *order;      // agent index of each sorted agent
+    int *slot;       // sorted position of each agent (its bucket while building)
+    float *pos;      // sorted positions, x y z per agent
+    float *vel;      // sorted velocities, x y z per agent
+    float *limit;    // sorted maximum speed and force, 2 per agent
+    float *acc;      // sorted steering accelerations, x y z per agent, written by steer_swarm
+} SwarmGrid;
+
+// Weights and radii of the boids steering rules
+typedef struct {
+    float neighborRadius;   // agents within this distance are flockmates for alignment and cohesion
+    float separationRadius; // flockmates within this distance push the agent away
+    float separation;       // weight of the separation rule
+    float alignment;        // weight of the alignment rule
+    float cohesion;         // weight of the cohesion rule
+    float boundRadius;      // agents farther than this from the origin steer back toward it, or 0 for no bound
+    int maxNeighbors;       // flockmates considered per agent, or 0 for all
+    ThreadPool *pool;       // pool steer_swarm shares the agents across, or NULL to run on the calling thread
+} SwarmParams;
+
 void initialize_swarm(Agent *swarm, int numAgents, int cols, int rows);
 void update_swarm(Agent *swarm, int numAgents, float maxSpeed);
 void render_swarm(Agent *swarm, int numAgents, Module *m, Module *figure);
 
+int swarm_gridInit(SwarmGrid *grid, float cellSize);
+int swarm_gridBuild(SwarmGrid *grid, const Agent *swarm, int numAgents);
+int swarm_gridQuery(const SwarmGrid *grid, const Point *center, float radius, int *neighbors, int maxNeighbors);
+void swarm_gridFree(SwarmGrid *grid);
+
+void swarm_params(SwarmParams *p);
+void steer_swarm(Agent *swarm, int numAgents, SwarmGrid *grid, const SwarmParams *p);
+
 #endif // SWARM_H
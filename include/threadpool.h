@@ -0,0 +1,33 @@
+#ifndef THREADPOOL_H
+
+#define THREADPOOL_H
+
+#include <pthread.h>
+
+// Function run for each task of a job; task is the index of the task within the job
+typedef void (*ThreadTask)(void *arg, int task);
+
+// Structure to represent a pool of persistent worker threads
+typedef struct
+{
+  int nThreads;           // number of threads working on a job, including the calling thread
+  pthread_t *threads;     // worker threads (nThreads - 1 of them)
+  pthread_mutex_t lock;   // protects the job fields below
+  pthread_cond_t wake;    // signalled when a job is posted or the pool is shutting down
+  pthread_cond_t done;    // signalled when the last task of a job finishes
+  ThreadTask func;        // task function of the current job
+  void *arg;              // argument passed to every task of the current job
+  int nTasks;             // number of tasks in the current job
+  int nextTask;           // next task index to hand out
+  int nFinished;          // number of tasks completed
+  unsigned long job;      // incremented every time a job is posted
+  int quit;               // set when the pool is being deleted
+} ThreadPool;
+
+/* Function prototypes for thread pool operations */
+int threadpool_cpuCount(void);
+ThreadPool *threadpool_create(int nThreads);
+void threadpool_delete(ThreadPool *pool);
+void threadpool_run(ThreadPool *pool, int nTasks, ThreadTask func, void *arg);
+
+#endif // THREADPOOL_H
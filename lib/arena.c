@@ -0,0 +1,97 @@
+// These functions provide an arena allocator for memory that lives for one draw call or frame.
+// Allocation bumps a pointer through a chain of large blocks; resetting rewinds to the first
+// block without freeing anything, so later frames reuse the same memory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "arena.h"
+
+static _Thread_local Arena frameArena = {NULL, NULL, 0, ARENA_BLOCK_SIZE};
+
+// Initialize an empty arena; blockSize <= 0 uses ARENA_BLOCK_SIZE
+void arena_init(Arena *a, size_t blockSize)
+{
+  a->first = NULL;
+  a->block = NULL;
+  a->used = 0;
+  a->blockSize = blockSize > 0 ? blockSize : ARENA_BLOCK_SIZE;
+}
+
+// Free every block of the arena and leave it empty
+void arena_clear(Arena *a)
+{
+  ArenaBlock *b = a->first;
+  while (b)
+  {
+    ArenaBlock *next = b->next;
+    free(b);
+    b = next;
+  }
+  a->first = NULL;
+  a->block = NULL;
+  a->used = 0;
+}
+
+// Allocate size bytes aligned to ARENA_ALIGN; returns NULL if memory runs out
+void *arena_alloc(Arena *a, size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (a->block && a->used + size <= a->block->size)
+  {
+    void *p = a->block->data + a->used;
+    a->used += size;
+    return p;
+  }
+
+  // Move on to the next kept block, or link in a new one when it is missing or too small
+  ArenaBlock *next = a->block ? a->block->next : a->first;
+  if (!next || next->size < size)
+  {
+    size_t bytes = size > a->blockSize ? size : a->blockSize;
+    ArenaBlock *b = (ArenaBlock *)malloc(sizeof(ArenaBlock) + bytes);
+    if (!b)
+    {
+      fprintf(stderr, "Unable to allocate arena block\n");
+      return NULL;
+    }
+    b->size = bytes;
+    b->next = next;
+    if (a->block)
+      a->block->next = b;
+    else
+      a->first = b;
+    next = b;
+  }
+
+  a->block = next;
+  a->used = size;
+  return next->data;
+}
+
+// Remember the current position of the arena
+ArenaMark arena_mark(Arena *a)
+{
+  ArenaMark mark = {a->block, a->used};
+  return mark;
+}
+
+// Release everything allocated since the mark was taken
+void arena_release(Arena *a, ArenaMark mark)
+{
+  a->block = mark.block;
+  a->used = mark.used;
+}
+
+// Release everything allocated from the arena, keeping its blocks for reuse
+void arena_reset(Arena *a)
+{
+  a->block = NULL;
+  a->used = 0;
+}
+
+// Returns the calling thread's frame arena, which module_draw resets when it finishes
+Arena *arena_frame(void)
+{
+  return &frameArena;
+}
@@ -0,0 +1,361 @@
+// These functions provide view volume clipping for points, lines, and polygons.
+// Geometry is clipped after the VTM and before normalization, where the view
+// volume is 0 <= x <= cols * h, 0 <= y <= rows * h, z <= 1, and h > 0.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "clip.h"
+
+// Structure to represent one side of the double buffer used while clipping
+typedef struct
+{
+  Point *vertex;
+  Color *color;
+  Vector *normal;
+  Point *world;
+  int capacity;
+} ClipBuffer;
+
+static _Thread_local ClipBuffer clipBuffer[2];
+static _Thread_local Polygon clipPolygon;
+
+// Grow a clip buffer to hold at least n vertices; returns 0 on success
+static int clipBuffer_reserve(ClipBuffer *buf, int n)
+{
+  if (n <= buf->capacity)
+  {
+    return 0;
+  }
+
+  int capacity = buf->capacity ? buf->capacity : 16;
+  while (capacity < n)
+  {
+    capacity *= 2;
+  }
+
+  Point *vertex = realloc(buf->vertex, sizeof(Point) * capacity);
+  if (vertex)
+    buf->vertex = vertex;
+  Color *color = realloc(buf->color, sizeof(Color) * capacity);
+  if (color)
+    buf->color = color;
+  Vector *normal = realloc(buf->normal, sizeof(Vector) * capacity);
+  if (normal)
+    buf->normal = normal;
+  Point *world = realloc(buf->world, sizeof(Point) * capacity);
+  if (world)
+    buf->world = world;
+  if (!vertex || !color || !normal || !world)
+  {
+    printf("Error: unable to allocate clip buffer\n");
+    return -1;
+  }
+
+  buf->capacity = capacity;
+  return 0;
+}
+
+// Signed distance of a homogeneous point from a clipping plane; inside when >= 0
+static double clip_distance(Point *p, int plane, int rows, int cols)
+{
+  switch (plane)
+  {
+  case CLIP_LEFT:
+    return p->val[0];
+  case CLIP_RIGHT:
+    return cols * p->val[3] - p->val[0];
+  case CLIP_TOP:
+    return p->val[1];
+  case CLIP_BOTTOM:
+    return rows * p->val[3] - p->val[1];
+  case CLIP_NEAR:
+    return p->val[3] - CLIP_NEAR_EPSILON;
+  default:
+    return 1.0 - p->val[2];
+  }
+}
+
+// Compute the outcode of a point in homogeneous screen coordinates
+int clip_outcode(Point *p, int rows, int cols)
+{
+  int code = 0;
+
+  if (p->val[0] < 0.0)
+    code |= CLIP_LEFT;
+  if (p->val[0] > cols * p->val[3])
+    code |= CLIP_RIGHT;
+  if (p->val[1] < 0.0)
+    code |= CLIP_TOP;
+  if (p->val[1] > rows * p->val[3])
+    code |= CLIP_BOTTOM;
+  if (p->val[3] < CLIP_NEAR_EPSILON)
+    code |= CLIP_NEAR;
+  if (p->val[2] > 1.0)
+    code |= CLIP_FAR;
+
+  return code;
+}
+
+// Linearly interpolate between two points
+static void clip_lerp(Point *a, Point *b, double t, Point *out)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    out->val[i] = a->val[i] + (b->val[i] - a->val[i]) * t;
+  }
+}
+
+// Clip the polygon against one plane with Sutherland-Hodgman; returns the new vertex count
+static int clip_plane(ClipBuffer *in, int n, ClipBuffer *out, int plane, int rows, int cols, int hasColor, int hasNormal, int hasWorld)
+{
+  int m = 0;
+  int prev = n - 1;
+  double dPrev = clip_distance(&in->vertex[prev], plane, rows, cols);
+
+  // Each edge emits at most two vertices
+  if (clipBuffer_reserve(out, 2 * n))
+  {
+    return 0;
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    double d = clip_distance(&in->vertex[i], plane, rows, cols);
+
+    // Emit the intersection when the edge crosses the plane
+    if ((dPrev >= 0.0) != (d >= 0.0))
+    {
+      double t = dPrev / (dPrev - d);
+      clip_lerp(&in->vertex[prev], &in->vertex[i], t, &out->vertex[m]);
+      if (hasColor)
+      {
+        for (int c = 0; c < 3; c++)
+        {
+          out->color[m].c[c] = in->color[prev].c[c] + (in->color[i].c[c] - in->color[prev].c[c]) * t;
+        }
+      }
+      if (hasNormal)
+      {
+        clip_lerp(&in->normal[prev], &in->normal[i], t, &out->normal[m]);
+      }
+      if (hasWorld)
+      {
+        clip_lerp(&in->world[prev], &in->world[i], t, &out->world[m]);
+      }
+      m++;
+    }
+
+    // Keep vertices on the inside of the plane
+    if (d >= 0.0)
+    {
+      out->vertex[m] = in->vertex[i];
+      if (hasColor)
+        out->color[m] = in->color[i];
+      if (hasNormal)
+        out->normal[m] = in->normal[i];
+      if (hasWorld)
+        out->world[m] = in->world[i];
+      m++;
+    }
+
+    prev = i;
+    dPrev = d;
+  }
+
+  return m;
+}
+
+// Clip a polygon in homogeneous screen coordinates to the view volume.
+// Returns p when it is entirely inside, NULL when nothing is visible, or a
+// polygon that borrows thread-local storage until the next call on this thread;
+// the returned polygon must not be cleared.
+Polygon *polygon_clip(Polygon *p, int rows, int cols)
+{
+  static const int planes[] = {CLIP_NEAR, CLIP_FAR, CLIP_LEFT, CLIP_RIGHT, CLIP_TOP, CLIP_BOTTOM};
+  int codeAnd = ~0;
+  int codeOr = 0;
+  int hasColor = p->color != NULL;
+  int hasNormal = p->normal != NULL;
+  int hasWorld = p->vertexWorld != NULL;
+
+  if (p->nVertex < 3)
+  {
+    return NULL;
+  }
+
+  for (int i = 0; i < p->nVertex; i++)
+  {
+    int code = clip_outcode(&p->vertex[i], rows, cols);
+    codeAnd &= code;
+    codeOr |= code;
+  }
+
+  // Trivial accept and trivial reject
+  if (!codeOr)
+  {
+    return p;
+  }
+  if (codeAnd)
+  {
+    return NULL;
+  }
+
+  // Copy the polygon into the first buffer
+  ClipBuffer *in = &clipBuffer[0];
+  ClipBuffer *out = &clipBuffer[1];
+  int n = p->nVertex;
+  if (clipBuffer_reserve(in, n))
+  {
+    return NULL;
+  }
+  for (int i = 0; i < n; i++)
+  {
+    in->vertex[i] = p->vertex[i];
+    if (hasColor)
+      in->color[i] = p->color[i];
+    if (hasNormal)
+      in->normal[i] = p->normal[i];
+    if (hasWorld)
+      in->world[i] = p->vertexWorld[i];
+  }
+
+  // Only the planes that some vertex lies outside of need a pass
+  for (int k = 0; k < 6 && n >= 3; k++)
+  {
+    if (codeOr & planes[k])
+    {
+      ClipBuffer *tmp;
+      n = clip_plane(in, n, out, planes[k], rows, cols, hasColor, hasNormal, hasWorld);
+      tmp = in;
+      in = out;
+      out = tmp;
+    }
+  }
+
+  if (n < 3)
+  {
+    return NULL;
+  }
+
+  clipPolygon.oneSided = p->oneSided;
+  clipPolygon.zBuffer = p->zBuffer;
+  clipPolygon.nVertex = n;
+  clipPolygon.vertex = in->vertex;
+  clipPolygon.color = hasColor ? in->color : NULL;
+  clipPolygon.normal = hasNormal ? in->normal : NULL;
+  clipPolygon.vertexWorld = hasWorld ? in->world : NULL;
+  return &clipPolygon;
+}
+
+// Compute the outcode of a normalized point against the pixel rectangle
+static int clip_screenOutcode(double x, double y, double xmax, double ymax)
+{
+  int code = 0;
+
+  if (x < 0.0)
+    code |= CLIP_LEFT;
+  else if (x > xmax)
+    code |= CLIP_RIGHT;
+  if (y < 0.0)
+    code |= CLIP_TOP;
+  else if (y > ymax)
+    code |= CLIP_BOTTOM;
+
+  return code;
+}
+
+// Move a normalized endpoint along the line by parameter t, keeping depth perspective correct
+static void clip_screenLerp(Point *a, Point *b, double t, Point *out)
+{
+  double za = a->val[2];
+  double zb = b->val[2];
+
+  out->val[0] = a->val[0] + (b->val[0] - a->val[0]) * t;
+  out->val[1] = a->val[1] + (b->val[1] - a->val[1]) * t;
+  if (za > 0.0 && zb > 0.0)
+    out->val[2] = 1.0 / (1.0 / za + (1.0 / zb - 1.0 / za) * t);
+  else
+    out->val[2] = za + (zb - za) * t;
+  out->val[3] = 1.0;
+}
+
+// Clip a line in homogeneous screen coordinates to the view volume and normalize it.
+// The near and far planes are clipped before the divide, then the endpoints are
+// clipped to the image with Cohen-Sutherland; returns 0 if nothing is visible.
+int line_clip(Line *l, int rows, int cols)
+{
+  static const int planes[] = {CLIP_NEAR, CLIP_FAR};
+  double xmax = cols - 1;
+  double ymax = rows - 1;
+  Point a = l->a;
+  Point b = l->b;
+
+  for (int k = 0; k < 2; k++)
+  {
+    double da = clip_distance(&l->a, planes[k], rows, cols);
+    double db = clip_distance(&l->b, planes[k], rows, cols);
+
+    if (da < 0.0 && db < 0.0)
+    {
+      return 0;
+    }
+    if (da < 0.0)
+    {
+      clip_lerp(&a, &b, da / (da - db), &l->a);
+    }
+    else if (db < 0.0)
+    {
+      clip_lerp(&a, &b, da / (da - db), &l->b);
+    }
+    a = l->a;
+    b = l->b;
+  }
+
+  line_normalize(l);
+
+  int codeA = clip_screenOutcode(l->a.val[0], l->a.val[1], xmax, ymax);
+  int codeB = clip_screenOutcode(l->b.val[0], l->b.val[1], xmax, ymax);
+
+  while (codeA | codeB)
+  {
+    // Both endpoints share an outside region
+    if (codeA & codeB)
+    {
+      return 0;
+    }
+
+    // Move the outside endpoint to the boundary it crosses
+    int code = codeA ? codeA : codeB;
+    double dx = l->b.val[0] - l->a.val[0];
+    double dy = l->b.val[1] - l->a.val[1];
+    double t;
+    if (code & CLIP_LEFT)
+      t = (0.0 - l->a.val[0]) / dx;
+    else if (code & CLIP_RIGHT)
+      t = (xmax - l->a.val[0]) / dx;
+    else if (code & CLIP_TOP)
+      t = (0.0 - l->a.val[1]) / dy;
+    else
+      t = (ymax - l->a.val[1]) / dy;
+
+    Point p;
+    clip_screenLerp(&l->a, &l->b, t, &p);
+    if (code & (CLIP_LEFT | CLIP_RIGHT))
+      p.val[0] = code & CLIP_LEFT ? 0.0 : xmax;
+    else
+      p.val[1] = code & CLIP_TOP ? 0.0 : ymax;
+
+    if (codeA)
+    {
+      l->a = p;
+      codeA = clip_screenOutcode(p.val[0], p.val[1], xmax, ymax);
+    }
+    else
+    {
+      l->b = p;
+      codeB = clip_screenOutcode(p.val[0], p.val[1], xmax, ymax);
+    }
+  }
+
+  return 1;
+}
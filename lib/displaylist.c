@@ -0,0 +1,434 @@
+// These functions compile a module hierarchy into a flat display list and draw it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "displaylist.h"
+
+// Make room for one more item and n more vertices; returns the new item or NULL
+static DrawItem *displaylist_append(DisplayList *dl, DrawItemType type, int n, DrawState *ds)
+{
+  if (dl->nItems == dl->itemCapacity)
+  {
+    int capacity = dl->itemCapacity ? dl->itemCapacity * 2 : 64;
+    DrawItem *item = (DrawItem *)realloc(dl->item, capacity * sizeof(DrawItem));
+    if (!item)
+    {
+      return NULL;
+    }
+    dl->item = item;
+    dl->itemCapacity = capacity;
+  }
+
+  if (dl->nVertex + n > dl->vertexCapacity)
+  {
+    int capacity = dl->vertexCapacity ? dl->vertexCapacity * 2 : 256;
+    while (capacity < dl->nVertex + n)
+    {
+      capacity *= 2;
+    }
+    Point *vertex = (Point *)realloc(dl->vertex, capacity * sizeof(Point));
+    if (!vertex)
+    {
+      return NULL;
+    }
+    dl->vertex = vertex;
+    Vector *normal = (Vector *)realloc(dl->normal, capacity * sizeof(Vector));
+    if (!normal)
+    {
+      return NULL;
+    }
+    dl->normal = normal;
+    Color *color = (Color *)realloc(dl->color, capacity * sizeof(Color));
+    if (!color)
+    {
+      return NULL;
+    }
+    dl->color = color;
+    dl->vertexCapacity = capacity;
+  }
+
+  DrawItem *item = &dl->item[dl->nItems++];
+  item->type = type;
+  item->nVertex = n;
+  item->first = dl->nVertex;
+  item->oneSided = 0;
+  item->zBuffer = 1;
+  item->hasColor = 0;
+  item->hasNormal = 0;
+  item->color = ds->color;
+  item->body = ds->body;
+  item->surface = ds->surface;
+  item->surfaceCoeff = ds->surfaceCoeff;
+
+  dl->nVertex += n;
+  if (type != DrawItemMesh && n > dl->maxVertex)
+  {
+    dl->maxVertex = n;
+  }
+  return item;
+}
+
+// Walk the module like module_draw does, appending its primitives transformed by GTM * LTM
+static void displaylist_compile(DisplayList *dl, Module *md, Matrix *GTM, DrawState *ds)
+{
+  Matrix LTM, M;
+  matrix_identity(&LTM);
+
+  for (Element *e = md->head; e; e = (Element *)e->next)
+  {
+    switch (e->type)
+    {
+    case ObjSurfaceCoeff:
+      ds->surfaceCoeff = e->obj.coeff;
+      break;
+
+    case ObjSurfaceColor:
+      ds->surface = e->obj.color;
+      break;
+
+    case ObjBodyColor:
+      ds->body = e->obj.color;
+      break;
+
+    case ObjColor:
+      ds->color = e->obj.color;
+      break;
+
+    case ObjPoint:
+    {
+      DrawItem *item = displaylist_append(dl, DrawItemPoint, 1, ds);
+      if (item)
+      {
+        matrix_multiply(GTM, &LTM, &M);
+        matrix_xformPoint(&M, &e->obj.point, &dl->vertex[item->first]);
+        vector_set(&dl->normal[item->first], 0.0, 0.0, 0.0);
+      }
+      break;
+    }
+
+    case ObjLine:
+    {
+      DrawItem *item = displaylist_append(dl, DrawItemLine, 2, ds);
+      if (item)
+      {
+        matrix_multiply(GTM, &LTM, &M);
+        matrix_xformPoint(&M, &e->obj.line.a, &dl->vertex[item->first]);
+        matrix_xformPoint(&M, &e->obj.line.b, &dl->vertex[item->first + 1]);
+        vector_set(&dl->normal[item->first], 0.0, 0.0, 0.0);
+        vector_set(&dl->normal[item->first + 1], 0.0, 0.0, 0.0);
+        item->zBuffer = e->obj.line.zBuffer;
+      }
+      break;
+    }
+
+    case ObjPolygon:
+    {
+      Polygon *p = &e->obj.polygon;
+      if (p->nVertex < 3)
+      {
+        break;
+      }
+      DrawItem *item = displaylist_append(dl, DrawItemPolygon, p->nVertex, ds);
+      if (item)
+      {
+        matrix_multiply(GTM, &LTM, &M);
+        matrix_xformPoints(&M, p->vertex, &dl->vertex[item->first], p->nVertex);
+        if (p->normal)
+        {
+          matrix_xformVectors(&M, p->normal, &dl->normal[item->first], p->nVertex);
+        }
+        else
+        {
+          for (int i = 0; i < p->nVertex; i++)
+          {
+            vector_set(&dl->normal[item->first + i], 0.0, 0.0, 0.0);
+          }
+        }
+        if (p->color)
+        {
+          memcpy(&dl->color[item->first], p->color, p->nVertex * sizeof(Color));
+        }
+        item->hasColor = p->color != NULL;
+        item->hasNormal = p->normal != NULL;
+        item->oneSided = p->oneSided;
+        item->zBuffer = p->zBuffer;
+      }
+      break;
+    }
+
+    case ObjMesh:
+    {
+      // The mesh keeps its shared vertices, so each is still transformed and lit once per draw
+      Mesh *mesh = &e->obj.mesh;
+      int nIndex = 3 * mesh->nTriangle;
+      if (mesh->nVertex < 3 || mesh->nTriangle < 1)
+      {
+        break;
+      }
+      if (dl->nIndex + nIndex > dl->indexCapacity)
+      {
+        int capacity = dl->indexCapacity ? dl->indexCapacity * 2 : 768;
+        while (capacity < dl->nIndex + nIndex)
+        {
+          capacity *= 2;
+        }
+        int *index = (int *)realloc(dl->index, capacity * sizeof(int));
+        if (!index)
+        {
+          break;
+        }
+        dl->index = index;
+        dl->indexCapacity = capacity;
+      }
+      DrawItem *item = displaylist_append(dl, DrawItemMesh, mesh->nVertex, ds);
+      if (item)
+      {
+        matrix_multiply(GTM, &LTM, &M);
+        matrix_xformPoints(&M, mesh->vertex, &dl->vertex[item->first], mesh->nVertex);
+        if (mesh->normal)
+        {
+          matrix_xformVectors(&M, mesh->normal, &dl->normal[item->first], mesh->nVertex);
+        }
+        if (mesh->color)
+        {
+          memcpy(&dl->color[item->first], mesh->color, mesh->nVertex * sizeof(Color));
+        }
+        memcpy(&dl->index[dl->nIndex], mesh->index, nIndex * sizeof(int));
+        item->nTriangle = mesh->nTriangle;
+        item->firstIndex = dl->nIndex;
+        dl->nIndex += nIndex;
+        item->hasColor = mesh->color != NULL;
+        item->hasNormal = mesh->normal != NULL;
+        item->oneSided = mesh->oneSided;
+        item->zBuffer = mesh->zBuffer;
+      }
+      break;
+    }
+
+    case ObjMatrix:
+      matrix_multiply(&(e->obj.matrix), &LTM, &LTM);
+      break;
+
+    case ObjIdentity:
+      matrix_identity(&LTM);
+      break;
+
+    case ObjModule:
+    {
+      DrawState tempDS;
+      matrix_multiply(GTM, &LTM, &M);
+      drawstate_copy(&tempDS, ds);
+      displaylist_compile(dl, e->obj.module, &M, &tempDS);
+      break;
+    }
+
+    default:
+      break;
+    }
+  }
+}
+
+// Flatten a module hierarchy into a display list of world-space primitives; GTM may be NULL for identity
+DisplayList *module_compile(Module *md, Matrix *GTM, DrawState *ds)
+{
+  if (!md || !ds)
+  {
+    printf("Null argument passed to module_compile\n");
+    return NULL;
+  }
+
+  DisplayList *dl = (DisplayList *)calloc(1, sizeof(DisplayList));
+  if (!dl)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return NULL;
+  }
+
+  Matrix identity;
+  DrawState state;
+  matrix_identity(&identity);
+  drawstate_copy(&state, ds);
+  displaylist_compile(dl, md, GTM ? GTM : &identity, &state);
+
+  // The draw loop works in these arrays, so it never allocates
+  int n = dl->maxVertex > 0 ? dl->maxVertex : 1;
+  dl->scratchVertex = (Point *)malloc(n * sizeof(Point));
+  dl->scratchNormal = (Vector *)malloc(n * sizeof(Vector));
+  dl->scratchColor = (Color *)malloc(n * sizeof(Color));
+  dl->scratchWorld = (Point *)malloc(n * sizeof(Point));
+  if (!dl->scratchVertex || !dl->scratchNormal || !dl->scratchColor || !dl->scratchWorld)
+  {
+    displaylist_delete(dl);
+    return NULL;
+  }
+
+  return dl;
+}
+
+// Free a display list
+void displaylist_delete(DisplayList *dl)
+{
+  if (!dl)
+  {
+    return;
+  }
+  free(dl->item);
+  free(dl->vertex);
+  free(dl->normal);
+  free(dl->color);
+  free(dl->index);
+  free(dl->scratchVertex);
+  free(dl->scratchNormal);
+  free(dl->scratchColor);
+  free(dl->scratchWorld);
+  free(dl);
+}
+
+// Draw a display list; GTM places the whole list in the world and may be NULL when the list is already in place.
+// Each vertex is taken to the screen by VTM * GTM in one transform; world-space copies are made only for the
+// polygons that are lit or culled. Meshes keep their shared vertices, so each is transformed and lit once.
+// Deferred shading only fills the G-buffer, as in module_draw
+void displaylist_draw(DisplayList *dl, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src)
+{
+  if (!dl || !VTM || !ds || !src)
+  {
+    printf("Null argument passed to displaylist_draw\n");
+    return;
+  }
+
+  DrawState state;
+  Matrix M;
+  Point cop;
+  int perspective = matrix_centerOfProjection(VTM, &cop);
+  drawstate_copy(&state, ds);
+  int deferred = state.shade == ShadeDeferred && lighting;
+  if (deferred && !src->gbuf && image_attachGBuffer(src, 1))
+  {
+    return;
+  }
+  if (lighting)
+  {
+    lighting_prepare(lighting); // pick up any lights moved since the last draw
+  }
+  if (GTM)
+  {
+    matrix_multiply(VTM, GTM, &M);
+  }
+  else
+  {
+    matrix_copy(&M, VTM);
+  }
+
+  for (int k = 0; k < dl->nItems; k++)
+  {
+    DrawItem *item = &dl->item[k];
+    Point *vertex = &dl->vertex[item->first];
+    Vector *normal = &dl->normal[item->first];
+
+    state.color = item->color;
+    state.body = item->body;
+    state.surface = item->surface;
+    state.surfaceCoeff = item->surfaceCoeff;
+
+    switch (item->type)
+    {
+    case DrawItemPoint:
+    {
+      Point X;
+      matrix_xformPoint(&M, &vertex[0], &X);
+      point_normalize(&X);
+      point_draw(&X, src, state.color);
+      break;
+    }
+
+    case DrawItemLine:
+    {
+      Line L;
+      matrix_xformPoint(&M, &vertex[0], &L.a);
+      matrix_xformPoint(&M, &vertex[1], &L.b);
+      L.zBuffer = item->zBuffer;
+      if (line_clip(&L, src->rows, src->cols))
+        line_draw(&L, src, state.color);
+      break;
+    }
+
+    case DrawItemPolygon:
+    {
+      // The polygon borrows the list's and the scratch arrays, so it must not be cleared
+      Polygon P;
+      int cull = perspective && item->oneSided && item->hasNormal && state.shade != ShadeFrame;
+      int gouraud = state.shade == ShadeGouraud && lighting;
+      int perPixel = (state.shade == ShadePhong || state.shade == ShadeDeferred) && lighting && item->hasNormal;
+      polygon_init(&P);
+      P.nVertex = item->nVertex;
+      P.oneSided = item->oneSided;
+      P.zBuffer = item->zBuffer;
+      P.color = item->hasColor ? &dl->color[item->first] : NULL;
+
+      if (cull || gouraud || perPixel)
+      {
+        // Bring the item into world space for the lighting and the facing test; without normals, like
+        // module_draw, it is neither culled nor lit per pixel
+        P.vertex = vertex;
+        P.normal = item->hasNormal ? normal : NULL;
+        if (GTM)
+        {
+          P.vertex = dl->scratchWorld;
+          matrix_xformPoints(GTM, vertex, P.vertex, P.nVertex);
+          if (P.normal)
+          {
+            P.normal = dl->scratchNormal;
+            matrix_xformVectors(GTM, normal, P.normal, P.nVertex);
+          }
+        }
+        if (cull && polygon_backFacing(&P, &cop))
+        {
+          break; // one-sided polygon facing away from the viewer
+        }
+        if (gouraud)
+        {
+          P.color = dl->scratchColor;
+          polygon_shade(&P, &state, lighting);
+        }
+        if (perPixel)
+        {
+          P.vertexWorld = P.vertex; // keep the world-space positions for per-pixel lighting
+        }
+      }
+
+      P.vertex = dl->scratchVertex;
+      matrix_xformPoints(&M, vertex, P.vertex, P.nVertex);
+      Polygon *Q = polygon_clip(&P, src->rows, src->cols);
+      if (Q)
+      {
+        polygon_normalize(Q);
+        polygon_drawShade(Q, src, &state, lighting);
+      }
+      break;
+    }
+
+    case DrawItemMesh:
+    {
+      // The mesh borrows the list's arrays and is drawn as module_draw draws one, placed by GTM alone
+      Mesh mesh;
+      Matrix identity;
+      mesh.oneSided = item->oneSided;
+      mesh.zBuffer = item->zBuffer;
+      mesh.nVertex = item->nVertex;
+      mesh.vertex = vertex;
+      mesh.normal = item->hasNormal ? normal : NULL;
+      mesh.color = item->hasColor ? &dl->color[item->first] : NULL;
+      mesh.nTriangle = item->nTriangle;
+      mesh.index = &dl->index[item->firstIndex];
+      matrix_identity(&identity);
+      module_drawMesh(&mesh, &identity, VTM, GTM ? GTM : &identity, &state, lighting, src, perspective ? &cop : NULL,
+                      NULL);
+      break;
+    }
+
+    default:
+      break;
+    }
+  }
+}
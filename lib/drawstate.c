@@ -7,26 +7,26 @@
 // Create a new DrawState object
 DrawState *drawstate_create(void) {
   DrawState* state = (DrawState*)malloc(sizeof(DrawState));
-  Color defaultColor;
-  color_set(&defaultColor, 1.0, 1.0, 1.0); // Default color is white
-  Point defaultViewer = {0.0, 0.0, 0.0};
-  state->color = defaultColor;
-  state->flatColor = defaultColor;
-  state->body = defaultColor;
-  state->surface = defaultColor;
-  state->surfaceCoeff = 32.0f;
-  state->shade = ShadeConstant;
-  state->zBufferFlag = 0;
-  state->viewer = defaultViewer;
+  drawstate_init(state);
   return state;
 }
 
-// Initialize a DrawState object
+// Initialize a DrawState object to the defaults
 int drawstate_init(DrawState* s) {
   if (s == NULL) {
     return -1;
   }
-  s = drawstate_create();
+  Color defaultColor;
+  color_set(&defaultColor, 1.0, 1.0, 1.0); // Default color is white
+  Point defaultViewer = {0.0, 0.0, 0.0};
+  s->color = defaultColor;
+  s->flatColor = defaultColor;
+  s->body = defaultColor;
+  s->surface = defaultColor;
+  s->surfaceCoeff = 32.0f;
+  s->shade = ShadeConstant;
+  s->zBufferFlag = 0;
+  s->viewer = defaultViewer;
   return 0;
 }
 
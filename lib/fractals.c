@@ -1,10 +1,375 @@
 // These functions generate fractal images (Mandelbrot and Julia sets) and Perlin noise.
 // Written by Nicholas Ung 2024-05-20
+// The escape-time sets are iterated a vector of points at a time, in bands of rows shared across threads.
+// Rectangles whose border escapes at a single iteration are filled without iterating inside (Mariani-Silver),
+// and progressive renders compute coarse-to-fine grids of points until a deadline. Deep zooms iterate each pixel
+// in double as an offset from one reference orbit computed in double-double arithmetic (perturbation), and
+// animations keep the escape iterations of a multi-level grid of samples from frame to frame.
 
-#include <complex.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "fractals.h"
+#include "noise.h"
+#include "threadpool.h"
+
+// Escape-time points are iterated this many at a time, one per vector lane
+#define FRACTAL_LANES 4
+
+// Iterations between checks for whether every lane has finished
+#define FRACTAL_CHECK 8
+
+// Squared distance under which an orbit is taken to have returned to a saved point
+#define FRACTAL_PERIOD_EPSILON2 1e-20
+
+// Default tile budget of a FractalCache, 64 MB
+#define FRACTAL_CACHE_TILES 4096
+
+// Queued cache samples handed to a thread at a time
+#define FRACTAL_CACHE_CHUNK 1024
+
+typedef double FractalVec __attribute__((vector_size(FRACTAL_LANES * sizeof(double))));
+typedef long long FractalMask __attribute__((vector_size(FRACTAL_LANES * sizeof(long long))));
+
+// Build the lane kernel for AVX as well and pick it at load time when the processor has it; FMA is left out so
+// every build produces the same iteration counts
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define FRACTAL_TARGETS __attribute__((target_clones("avx", "default")))
+#else
+#define FRACTAL_TARGETS
+#endif
+
+// Structure to represent one render job split into bands of rows
+typedef struct
+{
+  FractalParams *p;
+  double re0, im0;  // point of the top-left pixel
+  double dre, dim;  // step from one column and one row to the next
+  int rows, cols;
+  int *counts;      // escape iterations out, or NULL when the job colors dst directly
+  Image *dst;
+  int block;        // grid step of a progressive pass
+  double deadline;  // time after which a progressive pass stops starting rows, or 0 for none
+  int late;         // set when a progressive pass stopped at the deadline
+  const FractalOrbit *orbit; // reference orbit of a deep zoom, which re0 and im0 are offsets from, or NULL
+} FractalJob;
+
+// Structure to represent the work of one cached frame: its queued samples, then its pixels to color
+typedef struct
+{
+  FractalJob job;
+  FractalCache *cache;
+  int nQueue;
+} FractalCacheJob;
+
+// Structure to gather scattered pixels of a job into vectors of points
+typedef struct
+{
+  FractalJob *job;
+  int n;
+  size_t pixel[FRACTAL_LANES];
+  double re[FRACTAL_LANES], im[FRACTAL_LANES];
+} FractalBatch;
+
+/*
+ * Function: fractal_inside
+ * ------------------------
+ * Tests whether c lies in the main cardioid or the period-2 bulb of the Mandelbrot set,
+ * where the iteration never escapes.
+ *
+ * x, y: The real and imaginary parts of c.
+ *
+ * Returns: 1 if the point is known to be inside the set.
+ */
+static int fractal_inside(double x, double y)
+{
+  double y2 = y * y;
+  double q = (x - 0.25) * (x - 0.25) + y2;
+  if (q * (q + (x - 0.25)) <= 0.25 * y2)
+    return 1;
+  return (x + 1.0) * (x + 1.0) + y2 <= 0.0625;
+}
+
+/*
+ * Function: fractal_any
+ * ---------------------
+ * Tests whether any lane of a mask is set.
+ *
+ * m: The mask.
+ *
+ * Returns: Nonzero if some lane is set.
+ */
+static inline __attribute__((always_inline)) long long fractal_any(FractalMask m)
+{
+  long long any = 0;
+  for (int l = 0; l < FRACTAL_LANES; l++)
+    any |= m[l];
+  return any;
+}
+
+/*
+ * Function: fractal_lanes
+ * -----------------------
+ * Iterates up to FRACTAL_LANES points in lockstep, comparing |z|^2 against 4 instead of taking a square root.
+ * Each lane counts the escape tests it passes, so it stops counting when it escapes. Lanes known to be inside,
+ * or whose orbit comes back to the point saved at the last power-of-two iteration, are marked inside instead.
+ * Whether any lane is still running is only checked every FRACTAL_CHECK iterations.
+ *
+ * p: The fractal parameters.
+ * re, im: The points, n of them.
+ * n: The number of points, at most FRACTAL_LANES.
+ * count: Receives the escape iteration of each point, or maxIterations.
+ *
+ * Returns: void
+ */
+FRACTAL_TARGETS
+static void fractal_lanes(FractalParams *p, const double *re, const double *im, int n, int *count)
+{
+  FractalVec zr, zi, cr, ci, sr, si;
+  FractalMask active, inside, iterations;
+  int julia = p->type == FractalJulia;
+  int maxIterations = p->maxIterations;
+  int periodicity = p->periodicity;
+  int check = 1;
+
+  for (int l = 0; l < FRACTAL_LANES; l++)
+  {
+    int k = l < n ? l : n - 1; // spare lanes repeat the last point
+    zr[l] = julia ? re[k] : 0.0;
+    zi[l] = julia ? im[k] : 0.0;
+    cr[l] = julia ? p->cx : re[k];
+    ci[l] = julia ? p->cy : im[k];
+    inside[l] = !julia && fractal_inside(re[k], im[k]) ? -1 : 0;
+    active[l] = l < n && !inside[l] ? -1 : 0;
+    iterations[l] = 0;
+  }
+  sr = zr;
+  si = zi;
+
+  for (int k = 0; k < maxIterations && fractal_any(active);)
+  {
+    int stop = k + FRACTAL_CHECK < maxIterations ? k + FRACTAL_CHECK : maxIterations;
+    for (; k < stop; k++)
+    {
+      FractalVec zr2 = zr * zr;
+      FractalVec zi2 = zi * zi;
+      active &= zr2 + zi2 <= 4.0;
+      iterations -= active; // active lanes are -1
+
+      zi = 2.0 * zr * zi + ci;
+      zr = zr2 - zi2 + cr;
+
+      if (periodicity)
+      {
+        FractalVec dr = zr - sr;
+        FractalVec di = zi - si;
+        FractalMask cycle = (dr * dr + di * di < FRACTAL_PERIOD_EPSILON2) & active; // a cycle never escapes
+        inside |= cycle;
+        active &= ~cycle;
+        if (k + 1 == check)
+        {
+          sr = zr;
+          si = zi;
+          check *= 2;
+        }
+      }
+    }
+  }
+
+  for (int l = 0; l < n; l++)
+    count[l] = inside[l] ? maxIterations : (int)iterations[l];
+}
+
+/*
+ * Function: fractal_perturbLanes
+ * ------------------------------
+ * Iterates up to FRACTAL_LANES points of a deep zoom in lockstep as offsets dz from a reference orbit Z, which
+ * stay small enough for double: dz' = (2 Z + dz) dz + dc, with z = Z + dz. Lanes advance along the orbit
+ * independently, though they read it with a single load while they all agree on where they are. A lane rebases, taking dz = z and restarting at Z_0 = 0, when z comes nearer 0 than the
+ * reference (where the offsets would lose their precision and glitch) or when the orbit runs out. Escape counts
+ * are made as in fractal_lanes; the known interior and periodicity tests need the absolute point, so they are
+ * not used.
+ *
+ * p: The fractal parameters.
+ * orbit: The reference orbit.
+ * dre, dim: The offsets of the points from the center of the orbit, n of them.
+ * n: The number of points, at most FRACTAL_LANES.
+ * count: Receives the escape iteration of each point, or maxIterations.
+ *
+ * Returns: void
+ */
+FRACTAL_TARGETS
+static void fractal_perturbLanes(FractalParams *p, const FractalOrbit *orbit, const double *dre, const double *dim,
+                                 int n, int *count)
+{
+  FractalVec dcr, dci, dzr = {0}, dzi = {0}, Zr, Zi, zero = {0};
+  FractalMask active, iterations = {0}, m = {0};
+  int maxIterations = p->maxIterations;
+  long long last = orbit->length - 1;
+  int shared = 0; // orbit index of every lane while they all agree, otherwise -1
+
+  for (int l = 0; l < FRACTAL_LANES; l++)
+  {
+    int k = l < n ? l : n - 1; // spare lanes repeat the last point
+    dcr[l] = dre[k];
+    dci[l] = dim[k];
+    active[l] = l < n ? -1 : 0;
+  }
+
+  for (int k = 0; k < maxIterations && fractal_any(active);)
+  {
+    int stop = k + FRACTAL_CHECK < maxIterations ? k + FRACTAL_CHECK : maxIterations;
+    for (; k < stop; k++)
+    {
+      if (shared >= 0)
+      {
+        Zr = zero + orbit->zr[shared];
+        Zi = zero + orbit->zi[shared];
+      }
+      else
+      {
+        for (int l = 0; l < FRACTAL_LANES; l++)
+        {
+          Zr[l] = orbit->zr[m[l]];
+          Zi[l] = orbit->zi[m[l]];
+        }
+      }
+      FractalVec zr = Zr + dzr;
+      FractalVec zi = Zi + dzi;
+      FractalVec r2 = zr * zr + zi * zi;
+      active &= r2 <= 4.0;
+      iterations -= active; // active lanes are -1
+
+      // Escaped lanes only rebase to stay on the orbit
+      FractalMask rebase = ((r2 < dzr * dzr + dzi * dzi) & active) | (m >= last);
+      if (fractal_any(rebase))
+      {
+        dzr = (FractalVec)(((FractalMask)zr & rebase) | ((FractalMask)dzr & ~rebase));
+        dzi = (FractalVec)(((FractalMask)zi & rebase) | ((FractalMask)dzi & ~rebase));
+        Zr = (FractalVec)((FractalMask)Zr & ~rebase); // Z_0 = 0
+        Zi = (FractalVec)((FractalMask)Zi & ~rebase);
+        m &= ~rebase;
+        shared = m[0];
+        for (int l = 1; l < FRACTAL_LANES; l++)
+          shared = m[l] == m[0] ? shared : -1;
+      }
+
+      FractalVec ar = Zr + zr, ai = Zi + zi; // 2 Z + dz
+      FractalVec tr = dzr * ar - dzi * ai + dcr;
+      dzi = dzr * ai + dzi * ar + dci;
+      dzr = tr;
+      m += 1;
+      shared += shared >= 0;
+    }
+  }
+
+  for (int l = 0; l < n; l++)
+    count[l] = (int)iterations[l];
+}
+
+/*
+ * Function: fractal_iterate
+ * -------------------------
+ * Iterates up to FRACTAL_LANES points of a job, directly or as offsets from the job's reference orbit.
+ *
+ * job: The render job.
+ * re, im: The points, n of them.
+ * n: The number of points, at most FRACTAL_LANES.
+ * count: Receives the escape iteration of each point.
+ *
+ * Returns: void
+ */
+static void fractal_iterate(FractalJob *job, const double *re, const double *im, int n, int *count)
+{
+  if (job->orbit)
+    fractal_perturbLanes(job->p, job->orbit, re, im, n, count);
+  else
+    fractal_lanes(job->p, re, im, n, count);
+}
+
+/*
+ * Function: fractal_row
+ * ---------------------
+ * Computes the escape iterations of one row of a render job.
+ *
+ * job: The render job.
+ * i: The row.
+ * count: Receives job->cols escape iterations.
+ *
+ * Returns: void
+ */
+static void fractal_row(FractalJob *job, int i, int *count)
+{
+  double re[FRACTAL_LANES], ims[FRACTAL_LANES];
+
+  for (int l = 0; l < FRACTAL_LANES; l++)
+    ims[l] = job->im0 + i * job->dim;
+  for (int j = 0; j < job->cols; j += FRACTAL_LANES)
+  {
+    int n = job->cols - j < FRACTAL_LANES ? job->cols - j : FRACTAL_LANES;
+    for (int l = 0; l < n; l++)
+      re[l] = job->re0 + (j + l) * job->dre;
+    fractal_iterate(job, re, ims, n, count + j);
+  }
+}
+
+/*
+ * Function: fractal_flush
+ * -----------------------
+ * Iterates the pixels gathered in a batch and stores their escape iterations in the job's counts.
+ *
+ * b: The batch, emptied on return.
+ *
+ * Returns: void
+ */
+static void fractal_flush(FractalBatch *b)
+{
+  int count[FRACTAL_LANES];
+
+  if (b->n == 0)
+    return;
+  fractal_iterate(b->job, b->re, b->im, b->n, count);
+  for (int l = 0; l < b->n; l++)
+    b->job->counts[b->pixel[l]] = count[l];
+  b->n = 0;
+}
+
+/*
+ * Function: fractal_add
+ * ---------------------
+ * Adds a pixel to a batch, iterating the batch once it fills every lane. The point is computed the same way as
+ * by fractal_row, so either path gives a pixel the same count.
+ *
+ * b: The batch.
+ * i, j: The row and column of the pixel.
+ *
+ * Returns: void
+ */
+static void fractal_add(FractalBatch *b, int i, int j)
+{
+  FractalJob *job = b->job;
+  b->pixel[b->n] = (size_t)i * job->cols + j;
+  b->re[b->n] = job->re0 + j * job->dre;
+  b->im[b->n] = job->im0 + i * job->dim;
+  if (++b->n == FRACTAL_LANES)
+    fractal_flush(b);
+}
+
+/*
+ * Function: fractal_now
+ * ---------------------
+ * Reads the monotonic clock.
+ *
+ * Returns: The current time in seconds.
+ */
+static double fractal_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
 /*
  * Function: getColor
@@ -52,220 +417,1109 @@ FPixel static getColor(int iterations, int maxIterations)
 }
 
 /*
- * Function: mandelbrot
- * --------------------
- * Generates a Mandelbrot set and fills the given image.
+ * Function: fractal_band
+ * ----------------------
+ * Thread task computing one band of FRACTAL_BAND_ROWS rows of a render job.
  *
- * dst: The image to fill.
- * x0, y0: The coordinates of the top-left corner of the rectangle in the complex plane.
- * dx: The width of the rectangle in the complex plane.
+ * arg: The FractalJob.
+ * task: The index of the band.
  *
  * Returns: void
  */
-void mandelbrot(Image *dst, float x0, float y0, float dx)
+static void fractal_band(void *arg, int task)
 {
-  // Flip the y-axis to match the image coordinate system
-  x0 *= -1;
-  y0 *= -1;
-  dx *= -1;
+  FractalJob *job = (FractalJob *)arg;
+  int rowEnd = (task + 1) * FRACTAL_BAND_ROWS;
+  int *row = NULL;
 
-  int cols = dst->cols;        // Get the number of columns (width) of the image
-  int rows = dst->rows;        // Get the number of rows (height) of the image
-  float dy = dx * rows / cols; // Calculate the height of the rectangle in the complex plane
-  int maxIterations = 128;     // Maximum number of iterations to determine set membership
+  if (rowEnd > job->rows)
+    rowEnd = job->rows;
+  if (!job->counts)
+  {
+    row = (int *)malloc(job->cols * sizeof(int));
+    if (!row)
+    {
+      fprintf(stderr, "Memory allocation failed\n");
+      return;
+    }
+  }
 
-  // Iterate over each pixel in the image
-  for (int i = 0; i < rows; ++i)
+  for (int i = task * FRACTAL_BAND_ROWS; i < rowEnd; i++)
   {
-    for (int j = 0; j < cols; ++j)
+    int *count = job->counts ? job->counts + (size_t)i * job->cols : row;
+    fractal_row(job, i, count);
+    if (job->dst)
     {
-      // Calculate the complex plane coordinates
-      float x = x0 + j * dx / cols;
-      float y = (dy + y0) - i * dy / rows;
-      float complex c = x + y * I; // Create the complex number c
-      float complex z = 0;         // Initialize z to 0
-      int k = 0;
-
-      // Iterate to determine if the point is in the Mandelbrot set
-      for (k = 0; k < maxIterations; k++)
+      FPixel *span = image_span(job->dst, i, 0);
+      for (int j = 0; j < job->cols; j++)
+        span[j] = getColor(count[j], job->p->maxIterations);
+      image_markSpan(job->dst, i, 0, job->cols - 1);
+    }
+  }
+  free(row);
+}
+
+/*
+ * Function: fractal_rect
+ * ----------------------
+ * Fills the inside of a rectangle whose border has been computed. If every border pixel has the same count the
+ * inside takes it without iterating: the sets are connected, so only detail thinner than a pixel can be missed.
+ * Small rectangles are iterated, and the others are split across their longer side into two smaller ones.
+ *
+ * b: The batch of the job, empty.
+ * i0, j0: The top-left pixel of the rectangle.
+ * i1, j1: The bottom-right pixel of the rectangle.
+ *
+ * Returns: void
+ */
+static void fractal_rect(FractalBatch *b, int i0, int j0, int i1, int j1)
+{
+  int *counts = b->job->counts;
+  int cols = b->job->cols;
+  int c = counts[(size_t)i0 * cols + j0];
+  int uniform = 1;
+
+  if (i1 - i0 < 2 || j1 - j0 < 2)
+    return; // no inside
+  for (int j = j0; j <= j1 && uniform; j++)
+    uniform = counts[(size_t)i0 * cols + j] == c && counts[(size_t)i1 * cols + j] == c;
+  for (int i = i0 + 1; i < i1 && uniform; i++)
+    uniform = counts[(size_t)i * cols + j0] == c && counts[(size_t)i * cols + j1] == c;
+
+  if (uniform)
+  {
+    for (int i = i0 + 1; i < i1; i++)
+      for (int j = j0 + 1; j < j1; j++)
+        counts[(size_t)i * cols + j] = c;
+  }
+  else if ((i1 - i0 - 1) * (j1 - j0 - 1) <= 4 * FRACTAL_LANES)
+  {
+    for (int i = i0 + 1; i < i1; i++)
+      for (int j = j0 + 1; j < j1; j++)
+        fractal_add(b, i, j);
+    fractal_flush(b);
+  }
+  else if (j1 - j0 >= i1 - i0)
+  {
+    int jm = (j0 + j1) / 2;
+    for (int i = i0 + 1; i < i1; i++)
+      fractal_add(b, i, jm);
+    fractal_flush(b);
+    fractal_rect(b, i0, j0, i1, jm);
+    fractal_rect(b, i0, jm, i1, j1);
+  }
+  else
+  {
+    int im = (i0 + i1) / 2;
+    for (int j = j0 + 1; j < j1; j++)
+      fractal_add(b, im, j);
+    fractal_flush(b);
+    fractal_rect(b, i0, j0, im, j1);
+    fractal_rect(b, im, j0, i1, j1);
+  }
+}
+
+/*
+ * Function: fractal_tile
+ * ----------------------
+ * Thread task computing one FRACTAL_TILE square of a subdividing render job: its border is iterated, then
+ * fractal_rect fills the inside.
+ *
+ * arg: The FractalJob.
+ * task: The index of the tile, row by row.
+ *
+ * Returns: void
+ */
+static void fractal_tile(void *arg, int task)
+{
+  FractalJob *job = (FractalJob *)arg;
+  FractalBatch b = {job, 0};
+  int tilesX = (job->cols + FRACTAL_TILE - 1) / FRACTAL_TILE;
+  int i0 = task / tilesX * FRACTAL_TILE, j0 = task % tilesX * FRACTAL_TILE;
+  int i1 = (i0 + FRACTAL_TILE < job->rows ? i0 + FRACTAL_TILE : job->rows) - 1;
+  int j1 = (j0 + FRACTAL_TILE < job->cols ? j0 + FRACTAL_TILE : job->cols) - 1;
+
+  for (int j = j0; j <= j1; j++)
+  {
+    fractal_add(&b, i0, j);
+    if (i1 > i0)
+      fractal_add(&b, i1, j);
+  }
+  for (int i = i0 + 1; i < i1; i++)
+  {
+    fractal_add(&b, i, j0);
+    if (j1 > j0)
+      fractal_add(&b, i, j1);
+  }
+  fractal_flush(&b);
+  fractal_rect(&b, i0, j0, i1, j1);
+
+  if (job->dst)
+  {
+    for (int i = i0; i <= i1; i++)
+    {
+      FPixel *span = image_span(job->dst, i, 0);
+      for (int j = j0; j <= j1; j++)
+        span[j] = getColor(job->counts[(size_t)i * job->cols + j], job->p->maxIterations);
+      image_markSpan(job->dst, i, j0, j1);
+    }
+  }
+}
+
+/*
+ * Function: fractal_pass
+ * ----------------------
+ * Thread task computing one band of a progressive pass: the pixels on the grid of step block that are not known
+ * yet. When subdividing, a pixel whose square of the previous pass has four equal corners takes their count
+ * without iterating. Rows are not started after the deadline, so the pass can be finished by a later call.
+ *
+ * arg: The FractalJob.
+ * task: The index of the band, FRACTAL_BAND_ROWS grid rows high.
+ *
+ * Returns: void
+ */
+static void fractal_pass(void *arg, int task)
+{
+  FractalJob *job = (FractalJob *)arg;
+  FractalBatch b = {job, 0};
+  int *counts = job->counts;
+  int cols = job->cols;
+  int step = job->block;
+  int coarse = 2 * step; // grid step of the previous pass
+  int guess = job->p->subdivide && step < FRACTAL_PROGRESSIVE_BLOCK;
+  int rowEnd = (task + 1) * FRACTAL_BAND_ROWS * step;
+
+  if (rowEnd > job->rows)
+    rowEnd = job->rows;
+  for (int i = task * FRACTAL_BAND_ROWS * step; i < rowEnd; i += step)
+  {
+    if (job->deadline > 0 && fractal_now() >= job->deadline)
+    {
+      job->late = 1;
+      return;
+    }
+    for (int j = 0; j < cols; j += step)
+    {
+      if (counts[(size_t)i * cols + j] >= 0)
+        continue;
+      if (guess)
       {
-        if (cabs(z) > 2.0)
-          break;
-        z = z * z + c;
+        int ci = i - i % coarse, cj = j - j % coarse;
+        if (ci + coarse < job->rows && cj + coarse < cols)
+        {
+          int *top = counts + (size_t)ci * cols + cj;
+          int *bottom = counts + (size_t)(ci + coarse) * cols + cj;
+          if (top[0] == top[coarse] && top[0] == bottom[0] && top[0] == bottom[coarse])
+          {
+            counts[(size_t)i * cols + j] = top[0];
+            continue;
+          }
+        }
       }
+      fractal_add(&b, i, j);
+    }
+    fractal_flush(&b);
+  }
+}
+
+/*
+ * Function: fractal_run
+ * ---------------------
+ * Runs a render job on the pool of its parameters; bands or tiles are handed out one at a time, so threads that
+ * land on quickly escaping ones pick up more of them. Subdividing jobs that only color dst get a scratch count
+ * buffer.
+ *
+ * job: The render job.
+ *
+ * Returns: void
+ */
+static void fractal_run(FractalJob *job)
+{
+  ThreadPool *pool = job->p->pool;
 
-      // Determine the color
-      FPixel color = getColor(k, maxIterations);
+  if (!job->p->subdivide)
+  {
+    threadpool_run(pool, (job->rows + FRACTAL_BAND_ROWS - 1) / FRACTAL_BAND_ROWS, fractal_band, job);
+    return;
+  }
 
-      image_setf(dst, i, j, color); // Set the pixel color in the image
+  int *scratch = NULL;
+  if (!job->counts)
+  {
+    scratch = (int *)malloc((size_t)job->rows * job->cols * sizeof(int));
+    if (!scratch)
+    {
+      fprintf(stderr, "Memory allocation failed\n");
+      return;
     }
+    job->counts = scratch;
+  }
+  int tilesX = (job->cols + FRACTAL_TILE - 1) / FRACTAL_TILE;
+  int tilesY = (job->rows + FRACTAL_TILE - 1) / FRACTAL_TILE;
+  threadpool_run(pool, tilesX * tilesY, fractal_tile, job);
+  if (scratch)
+  {
+    job->counts = NULL;
+    free(scratch);
   }
 }
 
 /*
- * Function: julia
- * ---------------
- * Generates a Julia set and fills the given image.
+ * Function: fractal_params
+ * ------------------------
+ * Sets the default parameters for a fractal type: 256 iterations with periodicity checking on the calling thread,
+ * and for Julia sets the constant used by julia(). Subdivision is off, so every pixel is iterated exactly; set
+ * subdivide to trade a few wrong pixels for speed, and pool to share the work across threads.
+ *
+ * p: The parameters to set.
+ * type: The fractal type.
+ *
+ * Returns: void
+ */
+void fractal_params(FractalParams *p, FractalType type)
+{
+  p->type = type;
+  p->cx = type == FractalJulia ? -0.7454054 : 0.0;
+  p->cy = type == FractalJulia ? 0.1130063 : 0.0;
+  p->maxIterations = 256;
+  p->pool = NULL;
+  p->periodicity = 1;
+  p->subdivide = 0;
+}
+
+/*
+ * Function: fractal_escape
+ * ------------------------
+ * Computes the escape iteration of a single point.
+ *
+ * p: The fractal parameters.
+ * re, im: The point in the complex plane.
+ *
+ * Returns: The iteration at which |z| first exceeds 2, or maxIterations if it never does.
+ */
+int fractal_escape(FractalParams *p, double re, double im)
+{
+  int count;
+  fractal_lanes(p, &re, &im, 1, &count);
+  return count;
+}
+
+/*
+ * Function: fractal_counts
+ * ------------------------
+ * Computes the escape iterations of a grid of points on the pool of the parameters.
+ *
+ * p: The fractal parameters.
+ * re0, im0: The point of the first row and column.
+ * dre, dim: The step from one column and from one row to the next.
+ * rows, cols: The size of the grid.
+ * counts: Receives rows * cols escape iterations in row major order.
+ *
+ * Returns: void
+ */
+void fractal_counts(FractalParams *p, double re0, double im0, double dre, double dim, int rows, int cols, int *counts)
+{
+  if (!p || !counts || rows <= 0 || cols <= 0)
+  {
+    return;
+  }
+  FractalJob job = {p, re0, im0, dre, dim, rows, cols, counts, NULL};
+  fractal_run(&job);
+}
+
+/*
+ * Function: fractal_color
+ * -----------------------
+ * Colors an image from escape iterations.
  *
  * dst: The image to fill.
- * x0, y0: The coordinates of the top-left corner of the rectangle in the complex plane.
- * dx: The width of the rectangle in the complex plane.
+ * counts: The escape iterations, dst->rows * dst->cols in row major order.
+ * maxIterations: The iteration limit the counts were computed with.
  *
  * Returns: void
  */
-void julia(Image *dst, float x0, float y0, float dx)
+void fractal_color(Image *dst, const int *counts, int maxIterations)
 {
-  // Flip the y-axis to match the image coordinate system
-  x0 *= -1;
-  y0 *= -1;
-  dx *= -1;
+  if (!dst || !counts)
+  {
+    return;
+  }
+  for (int i = 0; i < dst->rows; i++)
+  {
+    FPixel *span = image_span(dst, i, 0);
+    for (int j = 0; j < dst->cols; j++)
+      span[j] = getColor(counts[(size_t)i * dst->cols + j], maxIterations);
+    image_markSpan(dst, i, 0, dst->cols - 1);
+  }
+}
 
-  int cols = dst->cols;        // Get the number of columns (width) of the image
-  int rows = dst->rows;        // Get the number of rows (height) of the image
-  float dy = dx * rows / cols; // Calculate the height of the rectangle in the complex plane
-  int maxIterations = 256;     // Maximum number of iterations to determine set membership
+/*
+ * Function: fractal_render
+ * ------------------------
+ * Renders a fractal into an image on the pool of the parameters.
+ *
+ * dst: The image to fill.
+ * p: The fractal parameters.
+ * re0, im0: The point of the top-left pixel; the imaginary part decreases down the image.
+ * width: The width of the image in the complex plane.
+ *
+ * Returns: void
+ */
+void fractal_render(Image *dst, FractalParams *p, double re0, double im0, double width)
+{
+  if (!dst || !p || dst->rows <= 0 || dst->cols <= 0)
+  {
+    return;
+  }
+  double step = width / dst->cols;
+  FractalJob job = {p, re0, im0, step, -step, dst->rows, dst->cols, NULL, dst};
+  fractal_run(&job);
+}
 
-  float complex c = -0.7454054 + 0.1130063 * I; // Constant c, can be modified
-  // float complex c = 0.285 + 0.01 * I; // Different constant c
-  // float complex c = -0.4 + 0.6 * I; // Different constant c
+/*
+ * Function: fractal_progressiveInit
+ * ---------------------------------
+ * Starts a progressive render; nothing is computed until fractal_progressiveRefine.
+ *
+ * r: The render state.
+ * p: The fractal parameters, copied.
+ * rows, cols: The size of the image.
+ * re0, im0: The point of the top-left pixel; the imaginary part decreases down the image.
+ * width: The width of the image in the complex plane.
+ *
+ * Returns: 0 on success, 1 if the parameters are invalid or memory runs out.
+ */
+int fractal_progressiveInit(FractalProgress *r, FractalParams *p, int rows, int cols, double re0, double im0,
+                            double width)
+{
+  if (!r || !p || rows <= 0 || cols <= 0)
+  {
+    printf("Invalid arguments passed to fractal_progressiveInit\n");
+    return 1;
+  }
+  r->counts = (int *)malloc((size_t)rows * cols * sizeof(int));
+  if (!r->counts)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return 1;
+  }
+  memset(r->counts, 0xff, (size_t)rows * cols * sizeof(int)); // -1, not computed
+  r->params = *p;
+  r->re0 = re0;
+  r->im0 = im0;
+  r->step = width / cols;
+  r->rows = rows;
+  r->cols = cols;
+  r->block = 0;
+  return 0;
+}
 
-  // Iterate over each pixel in the image
-  for (int i = 0; i < rows; ++i)
+/*
+ * Function: fractal_progressiveRefine
+ * -----------------------------------
+ * Runs passes of a progressive render, halving the block size each time, until the render is complete or the
+ * time is up. A pass cut short by the deadline keeps its finished rows and is picked up by the next call. Each
+ * pixel of dst is colored from its own count once known, and otherwise from the corner of its block in the last
+ * complete pass.
+ *
+ * r: The render state.
+ * dst: The image to color, rows x cols, or NULL.
+ * seconds: The time to spend, or 0 or less to finish the render.
+ *
+ * Returns: The block size of the last complete pass, 1 once the render is complete.
+ */
+int fractal_progressiveRefine(FractalProgress *r, Image *dst, double seconds)
+{
+  if (!r || !r->counts)
   {
-    for (int j = 0; j < cols; ++j)
+    return 0;
+  }
+
+  FractalJob job = {&r->params, r->re0, r->im0, r->step, -r->step, r->rows, r->cols, r->counts, NULL};
+  ThreadPool *pool = r->params.pool;
+  double deadline = seconds > 0 ? fractal_now() + seconds : 0;
+
+  while (r->block != 1)
+  {
+    job.block = r->block ? r->block / 2 : FRACTAL_PROGRESSIVE_BLOCK;
+    job.deadline = r->block ? deadline : 0; // the first pass always completes, so there is an image to show
+    job.late = 0;
+    threadpool_run(pool, (r->rows + FRACTAL_BAND_ROWS * job.block - 1) / (FRACTAL_BAND_ROWS * job.block),
+                   fractal_pass, &job);
+    if (job.late)
+      break;
+    r->block = job.block;
+    if (deadline > 0 && fractal_now() >= deadline)
+      break;
+  }
+
+  if (dst && dst->rows == r->rows && dst->cols == r->cols)
+  {
+    for (int i = 0; i < r->rows; i++)
     {
-      // Calculate the complex plane coordinates
-      float x = x0 + j * dx / cols;
-      float y = (dy + y0) - i * dy / rows;
-      float complex z = x + y * I; // Initialize z to the complex plane coordinates
-      int k = 0;
-
-      // Iterate to determine if the point is in the Julia set
-      for (k = 0; k < maxIterations; k++)
-      {
-        if (cabs(z) > 2.0)
-          break;
-        z = z * z + c;
-      }
+      FPixel *span = image_span(dst, i, 0);
+      const int *row = r->counts + (size_t)i * r->cols;
+      const int *corner = r->counts + (size_t)(i - i % r->block) * r->cols;
+      for (int j = 0; j < r->cols; j++)
+        span[j] = getColor(row[j] >= 0 ? row[j] : corner[j - j % r->block], r->params.maxIterations);
+      image_markSpan(dst, i, 0, r->cols - 1);
+    }
+  }
+  return r->block;
+}
+
+/*
+ * Function: fractal_progressiveFree
+ * ---------------------------------
+ * Frees the iteration counts of a progressive render.
+ *
+ * r: The render state.
+ *
+ * Returns: void
+ */
+void fractal_progressiveFree(FractalProgress *r)
+{
+  if (r)
+  {
+    free(r->counts);
+    r->counts = NULL;
+  }
+}
+
+/*
+ * Function: fractal_quickSum
+ * --------------------------
+ * Adds two doubles exactly, as a rounded sum and its error, when |a| >= |b|.
+ *
+ * a, b: The doubles.
+ *
+ * Returns: The sum.
+ */
+static FractalReal fractal_quickSum(double a, double b)
+{
+  FractalReal r;
+  r.hi = a + b;
+  r.lo = b - (r.hi - a);
+  return r;
+}
 
-      // Determine the color
-      FPixel color = getColor(k, maxIterations);
+/*
+ * Function: fractal_twoSum
+ * ------------------------
+ * Adds two doubles exactly, as a rounded sum and its error.
+ *
+ * a, b: The doubles.
+ *
+ * Returns: The sum.
+ */
+static FractalReal fractal_twoSum(double a, double b)
+{
+  FractalReal r;
+  r.hi = a + b;
+  double bb = r.hi - a;
+  r.lo = (a - (r.hi - bb)) + (b - bb);
+  return r;
+}
 
-      image_setf(dst, i, j, color); // Set the pixel color in the image
+/*
+ * Function: fractal_twoProduct
+ * ----------------------------
+ * Multiplies two doubles exactly, as a rounded product and its error, splitting each into 26-bit halves so the
+ * partial products are exact without a fused multiply-add.
+ *
+ * a, b: The doubles.
+ *
+ * Returns: The product.
+ */
+static FractalReal fractal_twoProduct(double a, double b)
+{
+  FractalReal r;
+  double ca = 134217729.0 * a, cb = 134217729.0 * b; // 2^27 + 1
+  double ah = ca - (ca - a), al = a - ah;
+  double bh = cb - (cb - b), bl = b - bh;
+  r.hi = a * b;
+  r.lo = ((ah * bh - r.hi) + ah * bl + al * bh) + al * bl;
+  return r;
+}
+
+/*
+ * Function: fractal_realAdd
+ * -------------------------
+ * Adds two FractalReals.
+ *
+ * a, b: The numbers.
+ *
+ * Returns: a + b.
+ */
+static FractalReal fractal_realAdd(FractalReal a, FractalReal b)
+{
+  FractalReal s = fractal_twoSum(a.hi, b.hi);
+  FractalReal t = fractal_twoSum(a.lo, b.lo);
+  s = fractal_quickSum(s.hi, s.lo + t.hi);
+  return fractal_quickSum(s.hi, s.lo + t.lo);
+}
+
+/*
+ * Function: fractal_realMul
+ * -------------------------
+ * Multiplies two FractalReals.
+ *
+ * a, b: The numbers.
+ *
+ * Returns: a * b.
+ */
+static FractalReal fractal_realMul(FractalReal a, FractalReal b)
+{
+  FractalReal p = fractal_twoProduct(a.hi, b.hi);
+  return fractal_quickSum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+}
+
+/*
+ * Function: fractal_realDiv
+ * -------------------------
+ * Divides two FractalReals by long division, one double of quotient at a time.
+ *
+ * a, b: The numbers.
+ *
+ * Returns: a / b.
+ */
+static FractalReal fractal_realDiv(FractalReal a, FractalReal b)
+{
+  FractalReal minus = {-1.0, 0.0};
+  double q1 = a.hi / b.hi;
+  FractalReal r = fractal_realAdd(a, fractal_realMul(minus, fractal_realMul(b, (FractalReal){q1, 0.0})));
+  double q2 = r.hi / b.hi;
+  r = fractal_realAdd(r, fractal_realMul(minus, fractal_realMul(b, (FractalReal){q2, 0.0})));
+  double q3 = r.hi / b.hi;
+  FractalReal q = fractal_quickSum(q1, q2);
+  return fractal_realAdd(q, (FractalReal){q3, 0.0});
+}
+
+/*
+ * Function: fractal_real
+ * ----------------------
+ * Converts a decimal string, with an optional sign, fraction and exponent, to a FractalReal. The digits are
+ * accumulated as an integer and scaled by a power of ten once, so about 32 significant digits survive.
+ *
+ * s: The string.
+ *
+ * Returns: The number, or 0 if the string has no digits.
+ */
+FractalReal fractal_real(const char *s)
+{
+  FractalReal value = {0.0, 0.0}, ten = {10.0, 0.0}, scale = {1.0, 0.0};
+  int negative = 0, exponent = 0, fraction = 0;
+
+  if (!s)
+  {
+    return value;
+  }
+  while (*s == ' ' || *s == '\t')
+    s++;
+  if (*s == '-' || *s == '+')
+    negative = *s++ == '-';
+  for (; (*s >= '0' && *s <= '9') || (*s == '.' && !fraction); s++)
+  {
+    if (*s == '.')
+    {
+      fraction = 1;
+      continue;
     }
+    value = fractal_realAdd(fractal_realMul(value, ten), (FractalReal){*s - '0', 0.0});
+    exponent -= fraction;
+  }
+  if (*s == 'e' || *s == 'E')
+    exponent += atoi(s + 1);
+
+  for (int k = exponent < 0 ? -exponent : exponent; k > 0; k--)
+    scale = fractal_realMul(scale, ten);
+  value = exponent < 0 ? fractal_realDiv(value, scale) : fractal_realMul(value, scale);
+  if (negative)
+  {
+    value.hi = -value.hi;
+    value.lo = -value.lo;
   }
+  return value;
 }
 
-// Permutation table for Perlin noise
-static int perm[512];
+/*
+ * Function: fractal_orbit
+ * -----------------------
+ * Computes the reference orbit of a deep zoom: Z_0 = 0 and Z_n+1 = Z_n^2 + C in FractalReal arithmetic, until
+ * Z escapes or maxIterations points have been computed. The same orbit serves every frame of a zoom toward C
+ * and any iteration limit; pixels rebase onto its start when they run past its end.
+ *
+ * orbit: The orbit to fill.
+ * re, im: The center C.
+ * maxIterations: The iteration limit.
+ *
+ * Returns: 0 on success, 1 if memory runs out.
+ */
+int fractal_orbit(FractalOrbit *orbit, FractalReal re, FractalReal im, int maxIterations)
+{
+  FractalReal zr = {0.0, 0.0}, zi = {0.0, 0.0}, two = {2.0, 0.0}, minus = {-1.0, 0.0};
+
+  if (!orbit || maxIterations < 1)
+  {
+    printf("Invalid arguments passed to fractal_orbit\n");
+    return 1;
+  }
+  orbit->zr = (double *)malloc((size_t)(maxIterations + 1) * sizeof(double));
+  orbit->zi = (double *)malloc((size_t)(maxIterations + 1) * sizeof(double));
+  if (!orbit->zr || !orbit->zi)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    fractal_orbitFree(orbit);
+    return 1;
+  }
+  orbit->re = re;
+  orbit->im = im;
 
-// Gradient vectors for 3D Perlin noise
-static const int grad3[12][3] = {
-  {1, 1, 0}, {-1, 1, 0}, {1, -1, 0}, {-1, -1, 0}, 
-  {1, 0, 1}, {-1, 0, 1}, {1, 0, -1}, {-1, 0, -1}, 
-  {0, 1, 1}, {0, -1, 1}, {0, 1, -1}, {0, -1, -1}};
+  int n = 0;
+  for (;;)
+  {
+    orbit->zr[n] = zr.hi + zr.lo;
+    orbit->zi[n] = zi.hi + zi.lo;
+    n++;
+    if (n > maxIterations || orbit->zr[n - 1] * orbit->zr[n - 1] + orbit->zi[n - 1] * orbit->zi[n - 1] > 4.0)
+      break;
+    FractalReal zr2 = fractal_realMul(zr, zr);
+    FractalReal zi2 = fractal_realMul(zi, zi);
+    zi = fractal_realAdd(fractal_realMul(two, fractal_realMul(zr, zi)), im);
+    zr = fractal_realAdd(fractal_realAdd(zr2, fractal_realMul(minus, zi2)), re);
+  }
+  orbit->length = n;
+  return 0;
+}
 
 /*
- * Function: init_perlin
- * ---------------------
- * Initializes the permutation table for Perlin noise.
+ * Function: fractal_orbitFree
+ * ---------------------------
+ * Frees a reference orbit.
  *
- * seed: The seed for random number generation.
+ * orbit: The orbit.
+ *
+ * Returns: void
+ */
+void fractal_orbitFree(FractalOrbit *orbit)
+{
+  if (orbit)
+  {
+    free(orbit->zr);
+    free(orbit->zi);
+    orbit->zr = orbit->zi = NULL;
+    orbit->length = 0;
+  }
+}
+
+/*
+ * Function: fractal_countsDeep
+ * ----------------------------
+ * Computes the escape iterations of a grid of points of a deep zoom on the pool of the parameters.
+ *
+ * p: The fractal parameters; the type must be FractalMandelbrot.
+ * orbit: The reference orbit.
+ * re0, im0: The offset of the first row and column from the center of the orbit.
+ * dre, dim: The step from one column and from one row to the next.
+ * rows, cols: The size of the grid.
+ * counts: Receives rows * cols escape iterations in row major order.
  *
  * Returns: void
  */
-static void init_perlin(int seed)
+void fractal_countsDeep(FractalParams *p, const FractalOrbit *orbit, double re0, double im0, double dre, double dim,
+                        int rows, int cols, int *counts)
 {
-  srand(seed); // Initialize random seed
+  if (!p || !orbit || !orbit->zr || !counts || rows <= 0 || cols <= 0 || p->type != FractalMandelbrot)
+  {
+    printf("Invalid arguments passed to fractal_countsDeep\n");
+    return;
+  }
+  FractalJob job = {p, re0, im0, dre, dim, rows, cols, counts, NULL};
+  job.orbit = orbit;
+  fractal_run(&job);
+}
 
-  // Initialize the permutation table
-  for (int i = 0; i < 256; i++)
-    perm[i] = i;
-  for (int i = 0; i < 256; i++)
+/*
+ * Function: fractal_renderDeep
+ * ----------------------------
+ * Renders a deep zoom of the Mandelbrot set centered on the center of the orbit. Pixels are placed as by
+ * fractal_render, so a frame costs about as much at any depth; below a width of about 1e-28 the orbit's own
+ * precision runs out.
+ *
+ * dst: The image to fill.
+ * p: The fractal parameters; the type must be FractalMandelbrot.
+ * orbit: The reference orbit.
+ * width: The width of the image in the complex plane.
+ *
+ * Returns: void
+ */
+void fractal_renderDeep(Image *dst, FractalParams *p, const FractalOrbit *orbit, double width)
+{
+  if (!dst || !p || !orbit || !orbit->zr || dst->rows <= 0 || dst->cols <= 0 || p->type != FractalMandelbrot)
   {
-    int j = rand() % 256; // Generate a random index
-    int swap = perm[i];   // Swap perm[i] and perm[j]
-    perm[i] = perm[j];
-    perm[j] = swap;
+    printf("Invalid arguments passed to fractal_renderDeep\n");
+    return;
   }
-  for (int i = 0; i < 256; i++)
-    perm[256 + i] = perm[i]; // Extend the permutation table
+  double step = width / dst->cols;
+  FractalJob job = {p, -0.5 * width, 0.5 * step * dst->rows, step, -step, dst->rows, dst->cols, NULL, dst};
+  job.orbit = orbit;
+  fractal_run(&job);
 }
 
 /*
- * Function: dot
- * -------------
- * Computes the dot product of the gradient vector and the distance vector.
+ * Function: fractal_cacheFind
+ * ---------------------------
+ * Looks up a tile of a cache, creating it when asked. A new tile takes the samples it shares with its tile on the
+ * level above, every other sample in each direction, as they are the same points.
  *
- * g: The gradient vector.
- * x, y: The distance vector.
+ * c: The cache.
+ * level: The level of the tile.
+ * tx, ty: The position of the tile within its level.
+ * create: Whether to create the tile if the cache does not hold it.
  *
- * Returns: The dot product.
+ * Returns: The tile, or NULL if it is not held and not created.
  */
-static float dot(const int *g, float x, float y)
+static FractalCacheTile *fractal_cacheFind(FractalCache *c, int level, long long tx, long long ty, int create)
 {
-  return g[0] * x + g[1] * y;
+  unsigned long long h = (unsigned long long)level * 0x9e3779b97f4a7c15ull ^ (unsigned long long)tx * 0xc2b2ae3d27d4eb4full ^
+                         (unsigned long long)ty * 0x165667b19e3779f9ull;
+  FractalCacheTile **bucket = c->bucket + ((h ^ (h >> 29)) & (c->nBuckets - 1));
+  FractalCacheTile *tile;
+
+  for (tile = *bucket; tile; tile = tile->next)
+  {
+    if (tile->level == level && tile->tx == tx && tile->ty == ty)
+      return tile;
+  }
+  if (!create)
+    return NULL;
+
+  tile = (FractalCacheTile *)malloc(sizeof(FractalCacheTile));
+  if (!tile)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return NULL;
+  }
+  tile->level = level;
+  tile->tx = tx;
+  tile->ty = ty;
+  tile->lastUsed = c->frame;
+  memset(tile->counts, 0xff, sizeof(tile->counts)); // -1, not computed
+  tile->next = *bucket;
+  *bucket = tile;
+  c->nTiles++;
+
+  FractalCacheTile *parent = level > 0 ? fractal_cacheFind(c, level - 1, tx >> 1, ty >> 1, 0) : NULL;
+  if (parent)
+  {
+    const int half = FRACTAL_CACHE_TILE / 2;
+    const int *src = parent->counts + (ty & 1) * half * FRACTAL_CACHE_TILE + (tx & 1) * half;
+    for (int r = 0; r < half; r++)
+      for (int k = 0; k < half; k++)
+        tile->counts[2 * r * FRACTAL_CACHE_TILE + 2 * k] = src[r * FRACTAL_CACHE_TILE + k];
+  }
+  return tile;
 }
 
 /*
- * Function: fade
- * --------------
- * Fade function to smooth the transition between grid points.
+ * Function: fractal_cacheSamples
+ * ------------------------------
+ * Thread task iterating one chunk of FRACTAL_CACHE_CHUNK samples queued by a cached frame.
  *
- * t: The interpolation factor.
+ * arg: The FractalCacheJob.
+ * task: The index of the chunk.
  *
- * Returns: The smoothed interpolation factor.
+ * Returns: void
  */
-static float fade(float t)
+static void fractal_cacheSamples(void *arg, int task)
 {
-  return t * t * t * (t * (t * 6 - 15) + 10);
+  FractalCacheJob *job = (FractalCacheJob *)arg;
+  FractalCacheSample *queue = job->cache->queue;
+  int end = (task + 1) * FRACTAL_CACHE_CHUNK < job->nQueue ? (task + 1) * FRACTAL_CACHE_CHUNK : job->nQueue;
+  double re[FRACTAL_LANES], im[FRACTAL_LANES];
+  int count[FRACTAL_LANES];
+
+  for (int k = task * FRACTAL_CACHE_CHUNK; k < end; k += FRACTAL_LANES)
+  {
+    int n = end - k < FRACTAL_LANES ? end - k : FRACTAL_LANES;
+    for (int l = 0; l < n; l++)
+    {
+      re[l] = queue[k + l].re;
+      im[l] = queue[k + l].im;
+    }
+    fractal_iterate(&job->job, re, im, n, count);
+    for (int l = 0; l < n; l++)
+      *queue[k + l].slot = count[l];
+  }
 }
 
 /*
- * Function: lerp
- * --------------
- * Linear interpolation between two values.
+ * Function: fractal_cacheColor
+ * ----------------------------
+ * Thread task coloring one band of FRACTAL_BAND_ROWS rows of a cached frame from the samples its pixels read.
  *
- * t: The interpolation factor.
- * a, b: The values to interpolate between.
+ * arg: The FractalCacheJob.
+ * task: The index of the band.
  *
- * Returns: The interpolated value.
+ * Returns: void
  */
-static float lerp(float t, float a, float b)
+static void fractal_cacheColor(void *arg, int task)
 {
-  return a + t * (b - a);
+  FractalCacheJob *job = (FractalCacheJob *)arg;
+  Image *dst = job->job.dst;
+  int rowEnd = (task + 1) * FRACTAL_BAND_ROWS < dst->rows ? (task + 1) * FRACTAL_BAND_ROWS : dst->rows;
+
+  for (int i = task * FRACTAL_BAND_ROWS; i < rowEnd; i++)
+  {
+    FPixel *span = image_span(dst, i, 0);
+    int **slot = job->cache->slots + (size_t)i * dst->cols;
+    for (int j = 0; j < dst->cols; j++)
+      span[j] = getColor(*slot[j], job->job.p->maxIterations);
+    image_markSpan(dst, i, 0, dst->cols - 1);
+  }
 }
 
 /*
- * Function: noise
- * ---------------
- * Generates Perlin noise value for the given coordinates.
+ * Function: fractal_cacheInit
+ * ---------------------------
+ * Starts an empty cache of escape iterations.
  *
- * x, y: The coordinates.
+ * c: The cache.
+ * p: The fractal parameters, copied; with an orbit the type must be FractalMandelbrot.
+ * orbit: The reference orbit of a deep zoom, which must outlive the cache, or NULL.
+ * maxTiles: The number of tiles above which tiles the last frame did not read are freed, or 0 or less for
+ *           FRACTAL_CACHE_TILES.
  *
- * Returns: The Perlin noise value.
+ * Returns: 0 on success, 1 if the arguments are invalid or memory runs out.
  */
-static float noise(float x, float y)
+int fractal_cacheInit(FractalCache *c, FractalParams *p, const FractalOrbit *orbit, int maxTiles)
 {
-  // Calculate grid cell coordinates
-  int X = (int)floor(x) & 255;
-  int Y = (int)floor(y) & 255;
+  if (!c || !p || (orbit && p->type != FractalMandelbrot))
+  {
+    printf("Invalid arguments passed to fractal_cacheInit\n");
+    return 1;
+  }
+  c->maxTiles = maxTiles > 0 ? maxTiles : FRACTAL_CACHE_TILES;
+  for (c->nBuckets = 64; c->nBuckets < c->maxTiles; c->nBuckets *= 2)
+    ;
+  c->bucket = (FractalCacheTile **)calloc(c->nBuckets, sizeof(FractalCacheTile *));
+  if (!c->bucket)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return 1;
+  }
+  c->params = *p;
+  c->orbit = orbit;
+  c->nTiles = 0;
+  c->frame = 0;
+  c->slots = NULL;
+  c->queue = NULL;
+  c->nSlots = 0;
+  c->samples = 0;
+  c->iterations = 0;
+  return 0;
+}
 
-  // Calculate relative x, y coordinates in grid cell
-  x -= floor(x);
-  y -= floor(y);
+/*
+ * Function: fractal_cacheRender
+ * -----------------------------
+ * Renders a frame from the cache. The frame reads the finest level whose spacing is at most its pixel size, each
+ * pixel taking its nearest sample, so a frame is off by at most half a pixel. Samples the cache does not hold
+ * are iterated on the pool of the parameters. Once the cache holds more than its budget, tiles this frame did not
+ * read are freed.
+ *
+ * c: The cache.
+ * dst: The image to fill.
+ * re0, im0: The point of the top-left pixel, or its offset from the center of the orbit; the imaginary part
+ *           decreases down the image.
+ * width: The width of the image in the complex plane.
+ *
+ * Returns: void
+ */
+void fractal_cacheRender(FractalCache *c, Image *dst, double re0, double im0, double width)
+{
+  if (!c || !c->bucket || !dst || dst->rows <= 0 || dst->cols <= 0 || !(width > 0))
+  {
+    return;
+  }
 
-  // Compute fade curves for x, y
-  float u = fade(x);
-  float v = fade(y);
+  size_t nPixels = (size_t)dst->rows * dst->cols;
+  if (c->nSlots < nPixels)
+  {
+    int **slots = (int **)realloc(c->slots, nPixels * sizeof(int *));
+    if (slots)
+      c->slots = slots;
+    FractalCacheSample *queue = (FractalCacheSample *)realloc(c->queue, nPixels * sizeof(FractalCacheSample));
+    if (queue)
+      c->queue = queue;
+    if (!slots || !queue)
+    {
+      fprintf(stderr, "Memory allocation failed\n");
+      return;
+    }
+    c->nSlots = nPixels;
+  }
 
-  // Hash coordinates of the 4 square corners
-  int A = perm[X] + Y, AA = perm[A], AB = perm[A + 1];
-  int B = perm[X + 1] + Y, BA = perm[B], BB = perm[B + 1];
+  double step = width / dst->cols;
+  double spacing = FRACTAL_CACHE_BASE;
+  int level = 0;
+  while (spacing > step)
+  {
+    spacing *= 0.5;
+    level++;
+  }
+  c->frame++;
 
-  // Add blended results from 4 corners of the square
-  return lerp(v, lerp(u, dot(grad3[perm[AA] % 12], x, y), dot(grad3[perm[BA] % 12], x - 1, y)),
-              lerp(u, dot(grad3[perm[AB] % 12], x, y - 1), dot(grad3[perm[BB] % 12], x - 1, y - 1)));
+  // Find the sample of each pixel, queueing those not computed yet
+  FractalCacheJob job = {{&c->params, 0.0, 0.0, 0.0, 0.0, dst->rows, dst->cols, NULL, dst}, c, 0};
+  job.job.orbit = c->orbit;
+  for (int i = 0; i < dst->rows; i++)
+  {
+    long long b = llround((im0 - i * step) / spacing);
+    FractalCacheTile *tile = NULL;
+    for (int j = 0; j < dst->cols; j++)
+    {
+      long long a = llround((re0 + j * step) / spacing);
+      if (!tile || tile->tx != a >> FRACTAL_CACHE_SHIFT)
+      {
+        tile = fractal_cacheFind(c, level, a >> FRACTAL_CACHE_SHIFT, b >> FRACTAL_CACHE_SHIFT, 1);
+        if (!tile)
+        {
+          for (int k = 0; k < job.nQueue; k++)
+            *c->queue[k].slot = -1; // leave the cache as it was
+          return;
+        }
+        tile->lastUsed = c->frame;
+      }
+      int *slot = tile->counts + (b & (FRACTAL_CACHE_TILE - 1)) * FRACTAL_CACHE_TILE + (a & (FRACTAL_CACHE_TILE - 1));
+      if (*slot == -1)
+      {
+        *slot = -2; // queued
+        c->queue[job.nQueue].slot = slot;
+        c->queue[job.nQueue].re = a * spacing;
+        c->queue[job.nQueue].im = b * spacing;
+        job.nQueue++;
+      }
+      c->slots[(size_t)i * dst->cols + j] = slot;
+    }
+  }
+
+  ThreadPool *pool = c->params.pool;
+  threadpool_run(pool, (job.nQueue + FRACTAL_CACHE_CHUNK - 1) / FRACTAL_CACHE_CHUNK, fractal_cacheSamples, &job);
+  for (int k = 0; k < job.nQueue; k++)
+    c->iterations += *c->queue[k].slot;
+  c->samples += job.nQueue;
+  threadpool_run(pool, (dst->rows + FRACTAL_BAND_ROWS - 1) / FRACTAL_BAND_ROWS, fractal_cacheColor, &job);
+
+  if (c->nTiles > c->maxTiles)
+  {
+    for (int k = 0; k < c->nBuckets; k++)
+    {
+      FractalCacheTile **link = c->bucket + k;
+      while (*link)
+      {
+        FractalCacheTile *tile = *link;
+        if (tile->lastUsed < c->frame)
+        {
+          *link = tile->next;
+          free(tile);
+          c->nTiles--;
+        }
+        else
+          link = &tile->next;
+      }
+    }
+  }
+}
+
+/*
+ * Function: fractal_cacheFree
+ * ---------------------------
+ * Frees the tiles and buffers of a cache.
+ *
+ * c: The cache.
+ *
+ * Returns: void
+ */
+void fractal_cacheFree(FractalCache *c)
+{
+  if (!c || !c->bucket)
+  {
+    return;
+  }
+  for (int k = 0; k < c->nBuckets; k++)
+  {
+    while (c->bucket[k])
+    {
+      FractalCacheTile *tile = c->bucket[k];
+      c->bucket[k] = tile->next;
+      free(tile);
+    }
+  }
+  free(c->bucket);
+  free(c->slots);
+  free(c->queue);
+  c->bucket = NULL;
+  c->slots = NULL;
+  c->queue = NULL;
+  c->nSlots = 0;
+  c->nTiles = 0;
+}
+
+/*
+ * Function: mandelbrot
+ * --------------------
+ * Generates a Mandelbrot set and fills the given image.
+ *
+ * dst: The image to fill.
+ * x0, y0: The coordinates of the top-left corner of the rectangle in the complex plane.
+ * dx: The width of the rectangle in the complex plane.
+ *
+ * Returns: void
+ */
+void mandelbrot(Image *dst, float x0, float y0, float dx)
+{
+  FractalParams p;
+  fractal_params(&p, FractalMandelbrot);
+  p.maxIterations = 128; // Maximum number of iterations to determine set membership
+  p.periodicity = 0;     // too few iterations for cycle checks to pay off
+
+  // A pool of its own, so concurrent calls do not share one
+  p.pool = threadpool_create(0);
+
+  // Keep the original orientation: the real axis runs from -x0 to the left and the image starts at -(y0 + dy)
+  double dy = (double)dx * dst->rows / dst->cols;
+  FractalJob job = {&p, -x0, -(dy + y0), -(double)dx / dst->cols, dy / dst->rows, dst->rows, dst->cols, NULL, dst};
+  fractal_run(&job);
+  threadpool_delete(p.pool);
+}
+
+/*
+ * Function: julia
+ * ---------------
+ * Generates a Julia set and fills the given image.
+ *
+ * dst: The image to fill.
+ * x0, y0: The coordinates of the top-left corner of the rectangle in the complex plane.
+ * dx: The width of the rectangle in the complex plane.
+ *
+ * Returns: void
+ */
+void julia(Image *dst, float x0, float y0, float dx)
+{
+  FractalParams p;
+  fractal_params(&p, FractalJulia); // Constant c = -0.7454054 + 0.1130063i
+  p.maxIterations = 256;             // Maximum number of iterations to determine set membership
+  p.periodicity = 0;                 // too few iterations for cycle checks to pay off
+
+  // A pool of its own, so concurrent calls do not share one
+  p.pool = threadpool_create(0);
+
+  // Keep the original orientation, as in mandelbrot
+  double dy = (double)dx * dst->rows / dst->cols;
+  FractalJob job = {&p, -x0, -(dy + y0), -(double)dx / dst->cols, dy / dst->rows, dst->rows, dst->cols, NULL, dst};
+  fractal_run(&job);
+  threadpool_delete(p.pool);
 }
 
 /*
@@ -281,18 +1535,11 @@ static float noise(float x, float y)
  */
 void perlin_noise(Image *img, int seed, float scale)
 {
-  init_perlin(seed); // Initialize the permutation table with the seed
+  Noise noise;
+  NoiseParams params;
 
-  // Loop over each pixel in the image
-  for (int i = 0; i < img->rows; i++)
-  {
-    for (int j = 0; j < img->cols; j++)
-    {
-      float x = j / scale;          // Scale x coordinate
-      float y = i / scale;          // Scale y coordinate
-      float n = noise(x, y);        // Generate noise value
-      FPixel color = {n, n, n};     // Create grayscale color from noise value
-      image_setf(img, i, j, color); // Set the pixel color
-    }
-  }
+  noise_init(&noise, seed);     // Shuffle a private permutation table with the seed
+  noise_params(&params);        // One octave, filled on this thread
+  params.frequency = 1 / scale; // Scale the pixel coordinates
+  noise_fill(img, &noise, &params);
 }
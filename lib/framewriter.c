@@ -0,0 +1,226 @@
+// These functions provide a background thread that writes animation frames.
+// The render thread converts each finished Image into a pooled 8-bit buffer and
+// queues it, so rendering the next frame overlaps writing the previous one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "framewriter.h"
+
+// Write one converted frame to its PPM file and the GIF; returns 0 on success
+static int framewriter_output(FrameWriter *fw, FrameJob *job)
+{
+  int status = 0;
+
+  if (job->filename[0])
+  {
+    writePPM(job->pixels, fw->rows, fw->cols, 255, job->filename);
+  }
+  if (fw->gif && gif_addPixels(fw->gif, job->pixels))
+  {
+    status = 1;
+  }
+
+  return status;
+}
+
+// Writer thread loop: write queued frames in order and return their buffers to the pool
+static void *framewriter_worker(void *data)
+{
+  FrameWriter *fw = (FrameWriter *)data;
+
+  pthread_mutex_lock(&fw->lock);
+  while (1)
+  {
+    while (fw->count == 0 && !fw->quit)
+    {
+      pthread_cond_wait(&fw->ready, &fw->lock);
+    }
+    // Drain the queue before honouring quit
+    if (fw->count == 0)
+    {
+      break;
+    }
+
+    FrameJob job = fw->queue[fw->head];
+    fw->head = (fw->head + 1) % fw->nBuffers;
+    fw->count--;
+    fw->busy = 1;
+    pthread_mutex_unlock(&fw->lock);
+
+    int status = framewriter_output(fw, &job);
+
+    pthread_mutex_lock(&fw->lock);
+    fw->nErrors += status;
+    fw->pool[fw->nFree++] = job.pixels;
+    fw->busy = 0;
+    pthread_cond_broadcast(&fw->space);
+  }
+  pthread_mutex_unlock(&fw->lock);
+
+  return NULL;
+}
+
+// Create a frame writer for rows x cols frames with nBuffers conversion buffers
+// (nBuffers <= 0 uses FRAMEWRITER_BUFFERS); every frame is also added to gif when it is not NULL
+FrameWriter *framewriter_create(int rows, int cols, int nBuffers, GifWriter *gif)
+{
+  FrameWriter *fw = (FrameWriter *)malloc(sizeof(FrameWriter));
+  if (!fw)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return NULL;
+  }
+
+  if (nBuffers <= 0)
+  {
+    nBuffers = FRAMEWRITER_BUFFERS;
+  }
+
+  fw->rows = rows;
+  fw->cols = cols;
+  fw->nBuffers = nBuffers;
+  fw->pool = (Pixel **)malloc(nBuffers * sizeof(Pixel *));
+  fw->queue = (FrameJob *)malloc(nBuffers * sizeof(FrameJob));
+  fw->nFree = 0;
+  fw->head = 0;
+  fw->count = 0;
+  fw->busy = 0;
+  fw->gif = gif;
+  fw->nErrors = 0;
+  fw->threaded = 0;
+  fw->quit = 0;
+  if (!fw->pool || !fw->queue)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    free(fw->pool);
+    free(fw->queue);
+    free(fw);
+    return NULL;
+  }
+
+  for (int i = 0; i < nBuffers; i++)
+  {
+    Pixel *buf = (Pixel *)malloc((size_t)rows * cols * sizeof(Pixel));
+    if (!buf)
+    {
+      fprintf(stderr, "Memory allocation failed\n");
+      while (fw->nFree > 0)
+      {
+        free(fw->pool[--fw->nFree]);
+      }
+      free(fw->pool);
+      free(fw->queue);
+      free(fw);
+      return NULL;
+    }
+    fw->pool[fw->nFree++] = buf;
+  }
+
+  pthread_mutex_init(&fw->lock, NULL);
+  pthread_cond_init(&fw->ready, NULL);
+  pthread_cond_init(&fw->space, NULL);
+
+  // Without a writer thread, frames are simply written on the calling thread
+  if (pthread_create(&fw->thread, NULL, framewriter_worker, fw) == 0)
+  {
+    fw->threaded = 1;
+  }
+
+  return fw;
+}
+
+// Convert the image and queue it for writing to filename (NULL writes only the GIF).
+// Blocks while every buffer is in use; the image may be reused as soon as this returns.
+// Returns 0 on success
+int framewriter_write(FrameWriter *fw, Image *src, const char *filename)
+{
+  if (!fw || !src || src->rows != fw->rows || src->cols != fw->cols)
+  {
+    fprintf(stderr, "Frame does not match the frame writer size\n");
+    return 1;
+  }
+  if (filename && strlen(filename) >= FRAMEWRITER_PATH)
+  {
+    fprintf(stderr, "Frame filename is too long: %s\n", filename);
+    return 1;
+  }
+
+  // Wait for a free conversion buffer
+  pthread_mutex_lock(&fw->lock);
+  while (fw->nFree == 0)
+  {
+    pthread_cond_wait(&fw->space, &fw->lock);
+  }
+  FrameJob job;
+  job.pixels = fw->pool[--fw->nFree];
+  pthread_mutex_unlock(&fw->lock);
+
+  image_toPixels(src, job.pixels);
+  strcpy(job.filename, filename ? filename : "");
+
+  if (!fw->threaded)
+  {
+    int status = framewriter_output(fw, &job);
+    fw->pool[fw->nFree++] = job.pixels;
+    return status;
+  }
+
+  pthread_mutex_lock(&fw->lock);
+  fw->queue[(fw->head + fw->count) % fw->nBuffers] = job;
+  fw->count++;
+  pthread_cond_signal(&fw->ready);
+  pthread_mutex_unlock(&fw->lock);
+
+  return 0;
+}
+
+// Wait until every queued frame has been written
+void framewriter_flush(FrameWriter *fw)
+{
+  if (!fw)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&fw->lock);
+  while (fw->count > 0 || fw->busy)
+  {
+    pthread_cond_wait(&fw->space, &fw->lock);
+  }
+  pthread_mutex_unlock(&fw->lock);
+}
+
+// Write any queued frames, stop the writer thread, and free the writer.
+// The GIF is left open for the caller to finish; returns the number of frames the GIF rejected
+int framewriter_delete(FrameWriter *fw)
+{
+  if (!fw)
+  {
+    return 0;
+  }
+
+  if (fw->threaded)
+  {
+    pthread_mutex_lock(&fw->lock);
+    fw->quit = 1;
+    pthread_cond_signal(&fw->ready);
+    pthread_mutex_unlock(&fw->lock);
+    pthread_join(fw->thread, NULL);
+  }
+
+  int nErrors = fw->nErrors;
+
+  pthread_cond_destroy(&fw->space);
+  pthread_cond_destroy(&fw->ready);
+  pthread_mutex_destroy(&fw->lock);
+  while (fw->nFree > 0)
+  {
+    free(fw->pool[--fw->nFree]);
+  }
+  free(fw->pool);
+  free(fw->queue);
+  free(fw);
+
+  return nErrors;
+}
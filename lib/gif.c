@@ -1,5 +1,464 @@
+// These functions provide a native animated GIF encoder and helpers for building GIFs from PPM files.
+// Frames are written as they arrive: each frame stores only the rectangle that changed since the
+// previous one, quantized with median cut into a local color table and compressed with LZW.
+
 #include "gif.h"
 
+#define GIF_BINS 32768    // 5 bits per channel
+#define GIF_HASH 8192     // LZW dictionary hash table size, a power of two above 4096
+#define GIF_MAX_CODE 4096 // LZW codes are at most 12 bits
+
+// Structure to represent a median-cut box of histogram bins
+typedef struct
+{
+  int start;          // first entry of the box
+  int end;            // one past the last entry of the box
+  unsigned int count; // number of pixels in the box
+} GifBox;
+
+// Structure to represent the LZW code stream packed into GIF data sub-blocks
+typedef struct
+{
+  FILE *fp;
+  unsigned char block[255];
+  int length;
+  unsigned int bits;
+  int nBits;
+} GifStream;
+
+static _Thread_local int gifSortChannel;
+
+// Histogram bin of an 8-bit color
+static int gif_bin(Pixel *p)
+{
+  return ((p->r >> 3) << 10) | ((p->g >> 3) << 5) | (p->b >> 3);
+}
+
+// Channel c of a histogram bin
+static int gif_binChannel(int bin, int c)
+{
+  return (bin >> (10 - 5 * c)) & 31;
+}
+
+// Comparison function for sorting bins along one channel
+static int gif_compareBins(const void *a, const void *b)
+{
+  return gif_binChannel(*(const int *)a, gifSortChannel) - gif_binChannel(*(const int *)b, gifSortChannel);
+}
+
+// Write a 16-bit little-endian value
+static void gif_putShort(FILE *fp, int v)
+{
+  fputc(v & 0xff, fp);
+  fputc((v >> 8) & 0xff, fp);
+}
+
+// Append a code to the stream, flushing full sub-blocks
+static void gif_putCode(GifStream *gs, int code, int size)
+{
+  gs->bits |= (unsigned int)code << gs->nBits;
+  gs->nBits += size;
+  while (gs->nBits >= 8)
+  {
+    gs->block[gs->length++] = gs->bits & 0xff;
+    gs->bits >>= 8;
+    gs->nBits -= 8;
+    if (gs->length == 255)
+    {
+      fputc(255, gs->fp);
+      fwrite(gs->block, 1, 255, gs->fp);
+      gs->length = 0;
+    }
+  }
+}
+
+// Compress n palette indices with GIF-flavored LZW and write them as data sub-blocks
+static void gif_lzw(FILE *fp, unsigned char *index, int n, int minCodeSize)
+{
+  static _Thread_local int key[GIF_HASH];
+  static _Thread_local short value[GIF_HASH];
+  GifStream gs = {fp, {0}, 0, 0, 0};
+  int clear = 1 << minCodeSize;
+  int size = minCodeSize + 1;
+  int next = clear + 2;
+  int prefix = index[0];
+
+  fputc(minCodeSize, fp);
+  memset(key, 0, sizeof(key));
+  gif_putCode(&gs, clear, size);
+
+  for (int i = 1; i < n; i++)
+  {
+    int k = ((prefix << 8) | index[i]) + 1; // zero marks an empty slot
+    int h = (k * 2654435761u) >> 19 & (GIF_HASH - 1);
+    while (key[h] && key[h] != k)
+    {
+      h = (h + 1) & (GIF_HASH - 1);
+    }
+    if (key[h])
+    {
+      prefix = value[h]; // extend the current string
+      continue;
+    }
+
+    gif_putCode(&gs, prefix, size);
+    if (next < GIF_MAX_CODE)
+    {
+      key[h] = k;
+      value[h] = next++;
+      // The decoder adds its entries one code later, so grow once it would need the wider code
+      if (next > (1 << size) && size < 12)
+      {
+        size++;
+      }
+    }
+    else
+    {
+      // The dictionary is full, so start over
+      gif_putCode(&gs, clear, size);
+      memset(key, 0, sizeof(key));
+      size = minCodeSize + 1;
+      next = clear + 2;
+    }
+    prefix = index[i];
+  }
+
+  gif_putCode(&gs, prefix, size);
+  gif_putCode(&gs, clear + 1, size); // end of information
+  if (gs.nBits > 0)
+  {
+    gif_putCode(&gs, 0, 8 - gs.nBits);
+  }
+  if (gs.length > 0)
+  {
+    fputc(gs.length, fp);
+    fwrite(gs.block, 1, gs.length, fp);
+  }
+  fputc(0, fp); // block terminator
+}
+
+// Build a palette of at most maxColors entries for the histogram with median cut; returns the number of colors
+static int gif_quantize(GifWriter *gw, int nEntries, int maxColors, unsigned char palette[256][3])
+{
+  GifBox box[256];
+  int nBoxes = 1;
+
+  box[0].start = 0;
+  box[0].end = nEntries;
+  box[0].count = 0;
+  for (int i = 0; i < nEntries; i++)
+  {
+    box[0].count += gw->hist[gw->entry[i]];
+  }
+
+  while (nBoxes < maxColors)
+  {
+    // Split the most populated box that still holds more than one color
+    int best = -1;
+    for (int b = 0; b < nBoxes; b++)
+    {
+      if (box[b].end - box[b].start > 1 && (best < 0 || box[b].count > box[best].count))
+      {
+        best = b;
+      }
+    }
+    if (best < 0)
+    {
+      break;
+    }
+
+    // Find the longest side of the box
+    GifBox *bx = &box[best];
+    int lo[3] = {31, 31, 31}, hi[3] = {0, 0, 0};
+    for (int i = bx->start; i < bx->end; i++)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        int v = gif_binChannel(gw->entry[i], c);
+        lo[c] = v < lo[c] ? v : lo[c];
+        hi[c] = v > hi[c] ? v : hi[c];
+      }
+    }
+    gifSortChannel = 0;
+    for (int c = 1; c < 3; c++)
+    {
+      if (hi[c] - lo[c] > hi[gifSortChannel] - lo[gifSortChannel])
+      {
+        gifSortChannel = c;
+      }
+    }
+
+    // Cut at the pixel-weighted median along that side
+    qsort(gw->entry + bx->start, bx->end - bx->start, sizeof(int), gif_compareBins);
+    unsigned int half = 0;
+    int cut = bx->start + 1;
+    for (int i = bx->start; i < bx->end - 1; i++)
+    {
+      half += gw->hist[gw->entry[i]];
+      cut = i + 1;
+      if (half * 2 >= bx->count)
+      {
+        break;
+      }
+    }
+
+    box[nBoxes].start = cut;
+    box[nBoxes].end = bx->end;
+    box[nBoxes].count = bx->count - half;
+    bx->end = cut;
+    bx->count = half;
+    nBoxes++;
+  }
+
+  // Each color is the average of the exact colors in its box
+  for (int b = 0; b < nBoxes; b++)
+  {
+    double total[3] = {0.0, 0.0, 0.0};
+    for (int i = box[b].start; i < box[b].end; i++)
+    {
+      int bin = gw->entry[i];
+      gw->map[bin] = b;
+      for (int c = 0; c < 3; c++)
+      {
+        total[c] += gw->sum[bin][c];
+      }
+    }
+    for (int c = 0; c < 3; c++)
+    {
+      palette[b][c] = box[b].count ? (unsigned char)(total[c] / box[b].count + 0.5) : 0;
+    }
+  }
+
+  return nBoxes;
+}
+
+// Start writing an animated GIF of the given size; delay is in hundredths of a second. Returns NULL on failure.
+GifWriter *gif_begin(const char *filename, int rows, int cols, int delay)
+{
+  if (!filename || rows <= 0 || cols <= 0 || rows > 65535 || cols > 65535)
+  {
+    fprintf(stderr, "Invalid arguments passed to gif_begin\n");
+    return NULL;
+  }
+
+  GifWriter *gw = (GifWriter *)calloc(1, sizeof(GifWriter));
+  if (!gw)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return NULL;
+  }
+
+  size_t n = (size_t)rows * cols;
+  gw->rows = rows;
+  gw->cols = cols;
+  gw->delay = delay;
+  gw->frame = (Pixel *)malloc(n * sizeof(Pixel));
+  gw->prev = (Pixel *)malloc(n * sizeof(Pixel));
+  gw->index = (unsigned char *)malloc(n);
+  gw->hist = (unsigned int *)malloc(GIF_BINS * sizeof(unsigned int));
+  gw->sum = malloc(GIF_BINS * sizeof(*gw->sum));
+  gw->map = (unsigned char *)malloc(GIF_BINS);
+  gw->entry = (int *)malloc(GIF_BINS * sizeof(int));
+  gw->fp = fopen(filename, "wb");
+  if (!gw->frame || !gw->prev || !gw->index || !gw->hist || !gw->sum || !gw->map || !gw->entry || !gw->fp)
+  {
+    fprintf(stderr, "Unable to start GIF %s\n", filename);
+    if (gw->fp)
+      fclose(gw->fp);
+    gw->fp = NULL;
+    gif_end(gw);
+    return NULL;
+  }
+
+  // Header and logical screen descriptor without a global color table
+  fwrite("GIF89a", 1, 6, gw->fp);
+  gif_putShort(gw->fp, cols);
+  gif_putShort(gw->fp, rows);
+  fputc(0x00, gw->fp);
+  fputc(0x00, gw->fp);
+  fputc(0x00, gw->fp);
+
+  // Loop forever
+  fputc(0x21, gw->fp);
+  fputc(0xff, gw->fp);
+  fputc(11, gw->fp);
+  fwrite("NETSCAPE2.0", 1, 11, gw->fp);
+  fputc(3, gw->fp);
+  fputc(1, gw->fp);
+  gif_putShort(gw->fp, 0);
+  fputc(0, gw->fp);
+
+  return gw;
+}
+
+// Append a frame of rows * cols 8-bit pixels; returns 0 on success
+int gif_addPixels(GifWriter *gw, Pixel *pixels)
+{
+  int x0 = 0, y0 = 0, x1 = gw ? gw->cols - 1 : 0, y1 = gw ? gw->rows - 1 : 0;
+  int transparent = gw && gw->nFrames > 0;
+
+  if (!gw || !gw->fp || !pixels)
+  {
+    fprintf(stderr, "Null argument passed to gif_addPixels\n");
+    return 1;
+  }
+
+  // Only the rectangle that changed since the previous frame is stored
+  if (transparent)
+  {
+    x0 = gw->cols;
+    y0 = gw->rows;
+    x1 = -1;
+    y1 = -1;
+    for (int i = 0; i < gw->rows; i++)
+    {
+      Pixel *a = pixels + (size_t)i * gw->cols;
+      Pixel *b = gw->prev + (size_t)i * gw->cols;
+      if (!memcmp(a, b, gw->cols * sizeof(Pixel)))
+        continue;
+      int j0 = 0, j1 = gw->cols - 1;
+      while (!memcmp(&a[j0], &b[j0], sizeof(Pixel)))
+        j0++;
+      while (!memcmp(&a[j1], &b[j1], sizeof(Pixel)))
+        j1--;
+      x0 = j0 < x0 ? j0 : x0;
+      x1 = j1 > x1 ? j1 : x1;
+      y0 = i < y0 ? i : y0;
+      y1 = i;
+    }
+    if (x1 < 0)
+    {
+      // Nothing changed; store a single transparent pixel
+      x0 = y0 = x1 = y1 = 0;
+    }
+  }
+  int w = x1 - x0 + 1;
+  int h = y1 - y0 + 1;
+
+  // Histogram the pixels that changed
+  int nEntries = 0;
+  memset(gw->hist, 0, GIF_BINS * sizeof(unsigned int));
+  memset(gw->sum, 0, GIF_BINS * sizeof(*gw->sum));
+  for (int i = y0; i <= y1; i++)
+  {
+    for (int j = x0; j <= x1; j++)
+    {
+      size_t k = (size_t)i * gw->cols + j;
+      Pixel *p = &pixels[k];
+      if (transparent && !memcmp(p, &gw->prev[k], sizeof(Pixel)))
+        continue;
+      int bin = gif_bin(p);
+      if (!gw->hist[bin]++)
+        gw->entry[nEntries++] = bin;
+      gw->sum[bin][0] += p->r;
+      gw->sum[bin][1] += p->g;
+      gw->sum[bin][2] += p->b;
+    }
+  }
+
+  unsigned char palette[256][3];
+  int nColors = gif_quantize(gw, nEntries, transparent ? 255 : 256, palette);
+  if (nColors == 0)
+  {
+    palette[0][0] = palette[0][1] = palette[0][2] = 0;
+    nColors = 1;
+  }
+  int transIndex = nColors;
+  int nTable = nColors + transparent;
+  int bits = 1;
+  while ((1 << bits) < nTable)
+  {
+    bits++;
+  }
+
+  // Palette indices of the rectangle
+  unsigned char *idx = gw->index;
+  for (int i = y0; i <= y1; i++)
+  {
+    for (int j = x0; j <= x1; j++)
+    {
+      size_t k = (size_t)i * gw->cols + j;
+      if (transparent && !memcmp(&pixels[k], &gw->prev[k], sizeof(Pixel)))
+        *idx++ = transIndex;
+      else
+        *idx++ = gw->map[gif_bin(&pixels[k])];
+    }
+  }
+
+  // Graphic control extension: keep the previous frame underneath this one
+  fputc(0x21, gw->fp);
+  fputc(0xf9, gw->fp);
+  fputc(4, gw->fp);
+  fputc((1 << 2) | transparent, gw->fp);
+  gif_putShort(gw->fp, gw->delay);
+  fputc(transparent ? transIndex : 0, gw->fp);
+  fputc(0, gw->fp);
+
+  // Image descriptor with a local color table
+  fputc(0x2c, gw->fp);
+  gif_putShort(gw->fp, x0);
+  gif_putShort(gw->fp, y0);
+  gif_putShort(gw->fp, w);
+  gif_putShort(gw->fp, h);
+  fputc(0x80 | (bits - 1), gw->fp);
+  for (int i = 0; i < (1 << bits); i++)
+  {
+    if (i < nColors)
+      fwrite(palette[i], 1, 3, gw->fp);
+    else
+    {
+      fputc(0, gw->fp);
+      fputc(0, gw->fp);
+      fputc(0, gw->fp);
+    }
+  }
+
+  gif_lzw(gw->fp, gw->index, w * h, bits < 2 ? 2 : bits);
+
+  memcpy(gw->prev, pixels, (size_t)gw->rows * gw->cols * sizeof(Pixel));
+  gw->nFrames++;
+  return 0;
+}
+
+// Append an image as the next frame; the image must match the size given to gif_begin. Returns 0 on success.
+int gif_addFrame(GifWriter *gw, Image *src)
+{
+  if (!gw || !src || src->rows != gw->rows || src->cols != gw->cols)
+  {
+    fprintf(stderr, "Frame does not match the GIF size\n");
+    return 1;
+  }
+
+  // Convert to 8-bit the same way image_write does
+  image_toPixels(src, gw->frame);
+  return gif_addPixels(gw, gw->frame);
+}
+
+// Finish the GIF, close the file, and free the writer; returns 0 on success
+int gif_end(GifWriter *gw)
+{
+  int status = 0;
+
+  if (!gw)
+  {
+    return 1;
+  }
+  if (gw->fp)
+  {
+    fputc(0x3b, gw->fp); // trailer
+    status = fclose(gw->fp) ? 1 : 0;
+  }
+  free(gw->frame);
+  free(gw->prev);
+  free(gw->index);
+  free(gw->hist);
+  free(gw->sum);
+  free(gw->map);
+  free(gw->entry);
+  free(gw);
+  return status;
+}
+
 // Comparison function for sorting filenames
 static int compare(const void *a, const void *b) {
   return strcmp(*(const char **)a, *(const char **)b);
@@ -60,21 +519,37 @@ void list_ppm_files(const char *directory, char ***ppm_files, int *file_count)
     qsort(*ppm_files, *file_count, sizeof(char *), compare);
 }
 
-// Function to create a GIF from PPM files
+// Function to create a GIF from PPM files, all of which must have the size of the first
 void create_gif(const char *output_gif, char **ppm_files, int file_count, int delay)
 {
-  char command[4096] = "magick -delay ";
-  char delay_str[10];
-  snprintf(delay_str, sizeof(delay_str), "%d", delay);
-  strcat(command, delay_str);
-  strcat(command, " ");
+  GifWriter *gw = NULL;
 
   for (int i = 0; i < file_count; i++)
   {
-    strcat(command, ppm_files[i]);
-    strcat(command, " ");
+    int rows, cols, colors;
+    Pixel *pixels = readPPM(&rows, &cols, &colors, ppm_files[i]);
+    if (!pixels)
+    {
+      fprintf(stderr, "Unable to read PPM file %s\n", ppm_files[i]);
+      continue;
+    }
+
+    if (!gw)
+    {
+      gw = gif_begin(output_gif, rows, cols, delay);
+      if (!gw)
+      {
+        free(pixels);
+        return;
+      }
+    }
+
+    if (rows != gw->rows || cols != gw->cols)
+      fprintf(stderr, "Skipping %s: size does not match the first frame\n", ppm_files[i]);
+    else
+      gif_addPixels(gw, pixels);
+    free(pixels);
   }
 
-  strcat(command, output_gif);
-  system(command);
+  gif_end(gw);
 }
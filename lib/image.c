@@ -6,90 +6,143 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-// Helper function to allocate image data
-static int image_allocate_data(Image *src, int rows, int cols)
-{
-  // Allocate memory for 2D floating-point pixel data
-  src->data = (FPixel **)malloc(rows * sizeof(FPixel *));
-  if (!src->data)
-    return 1;
+// Fills larger than this many bytes bypass the cache
+#define IMAGE_STREAM_BYTES (4 << 20)
 
-  FPixel *dataBlock = (FPixel *)malloc(rows * cols * sizeof(FPixel));
-  if (!dataBlock)
+// Set n floats starting at dst to value, using aligned vector stores where possible
+static void image_fillFloats(float *dst, float value, size_t n)
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  __m128 v = _mm_set1_ps(value);
+  for (; i < n && ((size_t)(dst + i) & 15); i++)
   {
-    free(src->data);
-    return 1;
+    dst[i] = value;
   }
-
-  for (int i = 0; i < rows; i++)
+  if (n * sizeof(float) > IMAGE_STREAM_BYTES)
   {
-    src->data[i] = dataBlock + i * cols;
+    // Planes larger than the cache are written with non-temporal stores to skip the read for ownership
+    for (; i + 16 <= n; i += 16)
+    {
+      _mm_stream_ps(dst + i, v);
+      _mm_stream_ps(dst + i + 4, v);
+      _mm_stream_ps(dst + i + 8, v);
+      _mm_stream_ps(dst + i + 12, v);
+    }
+    _mm_sfence();
   }
-
-  // Allocate memory for 2D alpha values
-  src->a = (float **)malloc(rows * sizeof(float *));
-  if (!src->a)
+  for (; i + 16 <= n; i += 16)
   {
-    free(dataBlock);
-    free(src->data);
-    return 1;
+    _mm_store_ps(dst + i, v);
+    _mm_store_ps(dst + i + 4, v);
+    _mm_store_ps(dst + i + 8, v);
+    _mm_store_ps(dst + i + 12, v);
   }
-
-  float *aBlock = (float *)malloc(rows * cols * sizeof(float));
-  if (!aBlock)
+#endif
+  for (; i < n; i++)
   {
-    free(src->a);
-    free(dataBlock);
-    free(src->data);
-    return 1;
+    dst[i] = value;
   }
+}
 
-  for (int i = 0; i < rows; i++)
+// Set n pixels starting at dst to value; four pixels are three vector stores once dst is aligned
+static void image_fillPixels(FPixel *dst, FPixel value, size_t n)
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  float *rgb = value.rgb;
+  __m128 v0 = _mm_setr_ps(rgb[0], rgb[1], rgb[2], rgb[0]);
+  __m128 v1 = _mm_setr_ps(rgb[1], rgb[2], rgb[0], rgb[1]);
+  __m128 v2 = _mm_setr_ps(rgb[2], rgb[0], rgb[1], rgb[2]);
+  for (; i < n && ((size_t)(dst + i) & 15); i++)
   {
-    src->a[i] = aBlock + i * cols;
+    dst[i] = value;
   }
-
-  // Allocate memory for 2D depth values
-  src->z = (float **)malloc(rows * sizeof(float *));
-  if (!src->z)
+  if (n * sizeof(FPixel) > IMAGE_STREAM_BYTES)
   {
-    free(aBlock);
-    free(src->a);
-    free(dataBlock);
-    free(src->data);
-    return 1;
+    for (; i + 4 <= n; i += 4)
+    {
+      float *f = dst[i].rgb;
+      _mm_stream_ps(f, v0);
+      _mm_stream_ps(f + 4, v1);
+      _mm_stream_ps(f + 8, v2);
+    }
+    _mm_sfence();
   }
-
-  float *zBlock = (float *)malloc(rows * cols * sizeof(float));
-  if (!zBlock)
+  for (; i + 4 <= n; i += 4)
   {
-    free(src->z);
-    free(aBlock);
-    free(src->a);
-    free(dataBlock);
-    free(src->data);
-    return 1;
+    float *f = dst[i].rgb;
+    _mm_store_ps(f, v0);
+    _mm_store_ps(f + 4, v1);
+    _mm_store_ps(f + 8, v2);
+  }
+#endif
+  for (; i < n; i++)
+  {
+    dst[i] = value;
   }
+}
 
-  for (int i = 0; i < rows; i++)
+// Number of dirty-tile rows for an image
+static int image_tilesY(Image *src)
+{
+  return (src->rows + IMAGE_TILE_SIZE - 1) >> IMAGE_TILE_SHIFT;
+}
+
+// Number of tile rows in the hierarchical z-buffer
+static int image_hizY(Image *src)
+{
+  return (src->rows + IMAGE_HIZ_SIZE - 1) >> IMAGE_HIZ_SHIFT;
+}
+
+// Flag every tile as written, after an operation that touches the whole image
+static void image_markAll(Image *src)
+{
+  if (src->dirty)
   {
-    src->z[i] = zBlock + i * cols;
+    memset(src->dirty, 1, (size_t)src->tilesX * image_tilesY(src));
   }
+}
+
+// Helper function to allocate image data as one aligned block
+static int image_allocate_data(Image *src, int rows, int cols)
+{
+  // Pad rows so that every row of every plane starts on an aligned boundary
+  int stride = (cols + IMAGE_ALIGN / sizeof(float) - 1) & ~(int)(IMAGE_ALIGN / sizeof(float) - 1);
+  size_t n = (size_t)rows * stride;
+  size_t pixelBytes = n * sizeof(FPixel);
+  size_t planeBytes = n * sizeof(float);
+  size_t tableBytes = (size_t)rows * (sizeof(FPixel *) + 2 * sizeof(float *));
+  size_t total = (pixelBytes + 2 * planeBytes + tableBytes + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+
+  char *block = aligned_alloc(IMAGE_ALIGN, total);
+  if (!block)
+    return 1;
+
+  FPixel *dataBlock = (FPixel *)block;
+  float *aBlock = (float *)(block + pixelBytes);
+  float *zBlock = (float *)(block + pixelBytes + planeBytes);
+  src->data = (FPixel **)(block + pixelBytes + 2 * planeBytes);
+  src->a = (float **)(src->data + rows);
+  src->z = (float **)(src->a + rows);
+  src->block = block;
+  src->stride = stride;
 
-  // Initialize image data to appropriate values
   for (int i = 0; i < rows; i++)
   {
-    for (int j = 0; j < cols; j++)
-    {
-      src->data[i][j].rgb[0] = 0.0f; // Initialize R to 0.0
-      src->data[i][j].rgb[1] = 0.0f; // Initialize G to 0.0
-      src->data[i][j].rgb[2] = 0.0f; // Initialize B to 0.0
-      src->a[i][j] = 1.0f;           // Initialize alpha to 1.0
-      src->z[i][j] = 1.0f;           // Initialize depth to 1.0
-    }
+    src->data[i] = dataBlock + (size_t)i * stride;
+    src->a[i] = aBlock + (size_t)i * stride;
+    src->z[i] = zBlock + (size_t)i * stride;
   }
 
+  // Initialize image data to black with alpha and depth of 1.0; the alpha and depth planes are adjacent
+  memset(dataBlock, 0, pixelBytes);
+  image_fillFloats(aBlock, 1.0f, 2 * n);
+
   return 0;
 }
 
@@ -101,18 +154,16 @@ Image *image_create(int rows, int cols)
   {
     if (rows == 0 || cols == 0)
     {
-      src->cols = 0;
-      src->rows = 0;
-      src->data = NULL;
-      src->a = NULL;
-      src->z = NULL;
+      image_init(src);
     }
     else
     {
+      image_init(src);
       src->cols = cols;
       src->rows = rows;
       if (image_allocate_data(src, rows, cols) != 0)
       {
+        free(src);
         return NULL;
       }
     }
@@ -125,13 +176,11 @@ void image_free(Image *src)
 {
   if (src) // Check if the image pointer is not NULL
   {
-    free(src->data[0]); // Free the pixel data block
-    free(src->data);    // Free the array of row pointers
-    free(src->a[0]);    // Free the alpha data block
-    free(src->a);       // Free the array of alpha row pointers
-    free(src->z[0]);    // Free the depth data block
-    free(src->z);       // Free the array of depth row pointers
-    free(src);          // Free the image structure
+    free(src->block); // Free the planes and row tables
+    free(src->dirty); // Free the dirty-tile flags
+    free(src->gbuf);  // Free the G-buffer
+    free(src->zSeg);  // Free the hierarchical z-buffer
+    free(src);        // Free the image structure
   }
 }
 
@@ -140,11 +189,19 @@ void image_init(Image *src)
 {
   if (src) // Check if the image pointer is not NULL
   {
-    src->cols = 0; // Set the image cols to zero
-    src->rows = 0; // Set the image rows to zero
+    src->cols = 0;   // Set the image cols to zero
+    src->rows = 0;   // Set the image rows to zero
+    src->stride = 0; // Set the row stride to zero
     src->data = NULL;
     src->a = NULL;
     src->z = NULL;
+    src->block = NULL;
+    src->dirty = NULL;
+    src->tilesX = 0;
+    src->gbuf = NULL;
+    src->zSeg = NULL;
+    src->zTile = NULL;
+    src->hizX = 0;
   }
 }
 
@@ -157,23 +214,25 @@ int image_alloc(Image *src, int rows, int cols)
     src->rows = rows;
 
     // Free existing memory if any
-    if (src->data)
+    int tracking = src->dirty != NULL;
+    int deferred = src->gbuf != NULL;
+    int hierarchical = src->zSeg != NULL;
+    free(src->block);
+    src->block = NULL;
+
+    if (image_allocate_data(src, rows, cols))
     {
-      free(src->data[0]);
-      free(src->data);
+      return 1;
     }
-    if (src->a)
+    if (deferred && image_attachGBuffer(src, 1))
     {
-      free(src->a[0]);
-      free(src->a);
+      return 1;
     }
-    if (src->z)
+    if (hierarchical && image_trackDepth(src, 1))
     {
-      free(src->z[0]);
-      free(src->z);
+      return 1;
     }
-
-    return image_allocate_data(src, rows, cols);
+    return tracking ? image_trackTiles(src, 1) : 0;
   }
 
   return 1;
@@ -183,13 +242,11 @@ int image_alloc(Image *src, int rows, int cols)
 void image_dealloc(Image *src)
 {
   if (src)
-  {                     // Check if the image pointer is not NULL
-    free(src->data[0]); // Free the pixel data block
-    free(src->data);    // Free the array of row pointers
-    free(src->a[0]);    // Free the alpha data block
-    free(src->a);       // Free the array of alpha row pointers
-    free(src->z[0]);    // Free the depth data block
-    free(src->z);       // Free the array of depth row pointers
+  {                   // Check if the image pointer is not NULL
+    free(src->block); // Free the planes and row tables
+    free(src->dirty); // Free the dirty-tile flags
+    free(src->gbuf);  // Free the G-buffer
+    free(src->zSeg);  // Free the hierarchical z-buffer
 
     // Reset the Image structure fields
     image_init(src);
@@ -199,18 +256,229 @@ void image_dealloc(Image *src)
 // Resets every pixel to a default value (e.g. Black, alpha value of 1.0, z value of 1.0)
 void image_reset(Image *src)
 {
-  if (src) // Check if the image pointer is not NULL
+  if (src && src->block) // Check if the image has been allocated
+  {
+    if (src->dirty)
+    {
+      // Only clear the tiles written since the last reset
+      int tilesY = image_tilesY(src);
+      for (int ty = 0; ty < tilesY; ty++)
+      {
+        int r0 = ty << IMAGE_TILE_SHIFT;
+        int r1 = r0 + IMAGE_TILE_SIZE < src->rows ? r0 + IMAGE_TILE_SIZE : src->rows;
+        for (int tx = 0; tx < src->tilesX; tx++)
+        {
+          unsigned char *flag = &src->dirty[ty * src->tilesX + tx];
+          if (!*flag)
+            continue;
+
+          int c0 = tx << IMAGE_TILE_SHIFT;
+          int n = (c0 + IMAGE_TILE_SIZE < src->cols ? c0 + IMAGE_TILE_SIZE : src->cols) - c0;
+          for (int r = r0; r < r1; r++)
+          {
+            memset(image_span(src, r, c0), 0, n * sizeof(FPixel));
+            image_fillFloats(image_aspan(src, r, c0), 1.0f, n);
+            image_fillFloats(image_zspan(src, r, c0), 1.0f, n);
+          }
+          *flag = 0;
+        }
+      }
+    }
+    else
+    {
+      // Clear everything; the alpha and depth planes are adjacent
+      size_t n = (size_t)src->rows * src->stride;
+      memset(image_span(src, 0, 0), 0, n * sizeof(FPixel)); // Set all pixel values to zero
+      image_fillFloats(image_aspan(src, 0, 0), 1.0f, 2 * n); // Set all alpha and depth values to 1.0
+    }
+
+    if (src->zSeg)
+    {
+      image_fillFloats(src->zSeg, 1.0f, (size_t)(src->rows + image_hizY(src)) * src->hizX); // segments and tiles
+    }
+  }
+}
+
+// Turn dirty-tile tracking on or off. While it is on, image_reset only clears the tiles written since the
+// previous reset, so code that writes through the row tables directly must call image_markSpan.
+// Returns 0 on success.
+int image_trackTiles(Image *src, int enable)
+{
+  if (!src)
+  {
+    return 1;
+  }
+
+  free(src->dirty);
+  src->dirty = NULL;
+  src->tilesX = 0;
+
+  if (enable && src->block)
+  {
+    int tilesX = (src->cols + IMAGE_TILE_SIZE - 1) >> IMAGE_TILE_SHIFT;
+    src->dirty = (unsigned char *)malloc((size_t)tilesX * image_tilesY(src));
+    if (!src->dirty)
+    {
+      fprintf(stderr, "Unable to allocate dirty-tile flags\n");
+      return 1;
+    }
+    src->tilesX = tilesX;
+    image_markAll(src); // the current contents are unknown
+  }
+
+  return 0;
+}
+
+// Attach an empty G-buffer to the image, or free it. Deferred shading writes the visible surface of each pixel
+// into the G-buffer and lighting_shadeGBuffer lights and empties it, so image_reset leaves it alone.
+// Returns 0 on success.
+int image_attachGBuffer(Image *src, int enable)
+{
+  if (!src)
+  {
+    return 1;
+  }
+
+  free(src->gbuf);
+  src->gbuf = NULL;
+
+  if (enable && src->block)
+  {
+    src->gbuf = (GSample *)calloc((size_t)src->rows * src->stride, sizeof(GSample));
+    if (!src->gbuf)
+    {
+      fprintf(stderr, "Unable to allocate G-buffer\n");
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// Turn the hierarchical z-buffer on or off. While it is on, the image keeps a lower bound on the depth (1/z) of
+// every row segment and square tile of IMAGE_HIZ_SIZE pixels, so the rasterizer can reject spans and polygons that
+// are entirely hidden. Depth-tested writes only raise the depth, which keeps the bounds valid; code that lowers the
+// depth through the row tables must call image_updateDepth. Returns 0 on success.
+int image_trackDepth(Image *src, int enable)
+{
+  if (!src)
+  {
+    return 1;
+  }
+
+  free(src->zSeg);
+  src->zSeg = NULL;
+  src->zTile = NULL;
+  src->hizX = 0;
+
+  if (enable && src->block)
+  {
+    int hizX = (src->cols + IMAGE_HIZ_SIZE - 1) >> IMAGE_HIZ_SHIFT;
+    src->zSeg = (float *)malloc((size_t)(src->rows + image_hizY(src)) * hizX * sizeof(float));
+    if (!src->zSeg)
+    {
+      fprintf(stderr, "Unable to allocate hierarchical z-buffer\n");
+      return 1;
+    }
+    src->zTile = src->zSeg + (size_t)src->rows * hizX; // the tiles follow the segments
+    src->hizX = hizX;
+
+    // Start every tile at the far plane so each row lowers it to its real minimum
+    image_fillFloats(src->zTile, 1000.0f, (size_t)image_hizY(src) * hizX);
+    for (int r = 0; r < src->rows; r++)
+    {
+      float *seg = image_zsegments(src, r);
+      for (int s = 0; s < hizX; s++)
+      {
+        seg[s] = 1000.0f;
+      }
+      image_updateDepth(src, r, 0, src->cols - 1);
+    }
+  }
+
+  return 0;
+}
+
+// Recompute the depth bounds of the segments that hold columns c0 through c1 of a row, and of their tiles,
+// after the depth there changed
+void image_updateDepth(Image *src, int row, int c0, int c1)
+{
+  if (!src || !src->zSeg)
+  {
+    return;
+  }
+
+  float *seg = image_zsegments(src, row);
+  float *tile = src->zTile + (size_t)(row >> IMAGE_HIZ_SHIFT) * src->hizX;
+  int r0 = row & ~(IMAGE_HIZ_SIZE - 1);
+  int r1 = r0 + IMAGE_HIZ_SIZE < src->rows ? r0 + IMAGE_HIZ_SIZE : src->rows;
+
+  for (int s = c0 >> IMAGE_HIZ_SHIFT; s <= c1 >> IMAGE_HIZ_SHIFT; s++)
+  {
+    int a = s << IMAGE_HIZ_SHIFT;
+    int n = (a + IMAGE_HIZ_SIZE < src->cols ? a + IMAGE_HIZ_SIZE : src->cols) - a;
+    float *depth = image_zspan(src, row, a);
+    float m = depth[0];
+    for (int k = 1; k < n; k++)
+    {
+      m = depth[k] < m ? depth[k] : m;
+    }
+
+    float old = seg[s];
+    seg[s] = m;
+    if (m < tile[s])
+    {
+      tile[s] = m; // the depth was lowered
+    }
+    else if (old == tile[s])
+    {
+      // This segment may have held the tile minimum, so look at every row of the tile
+      float t = m;
+      for (int r = r0; r < r1; r++)
+      {
+        float v = src->zSeg[(size_t)r * src->hizX + s];
+        t = v < t ? v : t;
+      }
+      tile[s] = t;
+    }
+  }
+}
+
+// Test whether a surface whose depth (1/z) is at most z everywhere in rows [r0, r1] and columns [c0, c1] would lose
+// the depth test at every pixel, using the hierarchical z-buffer. z is raised slightly to allow for rounding in the
+// interpolated depth. Returns 0 when the buffer is off
+int image_occluded(Image *src, int r0, int c0, int r1, int c1, float z)
+{
+  if (!src || !src->zSeg)
   {
-    memset(src->data[0], 0, src->cols * src->rows * sizeof(FPixel)); // Set all pixel values to zero
-    for (int i = 0; i < src->rows; i++)
+    return 0;
+  }
+  if (r0 < 0)
+    r0 = 0;
+  if (c0 < 0)
+    c0 = 0;
+  if (r1 >= src->rows)
+    r1 = src->rows - 1;
+  if (c1 >= src->cols)
+    c1 = src->cols - 1;
+  if (r0 > r1 || c0 > c1)
+  {
+    return 1; // nothing of the surface is inside the image
+  }
+
+  z *= 1.0001f;
+  for (int ty = r0 >> IMAGE_HIZ_SHIFT; ty <= r1 >> IMAGE_HIZ_SHIFT; ty++)
+  {
+    float *tile = src->zTile + (size_t)ty * src->hizX;
+    for (int tx = c0 >> IMAGE_HIZ_SHIFT; tx <= c1 >> IMAGE_HIZ_SHIFT; tx++)
     {
-      for (int j = 0; j < src->cols; j++)
+      if (tile[tx] < z)
       {
-        src->a[i][j] = 1.0; // Set all alpha values to 1.0
-        src->z[i][j] = 1.0; // Set all depth values to 1.0
+        return 0;
       }
     }
   }
+  return 1;
 }
 
 // Returns the FPixel at (r, c).
@@ -263,6 +531,7 @@ void image_seta(Image *src, int row, int col, float value)
   if (src && row < src->rows && col < src->cols)
   {                           // Check if the coordinates are within bounds
     src->a[row][col] = value; // Set the alpha value for the pixel
+    image_markSpan(src, row, col, col);
   }
 }
 
@@ -272,6 +541,8 @@ void image_setz(Image *src, int row, int col, float value)
   if (src && row < src->rows && col < src->cols)
   {                           // Check if the coordinates are within bounds
     src->z[row][col] = value; // Set the depth value for the pixel
+    image_markSpan(src, row, col, col);
+    image_updateDepth(src, row, col, col);
   }
 }
 
@@ -281,6 +552,7 @@ void image_setc(Image *src, int row, int col, int ch, float value)
   if (src && row < src->rows && col < src->cols && ch >= 0 && ch < 3)
   {                                      // Check if coordinates and channel are within bounds
     src->data[row][col].rgb[ch] = value; // Set the channel value for the pixel
+    image_markSpan(src, row, col, col);
   }
 }
 
@@ -290,21 +562,17 @@ void image_setf(Image *src, int row, int col, FPixel value)
   if (src && row < src->rows && col < src->cols)
   {                              // Check if the coordinates are within bounds
     src->data[row][col] = value; // Set the pixel value
+    image_markSpan(src, row, col, col);
   }
 }
 
 // Fills the image with the FPixel value.
 void image_fill(Image *src, FPixel value)
 {
-  if (src)
-  { // Check if the image pointer is not NULL
-    for (int i = 0; i < src->rows; i++)
-    { // Loop over the rows
-      for (int j = 0; j < src->cols; j++)
-      {                               // Loop over the columns
-        image_setf(src, i, j, value); // Set the pixel value
-      }
-    }
+  if (src && src->block)
+  { // The pixel plane is one block, row padding included
+    image_fillPixels(image_span(src, 0, 0), value, (size_t)src->rows * src->stride);
+    image_markAll(src);
   }
 }
 
@@ -318,30 +586,24 @@ void image_fillrgb(Image *src, float r, float g, float b)
 // Sets the alpha value of each pixel to the given value.
 void image_filla(Image *src, float a)
 {
-  if (src)
-  { // Check if the image pointer is not NULL
-    for (int i = 0; i < src->rows; i++)
-    { // Loop over the rows
-      for (int j = 0; j < src->cols; j++)
-      {                           // Loop over the columns
-        image_seta(src, i, j, a); // Set the alpha value
-      }
-    }
+  if (src && src->block)
+  { // The alpha plane is one block, row padding included
+    image_fillFloats(image_aspan(src, 0, 0), a, (size_t)src->rows * src->stride);
+    image_markAll(src);
   }
 }
 
 // Sets the depth value of each pixel to the given value.
 void image_fillz(Image *src, float z)
 {
-  if (src)
-  { // Check if the image pointer is not NULL
-    for (int i = 0; i < src->rows; i++)
-    { // Loop over the rows
-      for (int j = 0; j < src->cols; j++)
-      {                           // Loop over the columns
-        image_setz(src, i, j, z); // Set the depth value
-      }
+  if (src && src->block)
+  { // The depth plane is one block, row padding included
+    image_fillFloats(image_zspan(src, 0, 0), z, (size_t)src->rows * src->stride);
+    if (src->zSeg)
+    {
+      image_fillFloats(src->zSeg, z, (size_t)(src->rows + image_hizY(src)) * src->hizX); // segments and tiles
     }
+    image_markAll(src);
   }
 }
 
@@ -379,36 +641,44 @@ Image *image_read(char *filename)
   return src;
 }
 
-// Write the image to a file in PPM P6 format
-int image_write(Image *src, char *filename)
+// Convert the image to 8-bit pixels, clamping each channel to [0, 1]
+void image_toPixels(Image *src, Pixel *dst)
 {
   int rows = src->rows;
   int cols = src->cols;
-  Pixel *ppmData = (Pixel *)malloc(rows * cols * sizeof(Pixel));
 
-  if (!ppmData)
-  {
-    fprintf(stderr, "Unable to allocate memory for PPM data\n");
-    return 0; // Return 0 if memory allocation fails
-  }
-
-  // Convert Image format to PPM data
   for (int i = 0; i < rows; i++)
   {
+    FPixel *row = image_span(src, i, 0);
+    Pixel *out = dst + (size_t)i * cols;
     for (int j = 0; j < cols; j++)
     {
-      FPixel p = src->data[i][j];
-      // Bounds check the pixel values
+      FPixel p = row[j];
       p.rgb[0] = p.rgb[0] < 0 ? 0 : p.rgb[0] > 1 ? 1 : p.rgb[0];
       p.rgb[1] = p.rgb[1] < 0 ? 0 : p.rgb[1] > 1 ? 1 : p.rgb[1];
       p.rgb[2] = p.rgb[2] < 0 ? 0 : p.rgb[2] > 1 ? 1 : p.rgb[2];
       Pixel pixel = {(unsigned char)(p.rgb[0] * 255), (unsigned char)(p.rgb[1] * 255), (unsigned char)(p.rgb[2] * 255)};
-      ppmData[i * cols + j] = pixel;
+      out[j] = pixel;
     }
   }
+}
 
+// Write the image to a file in PPM P6 format
+int image_write(Image *src, char *filename)
+{
+  int rows = src->rows;
+  int cols = src->cols;
+  Pixel *ppmData = (Pixel *)malloc(rows * cols * sizeof(Pixel));
+
+  if (!ppmData)
+  {
+    fprintf(stderr, "Unable to allocate memory for PPM data\n");
+    return 0; // Return 0 if memory allocation fails
+  }
+
+  image_toPixels(src, ppmData);
   writePPM(ppmData, rows, cols, 255, filename);
 
-  // free(ppmData);
+  free(ppmData);
   return 1; // Return 1 to indicate success
 }
\ No newline at end of file
@@ -2,10 +2,26 @@
 // Written by Nicholas Ung 2024-07-22
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
 #include <string.h>
 #include "lighting.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Structure to represent beta^s sampled over [0, 1] for one surface coefficient
+typedef struct
+{
+  int filled;                            // set once the table holds samples for s
+  float s;                               // surface coefficient of the table
+  float sample[LIGHTING_POW_STEPS + 2];  // beta^s at beta = i / LIGHTING_POW_STEPS, padded for interpolation
+} PowTable;
+
+static _Thread_local PowTable powTable[LIGHTING_POW_TABLES];
+static _Thread_local int powTableNext;
+
 // Create a new Lighting object
 Lighting *lighting_create(void)
 {
@@ -27,6 +43,7 @@ void lighting_delete(Lighting *lights)
 void lighting_init(Lighting *l)
 {
   l->nLights = 0;
+  l->prepared.valid = 0;
   for (int i = 0; i < MAX_LIGHTS; i++)
   {
     l->light[i].type = LightNone;
@@ -42,6 +59,7 @@ void lighting_init(Lighting *l)
 void lighting_clear(Lighting *l)
 {
   l->nLights = 0;
+  l->prepared.valid = 0;
 }
 
 // Add a light to a lighting structure
@@ -62,6 +80,7 @@ void lighting_add(Lighting *l, LightType type, Color *c, Vector *dir, Point *pos
     }
     light->cutoff = cutoff;
     light->sharpness = sharpness;
+    l->prepared.valid = 0;
   }
 }
 
@@ -215,3 +234,468 @@ void lighting_shading(Lighting *l, Vector *N, Vector *V, Point *P, Color *Cb, Co
     c->c[i] = fmin(fmax(c->c[i], 0.0), 1.0);
   }
 }
+
+// Group the lights by type and precompute their constants for lighting_shadeVertices.
+// Call it again after changing a light's fields directly; module_draw does so once per call.
+void lighting_prepare(Lighting *l)
+{
+  LightingPrepared *lp = &l->prepared;
+  static const LightType order[3] = {LightDirect, LightPoint, LightSpot};
+  int count[3] = {0, 0, 0};
+  int n = 0;
+
+  lp->ambient[0] = lp->ambient[1] = lp->ambient[2] = 0.0f;
+  for (int i = 0; i < l->nLights; i++)
+  {
+    if (l->light[i].type == LightAmbient)
+    {
+      for (int k = 0; k < 3; k++)
+        lp->ambient[k] += l->light[i].color.c[k];
+    }
+  }
+
+  for (int t = 0; t < 3; t++)
+  {
+    for (int i = 0; i < l->nLights; i++)
+    {
+      Light *light = &l->light[i];
+      if (light->type != order[t])
+      {
+        continue;
+      }
+
+      LightPrepared *q = &lp->light[n++];
+      if (light->type == LightDirect)
+      {
+        Vector L = light->direction;
+        vector_normalize(&L);
+        for (int k = 0; k < 3; k++)
+          q->pos[k] = L.val[k];
+      }
+      else
+      {
+        for (int k = 0; k < 3; k++)
+          q->pos[k] = light->position.val[k];
+      }
+      for (int k = 0; k < 3; k++)
+      {
+        q->dir[k] = light->direction.val[k];
+        q->color[k] = light->color.c[k];
+      }
+      q->cutoff = light->cutoff;
+      q->sharpness = light->sharpness;
+      count[t]++;
+    }
+  }
+
+  lp->nDirect = count[0];
+  lp->nPoint = count[1];
+  lp->nSpot = count[2];
+  lp->valid = 1;
+}
+
+// Returns this thread's table of beta^s, building it if s is not one of the recent coefficients
+static const float *lighting_powTable(float s)
+{
+  for (int i = 0; i < LIGHTING_POW_TABLES; i++)
+  {
+    if (powTable[i].filled && powTable[i].s == s)
+    {
+      return powTable[i].sample;
+    }
+  }
+
+  PowTable *t = &powTable[powTableNext];
+  powTableNext = (powTableNext + 1) % LIGHTING_POW_TABLES;
+  for (int i = 0; i <= LIGHTING_POW_STEPS; i++)
+  {
+    t->sample[i] = pow((double)i / LIGHTING_POW_STEPS, s);
+  }
+  t->sample[LIGHTING_POW_STEPS + 1] = t->sample[LIGHTING_POW_STEPS];
+  t->s = s;
+  t->filled = 1;
+  return t->sample;
+}
+
+// Look up beta^s by linear interpolation; beta is clamped to [0, 1]
+static inline float lighting_pow(const float *table, float beta)
+{
+  beta = beta < 0.0f ? 0.0f : beta > 1.0f ? 1.0f : beta;
+  float t = beta * LIGHTING_POW_STEPS;
+  int i = (int)t;
+  return table[i] + (table[i + 1] - table[i]) * (t - i);
+}
+
+// Structure to represent up to four vertices in structure-of-arrays form
+typedef struct
+{
+  float nx[4], ny[4], nz[4]; // unit surface normals
+  float vx[4], vy[4], vz[4]; // unit vectors toward the viewer
+  float px[4], py[4], pz[4]; // vertex positions
+  float c[3][4];             // shaded colors
+} ShadeBatch;
+
+#ifdef __SSE2__
+
+// Normalize four vectors held in x, y, z registers
+static inline void lighting_normalize4(__m128 *x, __m128 *y, __m128 *z)
+{
+  __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(*x, *x), _mm_mul_ps(*y, *y)), _mm_mul_ps(*z, *z)));
+  __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), len);
+  // Leave zero-length vectors at zero
+  inv = _mm_and_ps(inv, _mm_cmpgt_ps(len, _mm_setzero_ps()));
+  *x = _mm_mul_ps(*x, inv);
+  *y = _mm_mul_ps(*y, inv);
+  *z = _mm_mul_ps(*z, inv);
+}
+
+// Look up beta^s for four lanes
+static inline __m128 lighting_pow4(const float *table, __m128 beta)
+{
+  float b[4];
+  _mm_storeu_ps(b, beta);
+  for (int k = 0; k < 4; k++)
+    b[k] = lighting_pow(table, b[k]);
+  return _mm_loadu_ps(b);
+}
+
+// Add (Cb * theta + Cs * beta) * color * scale to the four lanes selected by mask
+static inline void lighting_accumulate4(__m128 c[3], const float *Cb, const float *Cs, const float *color, __m128 theta, __m128 beta, __m128 scale, __m128 mask)
+{
+  for (int k = 0; k < 3; k++)
+  {
+    __m128 term = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(Cb[k]), theta), _mm_mul_ps(_mm_set1_ps(Cs[k]), beta));
+    term = _mm_mul_ps(_mm_mul_ps(term, _mm_set1_ps(color[k])), scale);
+    c[k] = _mm_add_ps(c[k], _mm_and_ps(term, mask));
+  }
+}
+
+// Shade the four lanes of a batch with SSE2
+static void lighting_shadeBatch(LightingPrepared *lp, ShadeBatch *b, const float *Cb, const float *Cs, const float *table, int oneSided)
+{
+  __m128 zero = _mm_setzero_ps();
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128 twoSided = oneSided ? zero : _mm_castsi128_ps(_mm_set1_epi32(-1));
+  __m128 nx = _mm_loadu_ps(b->nx), ny = _mm_loadu_ps(b->ny), nz = _mm_loadu_ps(b->nz);
+  __m128 vx = _mm_loadu_ps(b->vx), vy = _mm_loadu_ps(b->vy), vz = _mm_loadu_ps(b->vz);
+  __m128 px = _mm_loadu_ps(b->px), py = _mm_loadu_ps(b->py), pz = _mm_loadu_ps(b->pz);
+  __m128 sigma = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, nx), _mm_mul_ps(vy, ny)), _mm_mul_ps(vz, nz));
+  __m128 c[3];
+  int i = 0;
+
+  for (int k = 0; k < 3; k++)
+    c[k] = _mm_set1_ps(Cb[k] * lp->ambient[k]);
+
+  for (; i < lp->nDirect; i++)
+  {
+    LightPrepared *q = &lp->light[i];
+    __m128 lx = _mm_set1_ps(q->pos[0]), ly = _mm_set1_ps(q->pos[1]), lz = _mm_set1_ps(q->pos[2]);
+    __m128 theta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz));
+    __m128 mask = _mm_or_ps(_mm_cmpgt_ps(theta, zero), twoSided);
+    __m128 hx = _mm_add_ps(lx, vx), hy = _mm_add_ps(ly, vy), hz = _mm_add_ps(lz, vz);
+    lighting_normalize4(&hx, &hy, &hz);
+    __m128 beta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, hx), _mm_mul_ps(ny, hy)), _mm_mul_ps(nz, hz));
+    lighting_accumulate4(c, Cb, Cs, q->color, theta, lighting_pow4(table, beta), one, mask);
+  }
+
+  for (; i < lp->nDirect + lp->nPoint; i++)
+  {
+    LightPrepared *q = &lp->light[i];
+    __m128 lx = _mm_sub_ps(_mm_set1_ps(q->pos[0]), px);
+    __m128 ly = _mm_sub_ps(_mm_set1_ps(q->pos[1]), py);
+    __m128 lz = _mm_sub_ps(_mm_set1_ps(q->pos[2]), pz);
+    lighting_normalize4(&lx, &ly, &lz);
+    __m128 theta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz));
+    __m128 back = _mm_cmplt_ps(theta, zero);
+
+    // Skip lanes lit from behind on one-sided surfaces, and lanes where the viewer and light are on opposite sides
+    __m128 mask = _mm_or_ps(_mm_cmpge_ps(theta, zero), twoSided);
+    mask = _mm_andnot_ps(_mm_and_ps(back, _mm_cmpgt_ps(sigma, zero)), mask);
+    mask = _mm_andnot_ps(_mm_and_ps(_mm_cmpgt_ps(theta, zero), _mm_cmplt_ps(sigma, zero)), mask);
+
+    __m128 hx = _mm_add_ps(lx, vx), hy = _mm_add_ps(ly, vy), hz = _mm_add_ps(lz, vz);
+    lighting_normalize4(&hx, &hy, &hz);
+    __m128 beta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, hx), _mm_mul_ps(ny, hy)), _mm_mul_ps(nz, hz));
+
+    // A two-sided surface lit from behind is shaded as if it faced the light
+    __m128 flip = _mm_or_ps(_mm_and_ps(back, _mm_set1_ps(-1.0f)), _mm_andnot_ps(back, one));
+    theta = _mm_mul_ps(theta, flip);
+    beta = _mm_mul_ps(beta, flip);
+    lighting_accumulate4(c, Cb, Cs, q->color, theta, lighting_pow4(table, beta), one, mask);
+  }
+
+  for (; i < lp->nDirect + lp->nPoint + lp->nSpot; i++)
+  {
+    LightPrepared *q = &lp->light[i];
+    __m128 lx = _mm_sub_ps(_mm_set1_ps(q->pos[0]), px);
+    __m128 ly = _mm_sub_ps(_mm_set1_ps(q->pos[1]), py);
+    __m128 lz = _mm_sub_ps(_mm_set1_ps(q->pos[2]), pz);
+    lighting_normalize4(&lx, &ly, &lz);
+    __m128 theta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz));
+    __m128 spot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(q->dir[0]), lx), _mm_mul_ps(_mm_set1_ps(q->dir[1]), ly)),
+                             _mm_mul_ps(_mm_set1_ps(q->dir[2]), lz));
+    __m128 mask = _mm_and_ps(_mm_or_ps(_mm_cmpgt_ps(theta, zero), twoSided), _mm_cmpgt_ps(spot, _mm_set1_ps(q->cutoff)));
+    if (!_mm_movemask_ps(mask))
+    {
+      continue;
+    }
+
+    __m128 hx = _mm_add_ps(lx, vx), hy = _mm_add_ps(ly, vy), hz = _mm_add_ps(lz, vz);
+    lighting_normalize4(&hx, &hy, &hz);
+    __m128 beta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, hx), _mm_mul_ps(ny, hy)), _mm_mul_ps(nz, hz));
+    float att[4];
+    _mm_storeu_ps(att, spot);
+    for (int k = 0; k < 4; k++)
+      att[k] = att[k] > 0.0f ? powf(att[k], q->sharpness) : 0.0f;
+    lighting_accumulate4(c, Cb, Cs, q->color, theta, lighting_pow4(table, beta), _mm_loadu_ps(att), mask);
+  }
+
+  for (int k = 0; k < 3; k++)
+    _mm_storeu_ps(b->c[k], _mm_min_ps(_mm_max_ps(c[k], zero), one));
+}
+
+#else
+
+// Shade the four lanes of a batch one lane at a time
+static void lighting_shadeBatch(LightingPrepared *lp, ShadeBatch *b, const float *Cb, const float *Cs, const float *table, int oneSided)
+{
+  for (int j = 0; j < 4; j++)
+  {
+    float n[3] = {b->nx[j], b->ny[j], b->nz[j]};
+    float v[3] = {b->vx[j], b->vy[j], b->vz[j]};
+    float p[3] = {b->px[j], b->py[j], b->pz[j]};
+    float sigma = v[0] * n[0] + v[1] * n[1] + v[2] * n[2];
+    float c[3];
+    int i = 0;
+
+    for (int k = 0; k < 3; k++)
+      c[k] = Cb[k] * lp->ambient[k];
+
+    for (; i < lp->nDirect + lp->nPoint + lp->nSpot; i++)
+    {
+      LightPrepared *q = &lp->light[i];
+      float L[3], H[3], len;
+      float scale = 1.0f;
+
+      for (int k = 0; k < 3; k++)
+        L[k] = i < lp->nDirect ? q->pos[k] : q->pos[k] - p[k];
+      len = sqrtf(L[0] * L[0] + L[1] * L[1] + L[2] * L[2]);
+      for (int k = 0; k < 3 && len > 0.0f; k++)
+        L[k] /= len;
+
+      float theta = n[0] * L[0] + n[1] * L[1] + n[2] * L[2];
+      if (i < lp->nDirect + lp->nPoint && i >= lp->nDirect)
+      {
+        // Point light: skip back lighting on one-sided surfaces and when the viewer and light are on opposite sides
+        if ((theta < 0 && oneSided) || (theta < 0 && sigma > 0) || (theta > 0 && sigma < 0))
+          continue;
+      }
+      else if (!(theta > 0 || !oneSided))
+      {
+        continue;
+      }
+      if (i >= lp->nDirect + lp->nPoint)
+      {
+        float spot = q->dir[0] * L[0] + q->dir[1] * L[1] + q->dir[2] * L[2];
+        if (!(spot > q->cutoff))
+          continue;
+        scale = spot > 0.0f ? powf(spot, q->sharpness) : 0.0f;
+      }
+
+      for (int k = 0; k < 3; k++)
+        H[k] = L[k] + v[k];
+      len = sqrtf(H[0] * H[0] + H[1] * H[1] + H[2] * H[2]);
+      for (int k = 0; k < 3 && len > 0.0f; k++)
+        H[k] /= len;
+      float beta = n[0] * H[0] + n[1] * H[1] + n[2] * H[2];
+      if (theta < 0 && i >= lp->nDirect && i < lp->nDirect + lp->nPoint)
+      {
+        theta = -theta;
+        beta = -beta;
+      }
+      beta = lighting_pow(table, beta);
+
+      for (int k = 0; k < 3; k++)
+        c[k] += (Cb[k] * theta + Cs[k] * beta) * q->color[k] * scale;
+    }
+
+    for (int k = 0; k < 3; k++)
+      b->c[k][j] = c[k] < 0.0f ? 0.0f : c[k] > 1.0f ? 1.0f : c[k];
+  }
+}
+
+#endif
+
+// Shade n vertices with the prepared lights, four at a time, writing their colors to c.
+// Follows lighting_shading, except that the specular power comes from a lookup table and
+// a negative specular term is treated as zero. N may be NULL, in which case every vertex faces the viewer
+void lighting_shadeVertices(Lighting *l, int n, Point *P, Vector *N, Point *viewer, Color *Cb, Color *Cs, float s, int oneSided, Color *c)
+{
+  LightingPrepared *lp = &l->prepared;
+  const float *table = lighting_powTable(s);
+  ShadeBatch b;
+
+  if (!lp->valid)
+  {
+    lighting_prepare(l);
+  }
+
+  for (int first = 0; first < n; first += 4)
+  {
+    int count = n - first < 4 ? n - first : 4;
+
+    // Gather the vertices, repeating the last one to fill the batch
+    for (int j = 0; j < 4; j++)
+    {
+      int i = first + (j < count ? j : count - 1);
+      float v[3], m[3], vlen, nlen;
+      for (int k = 0; k < 3; k++)
+        v[k] = viewer->val[k] - P[i].val[k];
+      vlen = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+      for (int k = 0; k < 3; k++)
+      {
+        v[k] = vlen > 0.0f ? v[k] / vlen : 0.0f;
+        m[k] = N ? N[i].val[k] : v[k];
+      }
+      nlen = sqrtf(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+      b.vx[j] = v[0];
+      b.vy[j] = v[1];
+      b.vz[j] = v[2];
+      b.nx[j] = nlen > 0.0f ? m[0] / nlen : 0.0f;
+      b.ny[j] = nlen > 0.0f ? m[1] / nlen : 0.0f;
+      b.nz[j] = nlen > 0.0f ? m[2] / nlen : 0.0f;
+      b.px[j] = P[i].val[0];
+      b.py[j] = P[i].val[1];
+      b.pz[j] = P[i].val[2];
+    }
+
+    lighting_shadeBatch(lp, &b, Cb->c, Cs->c, table, oneSided);
+
+    for (int j = 0; j < count; j++)
+    {
+      for (int k = 0; k < 3; k++)
+        c[first + j].c[k] = b.c[k][j];
+    }
+  }
+}
+
+// Number of deferred samples lit together
+#define LIGHTING_GBUFFER_BATCH 64
+
+// Structure to represent visible deferred samples with the same material waiting to be lit together
+typedef struct
+{
+  int n;                                   // number of queued samples
+  GSample *first;                          // first queued sample, whose material the others share
+  FPixel *pixel[LIGHTING_GBUFFER_BATCH];   // pixel each sample is written to
+  Point P[LIGHTING_GBUFFER_BATCH];         // world-space positions
+  Vector N[LIGHTING_GBUFFER_BATCH];        // world-space normals
+  Color c[LIGHTING_GBUFFER_BATCH];         // lit colors
+} GBufferBatch;
+
+// Light the queued samples and write them to their pixels
+static void lighting_flushGBuffer(Lighting *l, GBufferBatch *b, Point *viewer)
+{
+  Color Cb, Cs;
+
+  if (!b->n)
+  {
+    return;
+  }
+
+  for (int k = 0; k < 3; k++)
+  {
+    Cb.c[k] = b->first->body[k];
+    Cs.c[k] = b->first->surface[k];
+  }
+  lighting_shadeVertices(l, b->n, b->P, b->N, viewer, &Cb, &Cs, b->first->coeff, b->first->oneSided, b->c);
+  for (int j = 0; j < b->n; j++)
+  {
+    for (int k = 0; k < 3; k++)
+      b->pixel[j]->rgb[k] = b->c[j].c[k];
+  }
+  b->n = 0;
+}
+
+// Light the deferred samples in rows [rowStart, rowEnd) of the image's G-buffer, once per pixel, and empty them.
+// A sample is only lit if it is still the visible surface, that is if nothing drawn later replaced it in the z-buffer.
+// With dirty-tile tracking on, tiles not written since the last reset are skipped
+void lighting_shadeGBuffer(Lighting *l, Image *src, Point *viewer, int rowStart, int rowEnd)
+{
+  const size_t material = sizeof(GSample) - offsetof(GSample, body);
+  GBufferBatch b;
+
+  if (!l || !src || !src->gbuf || !viewer)
+  {
+    return;
+  }
+  if (rowStart < 0)
+    rowStart = 0;
+  if (rowEnd > src->rows)
+    rowEnd = src->rows;
+
+  b.n = 0;
+  b.first = NULL;
+  for (int r = rowStart; r < rowEnd; r++)
+  {
+    unsigned char *tile = src->dirty ? src->dirty + (size_t)(r >> IMAGE_TILE_SHIFT) * src->tilesX : NULL;
+    GSample *g = image_gspan(src, r, 0);
+    float *depth = image_zspan(src, r, 0);
+    FPixel *pixel = image_span(src, r, 0);
+
+    for (int c = 0; c < src->cols; c++)
+    {
+      if (tile && !tile[c >> IMAGE_TILE_SHIFT])
+      {
+        c |= IMAGE_TILE_SIZE - 1; // nothing was drawn in this tile
+        continue;
+      }
+
+      if (depth[c] == 1.0f)
+      {
+        continue; // the depth is still cleared, so nothing was drawn here
+      }
+
+      float z = g[c].z;
+      if (z == 0.0f)
+      {
+        continue;
+      }
+      g[c].z = 0.0f;
+      if (z != depth[c])
+      {
+        continue; // covered by something drawn after the sample
+      }
+
+      if (b.n == LIGHTING_GBUFFER_BATCH || (b.n && memcmp(g[c].body, b.first->body, material)))
+      {
+        lighting_flushGBuffer(l, &b, viewer);
+      }
+      if (!b.n)
+      {
+        b.first = &g[c];
+      }
+      for (int k = 0; k < 3; k++)
+      {
+        b.P[b.n].val[k] = g[c].world[k];
+        b.N[b.n].val[k] = g[c].normal[k];
+      }
+      b.P[b.n].val[3] = 1.0;
+      b.N[b.n].val[3] = 0.0;
+      b.pixel[b.n++] = &pixel[c];
+    }
+  }
+  lighting_flushGBuffer(l, &b, viewer);
+}
+
+// Light the whole G-buffer of an image. Deferred draws only fill the G-buffer, so the application calls this once
+// after the last draw of a frame and each visible pixel is lit once however many modules covered it
+void lighting_resolveGBuffer(Lighting *l, Image *src, Point *viewer)
+{
+  if (!l || !src || !viewer)
+  {
+    printf("Null argument passed to lighting_resolveGBuffer\n");
+    return;
+  }
+  lighting_shadeGBuffer(l, src, viewer, 0, src->rows);
+}
@@ -78,16 +78,24 @@ void line_draw(Line *l, Image *src, Color c) {
   while (1) {
     // Set pixel color if within the image boundaries
     if (x0 >= 0 && x0 < src->cols && y0 >= 0 && y0 < src->rows) {
+      float *depth = image_zspan(src, y0, x0);
+      FPixel *pixel = image_span(src, y0, x0);
       if (l->zBuffer) {
         // Perform z-buffer test
-        if (curZ > src->z[y0][x0] ) {
+        if (curZ > *depth) {
           // Update the z-buffer and draw the pixel
-          src->z[y0][x0] = curZ;
-          image_setColor(src, y0, x0, c);
+          *depth = curZ;
+          image_markSpan(src, y0, x0, x0);
+          pixel->rgb[0] = c.c[0];
+          pixel->rgb[1] = c.c[1];
+          pixel->rgb[2] = c.c[2];
         }
       } else {
         // Draw the pixel without z-buffer
-        image_setColor(src, y0, x0, c);
+        image_markSpan(src, y0, x0, x0);
+        pixel->rgb[0] = c.c[0];
+        pixel->rgb[1] = c.c[1];
+        pixel->rgb[2] = c.c[2];
       }
     }
 
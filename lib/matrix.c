@@ -3,6 +3,11 @@
 #include <math.h>
 #include "matrix.h"
 
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_X86
+#include <immintrin.h>
+#endif
+
 // Print the matrix to the file pointer
 void matrix_print(Matrix *m, FILE *fp)
 {
@@ -41,13 +46,13 @@ void matrix_identity(Matrix *m)
 }
 
 // Get the value at the specified row and column
-double matrix_get(Matrix *m, int row, int col)
+Real matrix_get(Matrix *m, int row, int col)
 {
   return m->m[row][col];
 }
 
 // Set the value at the specified row and column
-void matrix_set(Matrix *m, int row, int col, double val)
+void matrix_set(Matrix *m, int row, int col, Real val)
 {
   m->m[row][col] = val;
 }
@@ -96,57 +101,266 @@ void matrix_multiply(Matrix *left, Matrix *right, Matrix *result)
   matrix_copy(result, &temp);
 }
 
-// Transform the point by the matrix
-void matrix_xformPoint(Matrix *m, Point *p, Point *q)
+// Returns 1 if the bottom row of the matrix is (0, 0, 0, 1), so it leaves h unchanged
+int matrix_isAffine(Matrix *m)
+{
+  return m->m[3][0] == 0.0 && m->m[3][1] == 0.0 && m->m[3][2] == 0.0 && m->m[3][3] == 1.0;
+}
+
+#ifndef MATRIX_X86
+
+// Transform n points with plain C; the affine path copies h instead of computing the bottom row
+static void matrix_xformScalar(Matrix *m, Point *src, Point *dst, int n, int affine)
 {
-  Point temp;
-  point_copy(&temp, q);
-  for (int i = 0; i < 4; i++) {
-    temp.val[i] = 0.0;
-    for (int j = 0; j < 4; j++) {
-      temp.val[i] += m->m[i][j] * p->val[j];
+  for (int k = 0; k < n; k++)
+  {
+    Real x = src[k].val[0];
+    Real y = src[k].val[1];
+    Real z = src[k].val[2];
+    Real h = src[k].val[3];
+    for (int i = 0; i < 3; i++)
+    {
+      dst[k].val[i] = m->m[i][0] * x + m->m[i][1] * y + m->m[i][2] * z + m->m[i][3] * h;
     }
+    dst[k].val[3] = affine ? h : m->m[3][0] * x + m->m[3][1] * y + m->m[3][2] * z + m->m[3][3] * h;
   }
-  point_copy(q, &temp);
 }
 
-// Transform the vector by the matrix
-void matrix_xformVector(Matrix *m, Vector *v, Vector *q)
+#elif defined(GRAPHICS_SINGLE_PRECISION)
+
+// One row of a matrix times four points held as x, y, z and h registers, summed in the order of the general path
+static inline __m128 matrix_rowSSE(const __m128 e[4], __m128 x, __m128 y, __m128 z, __m128 h)
+{
+  __m128 r = _mm_mul_ps(e[0], x);
+  r = _mm_add_ps(r, _mm_mul_ps(e[1], y));
+  r = _mm_add_ps(r, _mm_mul_ps(e[2], z));
+  return _mm_add_ps(r, _mm_mul_ps(e[3], h));
+}
+
+// Transform n points with SSE. The general path holds one whole point per register; the affine path transposes
+// four points at a time, computes only the top three rows and passes h through
+static void matrix_xformSSE2(Matrix *m, Point *src, Point *dst, int n, int affine)
 {
-  Vector temp;
-  vector_copy(&temp, q);
-  for (int i = 0; i < 4; i++) {
-    temp.val[i] = 0.0;
-    for (int j = 0; j < 4; j++) {
-      temp.val[i] += m->m[i][j] * v->val[j];
+  int k = 0;
+  if (affine)
+  {
+    __m128 e[3][4];
+    for (int i = 0; i < 3; i++)
+    {
+      for (int j = 0; j < 4; j++)
+      {
+        e[i][j] = _mm_set1_ps(m->m[i][j]);
+      }
     }
+    for (; k + 3 < n; k += 4)
+    {
+      __m128 x = _mm_loadu_ps(src[k].val);
+      __m128 y = _mm_loadu_ps(src[k + 1].val);
+      __m128 z = _mm_loadu_ps(src[k + 2].val);
+      __m128 h = _mm_loadu_ps(src[k + 3].val);
+      _MM_TRANSPOSE4_PS(x, y, z, h); // into x, y, z and h of the four points
+      __m128 r0 = matrix_rowSSE(e[0], x, y, z, h);
+      __m128 r1 = matrix_rowSSE(e[1], x, y, z, h);
+      __m128 r2 = matrix_rowSSE(e[2], x, y, z, h);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, h); // back into one point per register
+      _mm_storeu_ps(dst[k].val, r0);
+      _mm_storeu_ps(dst[k + 1].val, r1);
+      _mm_storeu_ps(dst[k + 2].val, r2);
+      _mm_storeu_ps(dst[k + 3].val, h);
+    }
+  }
+
+  __m128 c[4];
+  for (int j = 0; j < 4; j++)
+  {
+    c[j] = _mm_set_ps(m->m[3][j], m->m[2][j], m->m[1][j], m->m[0][j]);
+  }
+  for (; k < n; k++)
+  {
+    __m128 r = _mm_mul_ps(c[0], _mm_set1_ps(src[k].val[0]));
+    r = _mm_add_ps(r, _mm_mul_ps(c[1], _mm_set1_ps(src[k].val[1])));
+    r = _mm_add_ps(r, _mm_mul_ps(c[2], _mm_set1_ps(src[k].val[2])));
+    r = _mm_add_ps(r, _mm_mul_ps(c[3], _mm_set1_ps(src[k].val[3])));
+    _mm_storeu_ps(dst[k].val, r);
   }
-  vector_copy(q, &temp);
+}
+
+// Transform n points with AVX, two points per register. The bottom row comes out of the same multiplies and adds
+// as the other three, so affine matrices take this path too; a three-row path has to transpose the points, and the
+// shuffles cost more than the row they save
+__attribute__((target("avx"))) static void matrix_xformAVX(Matrix *m, Point *src, Point *dst, int n, int affine)
+{
+  (void)affine;
+  __m256 c[4];
+  for (int j = 0; j < 4; j++)
+  {
+    c[j] = _mm256_set_ps(m->m[3][j], m->m[2][j], m->m[1][j], m->m[0][j],
+                         m->m[3][j], m->m[2][j], m->m[1][j], m->m[0][j]);
+  }
+
+  int k = 0;
+  for (; k + 1 < n; k += 2)
+  {
+    // Broadcast x, y, z and h of each point across its half of the register
+    __m256 p = _mm256_loadu_ps(src[k].val);
+    __m256 r = _mm256_mul_ps(c[0], _mm256_permute_ps(p, 0x00));
+    r = _mm256_add_ps(r, _mm256_mul_ps(c[1], _mm256_permute_ps(p, 0x55)));
+    r = _mm256_add_ps(r, _mm256_mul_ps(c[2], _mm256_permute_ps(p, 0xAA)));
+    r = _mm256_add_ps(r, _mm256_mul_ps(c[3], _mm256_permute_ps(p, 0xFF)));
+    _mm256_storeu_ps(dst[k].val, r);
+  }
+  if (k < n)
+  {
+    // The last point in the low half, without leaving AVX code for the SSE kernel
+    __m128 p = _mm_loadu_ps(src[k].val);
+    __m128 r = _mm_mul_ps(_mm256_castps256_ps128(c[0]), _mm_permute_ps(p, 0x00));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm256_castps256_ps128(c[1]), _mm_permute_ps(p, 0x55)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm256_castps256_ps128(c[2]), _mm_permute_ps(p, 0xAA)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm256_castps256_ps128(c[3]), _mm_permute_ps(p, 0xFF)));
+    _mm_storeu_ps(dst[k].val, r);
+  }
+}
+
+#else
+
+// Transform n points with SSE2, two rows of the result per register; the affine path computes the third row in
+// the low lane only and passes h through the high one
+static void matrix_xformSSE2(Matrix *m, Point *src, Point *dst, int n, int affine)
+{
+  // Columns of the matrix split into rows 0-1 and rows 2-3
+  __m128d lo[4], hi[4];
+  for (int j = 0; j < 4; j++)
+  {
+    lo[j] = _mm_set_pd(m->m[1][j], m->m[0][j]);
+    hi[j] = _mm_set_pd(m->m[3][j], m->m[2][j]);
+  }
+
+  if (affine)
+  {
+    for (int k = 0; k < n; k++)
+    {
+      __m128d x = _mm_set1_pd(src[k].val[0]);
+      __m128d y = _mm_set1_pd(src[k].val[1]);
+      __m128d z = _mm_set1_pd(src[k].val[2]);
+      __m128d h = _mm_set1_pd(src[k].val[3]);
+      __m128d a = _mm_mul_pd(lo[0], x);
+      __m128d b = _mm_mul_sd(hi[0], x);
+      a = _mm_add_pd(a, _mm_mul_pd(lo[1], y));
+      b = _mm_add_sd(b, _mm_mul_sd(hi[1], y));
+      a = _mm_add_pd(a, _mm_mul_pd(lo[2], z));
+      b = _mm_add_sd(b, _mm_mul_sd(hi[2], z));
+      a = _mm_add_pd(a, _mm_mul_pd(lo[3], h));
+      b = _mm_add_sd(b, _mm_mul_sd(hi[3], h));
+      _mm_storeu_pd(&dst[k].val[0], a);
+      _mm_storeu_pd(&dst[k].val[2], _mm_move_sd(h, b)); // row 2 from b, h from the source
+    }
+    return;
+  }
+
+  for (int k = 0; k < n; k++)
+  {
+    __m128d x = _mm_set1_pd(src[k].val[0]);
+    __m128d y = _mm_set1_pd(src[k].val[1]);
+    __m128d z = _mm_set1_pd(src[k].val[2]);
+    __m128d h = _mm_set1_pd(src[k].val[3]);
+    __m128d a = _mm_mul_pd(lo[0], x);
+    __m128d b = _mm_mul_pd(hi[0], x);
+    a = _mm_add_pd(a, _mm_mul_pd(lo[1], y));
+    b = _mm_add_pd(b, _mm_mul_pd(hi[1], y));
+    a = _mm_add_pd(a, _mm_mul_pd(lo[2], z));
+    b = _mm_add_pd(b, _mm_mul_pd(hi[2], z));
+    a = _mm_add_pd(a, _mm_mul_pd(lo[3], h));
+    b = _mm_add_pd(b, _mm_mul_pd(hi[3], h));
+    _mm_storeu_pd(&dst[k].val[0], a);
+    _mm_storeu_pd(&dst[k].val[2], b);
+  }
+}
+
+// Transform n points with AVX, one whole point per register. The bottom row comes out of the same multiplies and
+// adds as the other three, so affine matrices take this path too; a three-row path has to transpose the points,
+// and the shuffles cost more than the row they save
+__attribute__((target("avx"))) static void matrix_xformAVX(Matrix *m, Point *src, Point *dst, int n, int affine)
+{
+  (void)affine;
+  __m256d c0 = _mm256_set_pd(m->m[3][0], m->m[2][0], m->m[1][0], m->m[0][0]);
+  __m256d c1 = _mm256_set_pd(m->m[3][1], m->m[2][1], m->m[1][1], m->m[0][1]);
+  __m256d c2 = _mm256_set_pd(m->m[3][2], m->m[2][2], m->m[1][2], m->m[0][2]);
+  __m256d c3 = _mm256_set_pd(m->m[3][3], m->m[2][3], m->m[1][3], m->m[0][3]);
+
+  for (int k = 0; k < n; k++)
+  {
+    __m256d r = _mm256_mul_pd(c0, _mm256_broadcast_sd(&src[k].val[0]));
+    r = _mm256_add_pd(r, _mm256_mul_pd(c1, _mm256_broadcast_sd(&src[k].val[1])));
+    r = _mm256_add_pd(r, _mm256_mul_pd(c2, _mm256_broadcast_sd(&src[k].val[2])));
+    r = _mm256_add_pd(r, _mm256_mul_pd(c3, _mm256_broadcast_sd(&src[k].val[3])));
+    _mm256_storeu_pd(dst[k].val, r);
+  }
+}
+
+#endif
+
+#ifdef MATRIX_X86
+// Kernel for this processor, picked once when the program loads
+static void (*matrix_xformKernel)(Matrix *m, Point *src, Point *dst, int n, int affine) = matrix_xformSSE2;
+
+__attribute__((constructor)) static void matrix_pickKernel(void)
+{
+  __builtin_cpu_init(); // constructors may run before the CPU model is read
+  if (__builtin_cpu_supports("avx"))
+  {
+    matrix_xformKernel = matrix_xformAVX;
+  }
+}
+#endif
+
+// Transform n points from src into dst; src and dst may be the same array.
+// Uses AVX or SSE2 when the processor supports them; the SSE2 and C paths skip the bottom row for affine matrices.
+void matrix_xformPoints(Matrix *m, Point *src, Point *dst, int n)
+{
+  if (n <= 0)
+  {
+    return;
+  }
+
+#ifdef MATRIX_X86
+  matrix_xformKernel(m, src, dst, n, matrix_isAffine(m));
+#else
+  matrix_xformScalar(m, src, dst, n, matrix_isAffine(m));
+#endif
+}
+
+// Transform n vectors from src into dst; src and dst may be the same array
+void matrix_xformVectors(Matrix *m, Vector *src, Vector *dst, int n)
+{
+  matrix_xformPoints(m, src, dst, n);
+}
+
+// Transform the point by the matrix
+void matrix_xformPoint(Matrix *m, Point *p, Point *q)
+{
+  matrix_xformPoints(m, p, q, 1);
+}
+
+// Transform the vector by the matrix
+void matrix_xformVector(Matrix *m, Vector *v, Vector *q)
+{
+  matrix_xformPoints(m, v, q, 1);
 }
 
 // Transform the polygon by the matrix
 void matrix_xformPolygon(Matrix *m, Polygon *p)
 {
-  for (int i = 0; i < p->nVertex; i++)
+  matrix_xformPoints(m, p->vertex, p->vertex, p->nVertex);
+  if (p->normal)
   {
-    Point transformedPoint;
-    Vector transformedNormal;
-    matrix_xformPoint(m, &(p->vertex[i]), &transformedPoint);
-    point_copy(&(p->vertex[i]), &transformedPoint);
-    matrix_xformVector(m, &(p->normal[i]), &transformedNormal);
-    vector_copy(&(p->normal[i]), &transformedNormal);
+    matrix_xformVectors(m, p->normal, p->normal, p->nVertex);
   }
 }
 
 // Transform the polyline by the matrix
 void matrix_xformPolyline(Matrix *m, Polyline *p)
 {
-  for (int i = 0; i < p->numVertex; i++)
-  {
-    Point transformedPoint;
-    matrix_xformPoint(m, &(p->vertex[i]), &transformedPoint);
-    point_copy(&(p->vertex[i]), &transformedPoint);
-  }
+  matrix_xformPoints(m, p->vertex, p->vertex, p->numVertex);
 }
 
 // Transform the line by the matrix
@@ -160,7 +374,7 @@ void matrix_xformLine(Matrix *m, Line *l)
 }
 
 // Scale the matrix in 2D
-void matrix_scale2D(Matrix *m, double sx, double sy)
+void matrix_scale2D(Matrix *m, Real sx, Real sy)
 {
   // Create a scale matrix
   Matrix scale, result;
@@ -176,7 +390,7 @@ void matrix_scale2D(Matrix *m, double sx, double sy)
 }
 
 // Rotate the matrix about the Z axis
-void matrix_rotateZ(Matrix *m, double cth, double sth)
+void matrix_rotateZ(Matrix *m, Real cth, Real sth)
 {
   Matrix rotate, result;
   matrix_identity(&rotate);
@@ -189,7 +403,7 @@ void matrix_rotateZ(Matrix *m, double cth, double sth)
 }
 
 // Translate the matrix in 2D
-void matrix_translate2D(Matrix *m, double tx, double ty)
+void matrix_translate2D(Matrix *m, Real tx, Real ty)
 {
   Matrix translate, result;
   matrix_identity(&translate);
@@ -200,7 +414,7 @@ void matrix_translate2D(Matrix *m, double tx, double ty)
 }
 
 // Shear the matrix in 2D
-void matrix_shear2D(Matrix *m, double shx, double shy)
+void matrix_shear2D(Matrix *m, Real shx, Real shy)
 {
   Matrix shear, result;
   matrix_identity(&shear);
@@ -211,7 +425,7 @@ void matrix_shear2D(Matrix *m, double shx, double shy)
 }
 
 // Translate the matrix in 3D
-void matrix_translate(Matrix *m, double tx, double ty, double tz)
+void matrix_translate(Matrix *m, Real tx, Real ty, Real tz)
 {
   Matrix translate, result;
   matrix_identity(&translate);
@@ -223,7 +437,7 @@ void matrix_translate(Matrix *m, double tx, double ty, double tz)
 }
 
 // Scale the matrix in 3D
-void matrix_scale(Matrix *m, double sx, double sy, double sz)
+void matrix_scale(Matrix *m, Real sx, Real sy, Real sz)
 {
   Matrix scale, result;
   matrix_identity(&scale);
@@ -235,7 +449,7 @@ void matrix_scale(Matrix *m, double sx, double sy, double sz)
 }
 
 // Rotate the matrix about the X axis
-void matrix_rotateX(Matrix *m, double cth, double sth)
+void matrix_rotateX(Matrix *m, Real cth, Real sth)
 {
   Matrix rotate, result;
   matrix_identity(&rotate);
@@ -248,7 +462,7 @@ void matrix_rotateX(Matrix *m, double cth, double sth)
 }
 
 // Rotate the matrix about the Y axis
-void matrix_rotateY(Matrix *m, double cth, double sth)
+void matrix_rotateY(Matrix *m, Real cth, Real sth)
 {
   Matrix rotate, result;
   matrix_identity(&rotate);
@@ -279,7 +493,7 @@ void matrix_rotateXYZ(Matrix *m, Vector *u, Vector *v, Vector *w)
 }
 
 // Shear the matrix about the Z axis
-void matrix_shearZ(Matrix *m, double shx, double shy)
+void matrix_shearZ(Matrix *m, Real shx, Real shy)
 {
   Matrix shear, result;
   matrix_identity(&shear);
@@ -290,7 +504,7 @@ void matrix_shearZ(Matrix *m, double shx, double shy)
 }
 
 // Apply perspective transformation to the matrix
-void matrix_perspective(Matrix *m, double d)
+void matrix_perspective(Matrix *m, Real d)
 {
   Matrix perspective, result;
   matrix_identity(&perspective);
@@ -301,3 +515,73 @@ void matrix_perspective(Matrix *m, double d)
   matrix_multiply(&perspective, m, &result);
   matrix_copy(m, &result);
 }
+
+// Determinant of the 3x3 minor of m that excludes the given row and column
+static double matrix_minor(Matrix *m, int row, int col)
+{
+  double a[3][3];
+  int r = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    if (i == row)
+      continue;
+    int c = 0;
+    for (int j = 0; j < 4; j++)
+    {
+      if (j == col)
+        continue;
+      a[r][c++] = m->m[i][j];
+    }
+    r++;
+  }
+  return a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+         a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+         a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+}
+
+// Find the world-space center of projection of a perspective view matrix, the point it maps to (0, 0, 0, 0).
+// Returns 0 if the matrix has no finite center of projection, as with a parallel projection.
+int matrix_centerOfProjection(Matrix *vtm, Point *cop)
+{
+  Point best;
+  double bestLength = 0.0;
+  int bestRow = 0;
+
+  // Each row of cofactors of a singular matrix lies in its null space; keep the best conditioned one
+  for (int i = 0; i < 4; i++)
+  {
+    Point v;
+    double length = 0.0;
+    for (int j = 0; j < 4; j++)
+    {
+      v.val[j] = ((i + j) & 1 ? -1.0 : 1.0) * matrix_minor(vtm, i, j);
+      length += v.val[j] * v.val[j];
+    }
+    if (length > bestLength)
+    {
+      best = v;
+      bestLength = length;
+      bestRow = i;
+    }
+  }
+  if (bestLength == 0.0)
+  {
+    return 0;
+  }
+
+  // A nonsingular matrix has a nonzero determinant along the chosen row
+  double det = 0.0;
+  double rowLength = 0.0;
+  for (int j = 0; j < 4; j++)
+  {
+    det += vtm->m[bestRow][j] * best.val[j];
+    rowLength += vtm->m[bestRow][j] * vtm->m[bestRow][j];
+  }
+  if (fabs(det) > 1e-9 * sqrt(rowLength * bestLength) || fabs(best.val[3]) < 1e-12 * sqrt(bestLength))
+  {
+    return 0;
+  }
+
+  point_set3D(cop, best.val[0] / best.val[3], best.val[1] / best.val[3], best.val[2] / best.val[3]);
+  return 1;
+}
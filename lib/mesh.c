@@ -0,0 +1,198 @@
+// These functions provide methods for creating and manipulating indexed triangle meshes.
+
+#include "mesh.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Returns an allocated, empty Mesh pointer.
+Mesh *mesh_create(void)
+{
+  Mesh *m = (Mesh *)malloc(sizeof(Mesh));
+  if (m)
+  {
+    mesh_init(m);
+  }
+  return m;
+}
+
+// Frees the internal data for a Mesh and the Mesh pointer.
+void mesh_free(Mesh *m)
+{
+  if (m)
+  {
+    mesh_clear(m);
+    free(m);
+  }
+}
+
+// Initializes the existing Mesh to an empty, two-sided, z-buffered mesh.
+void mesh_init(Mesh *m)
+{
+  m->oneSided = 0;
+  m->zBuffer = 1;
+  m->nVertex = 0;
+  m->vertex = NULL;
+  m->normal = NULL;
+  m->color = NULL;
+  m->nTriangle = 0;
+  m->index = NULL;
+}
+
+// Frees the internal data and empties the mesh, keeping its flags.
+void mesh_clear(Mesh *m)
+{
+  if (m)
+  {
+    free(m->vertex);
+    free(m->normal);
+    free(m->color);
+    free(m->index);
+    m->vertex = NULL;
+    m->normal = NULL;
+    m->color = NULL;
+    m->index = NULL;
+    m->nVertex = 0;
+    m->nTriangle = 0;
+  }
+}
+
+// Sets the mesh to copies of numV vertices and numT triangles; nlist and clist may be NULL.
+// Returns 0 on success, or -1 if an index is out of range or memory runs out, leaving the mesh empty
+int mesh_set(Mesh *m, int numV, Point *vlist, Vector *nlist, Color *clist, int numT, int *ilist)
+{
+  if (!m || numV < 0 || numT < 0 || (numV && !vlist) || (numT && !ilist))
+  {
+    return -1;
+  }
+
+  for (int i = 0; i < 3 * numT; i++)
+  {
+    if (ilist[i] < 0 || ilist[i] >= numV)
+    {
+      fprintf(stderr, "mesh_set: triangle %d uses vertex %d of %d\n", i / 3, ilist[i], numV);
+      mesh_clear(m);
+      return -1;
+    }
+  }
+
+  mesh_clear(m);
+  m->vertex = (Point *)malloc((numV ? numV : 1) * sizeof(Point));
+  m->normal = nlist ? (Vector *)malloc((numV ? numV : 1) * sizeof(Vector)) : NULL;
+  m->color = clist ? (Color *)malloc((numV ? numV : 1) * sizeof(Color)) : NULL;
+  m->index = (int *)malloc((numT ? 3 * numT : 1) * sizeof(int));
+  if (!m->vertex || (nlist && !m->normal) || (clist && !m->color) || !m->index)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    mesh_clear(m);
+    return -1;
+  }
+
+  memcpy(m->vertex, vlist, numV * sizeof(Point));
+  if (nlist)
+    memcpy(m->normal, nlist, numV * sizeof(Vector));
+  if (clist)
+    memcpy(m->color, clist, numV * sizeof(Color));
+  memcpy(m->index, ilist, 3 * numT * sizeof(int));
+  m->nVertex = numV;
+  m->nTriangle = numT;
+  return 0;
+}
+
+// Sets the oneSided field to the value.
+void mesh_setSided(Mesh *m, int oneSided)
+{
+  if (m)
+  {
+    m->oneSided = oneSided;
+  }
+}
+
+// Sets the z-buffer flag to the given value.
+void mesh_zBuffer(Mesh *m, int flag)
+{
+  if (m)
+  {
+    m->zBuffer = flag;
+  }
+}
+
+// Copies the data from one mesh to another.
+void mesh_copy(Mesh *to, Mesh *from)
+{
+  if (to && from)
+  {
+    mesh_set(to, from->nVertex, from->vertex, from->normal, from->color, from->nTriangle, from->index);
+    to->oneSided = from->oneSided;
+    to->zBuffer = from->zBuffer;
+  }
+}
+
+// Sets each vertex normal to the area-weighted average of the normals of the triangles sharing it.
+// Returns 0 on success
+int mesh_computeNormals(Mesh *m)
+{
+  if (!m)
+  {
+    return -1;
+  }
+  if (!m->normal)
+  {
+    m->normal = (Vector *)malloc((m->nVertex ? m->nVertex : 1) * sizeof(Vector));
+    if (!m->normal)
+    {
+      fprintf(stderr, "Memory allocation failed\n");
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < m->nVertex; i++)
+  {
+    vector_set(&m->normal[i], 0.0, 0.0, 0.0);
+  }
+
+  // The unnormalized cross product is twice the triangle's area, which gives the weighting.
+  // The edges are taken about the middle vertex, the same winding readPLY uses for face normals
+  for (int t = 0; t < m->nTriangle; t++)
+  {
+    int *tri = &m->index[3 * t];
+    Vector a, b, n;
+    vector_subtract(&m->vertex[tri[0]], &m->vertex[tri[1]], &a);
+    vector_subtract(&m->vertex[tri[2]], &m->vertex[tri[1]], &b);
+    vector_cross(&a, &b, &n);
+    for (int j = 0; j < 3; j++)
+    {
+      for (int k = 0; k < 3; k++)
+      {
+        m->normal[tri[j]].val[k] += n.val[k];
+      }
+    }
+  }
+
+  for (int i = 0; i < m->nVertex; i++)
+  {
+    if (vector_length(&m->normal[i]) > 0.0)
+    {
+      vector_normalize(&m->normal[i]);
+    }
+  }
+  return 0;
+}
+
+// Prints mesh data to the stream designated by the FILE pointer.
+void mesh_print(Mesh *m, FILE *fp)
+{
+  if (m)
+  {
+    fprintf(fp, "Mesh: %d vertices, %d triangles\n", m->nVertex, m->nTriangle);
+    for (int i = 0; i < m->nVertex; i++)
+    {
+      fprintf(fp, "  ");
+      point_print(&m->vertex[i], fp);
+    }
+    for (int t = 0; t < m->nTriangle; t++)
+    {
+      fprintf(fp, "  [ %d %d %d ]\n", m->index[3 * t], m->index[3 * t + 1], m->index[3 * t + 2]);
+    }
+  }
+}
@@ -42,6 +42,10 @@ Element *element_init(ObjectType type, void *obj)
     polygon_init(&(e->obj.polygon));
     polygon_copy(&(e->obj.polygon), obj); // Copy the polygon
     break;
+  case ObjMesh:
+    mesh_init(&(e->obj.mesh));
+    mesh_copy(&(e->obj.mesh), obj); // Copy the mesh
+    break;
   case ObjIdentity:
     matrix_identity(&(e->obj.matrix)); // Set the matrix to identity
   case ObjMatrix:
@@ -81,6 +85,10 @@ void element_delete(Element *e)
   {
     polygon_clear(&(e->obj.polygon));
   }
+  else if (e->type == ObjMesh)
+  {
+    mesh_clear(&(e->obj.mesh));
+  }
   free(e);
 }
 
@@ -90,9 +98,62 @@ Module *module_create(void)
   Module *md = (Module *)malloc(sizeof(Module));
   md->head = NULL;
   md->tail = NULL;
+  md->boundEmpty = 1;
+  md->boundDepthTested = 1;
+  md->boundDirty = 1;
+  md->parent = NULL;
+  md->nParents = 0;
+  md->parentCapacity = 0;
   return md;
 }
 
+// Mark the cached bounds of a module and of everything that includes it as stale; a dirty module's ancestors are
+// already dirty, so the walk stops there
+static void module_invalidate(Module *md)
+{
+  if (md->boundDirty)
+  {
+    return;
+  }
+  md->boundDirty = 1;
+  for (int i = 0; i < md->nParents; i++)
+  {
+    module_invalidate((Module *)md->parent[i]);
+  }
+}
+
+// Record that parent includes sub, so changes to sub reach the parent's bounds; returns 0 on success
+static int module_link(Module *sub, Module *parent)
+{
+  if (sub->nParents == sub->parentCapacity)
+  {
+    int capacity = sub->parentCapacity ? sub->parentCapacity * 2 : 2;
+    void **list = (void **)realloc(sub->parent, capacity * sizeof(void *));
+    if (!list)
+    {
+      fprintf(stderr, "Memory allocation failed\n");
+      return 1;
+    }
+    sub->parent = list;
+    sub->parentCapacity = capacity;
+  }
+  sub->parent[sub->nParents++] = parent;
+  return 0;
+}
+
+// Remove one record of parent including sub
+static void module_unlink(Module *sub, Module *parent)
+{
+  for (int i = 0; i < sub->nParents; i++)
+  {
+    if (sub->parent[i] == parent)
+    {
+      sub->parent[i] = sub->parent[--sub->nParents];
+      return;
+    }
+  }
+}
+
 // Clear a module's elements
 void module_clear(Module *md)
 {
@@ -100,11 +161,16 @@ void module_clear(Module *md)
   while (current)
   {
     Element *next = current->next;
+    if (current->type == ObjModule)
+    {
+      module_unlink(current->obj.module, md);
+    }
     element_delete(current);
     current = next;
   }
   md->head = NULL;
   md->tail = NULL;
+  module_invalidate(md);
 }
 
 // Delete a module and free its memory
@@ -115,6 +181,21 @@ void module_delete(Module *md)
     return;
   }
   module_clear(md);
+
+  // Modules still including this one skip it from now on instead of following a freed pointer
+  while (md->nParents)
+  {
+    Module *parent = (Module *)md->parent[--md->nParents];
+    for (Element *e = parent->head; e; e = (Element *)e->next)
+    {
+      if (e->type == ObjModule && e->obj.module == md)
+      {
+        e->type = ObjNone;
+      }
+    }
+    module_invalidate(parent);
+  }
+  free(md->parent);
   free(md);
 }
 
@@ -135,6 +216,11 @@ void module_insert(Module *md, Element *e)
     md->tail->next = e;
     md->tail = e;
   }
+  if (e->type == ObjModule)
+  {
+    module_link(e->obj.module, md);
+  }
+  module_invalidate(md);
 }
 
 // Insert a submodule into a module
@@ -144,6 +230,171 @@ void module_module(Module *md, Module *sub)
   module_insert(md, e);
 }
 
+// Grow a bounding box to include the point transformed by M
+static void bound_add(Point *p, Matrix *M, Point *min, Point *max, int *empty)
+{
+  Point q;
+  matrix_xformPoint(M, p, &q);
+  for (int i = 0; i < 3; i++)
+  {
+    if (*empty || q.val[i] < min->val[i])
+      min->val[i] = q.val[i];
+    if (*empty || q.val[i] > max->val[i])
+      max->val[i] = q.val[i];
+  }
+  *empty = 0;
+}
+
+// Set the eight corners of a bounding box
+static void bound_corners(Point *min, Point *max, Point corner[8])
+{
+  for (int i = 0; i < 8; i++)
+  {
+    point_set3D(&corner[i],
+                i & 1 ? max->val[0] : min->val[0],
+                i & 2 ? max->val[1] : min->val[1],
+                i & 4 ? max->val[2] : min->val[2]);
+  }
+}
+
+// Get the object-space bounding box of a module, recomputing it if the module or a submodule changed; returns 0 if
+// it is empty
+int module_bounds(Module *md, Point *min, Point *max)
+{
+  if (!md)
+  {
+    return 0;
+  }
+
+  if (md->boundDirty)
+  {
+    Matrix LTM;
+    int empty = 1;
+    int depthTested = 1;
+    matrix_identity(&LTM);
+    point_set3D(&md->boundMin, 0.0, 0.0, 0.0);
+    point_set3D(&md->boundMax, 0.0, 0.0, 0.0);
+
+    for (Element *e = md->head; e; e = (Element *)e->next)
+    {
+      switch (e->type)
+      {
+      case ObjPoint:
+        bound_add(&e->obj.point, &LTM, &md->boundMin, &md->boundMax, &empty);
+        depthTested = 0; // points are drawn over everything
+        break;
+
+      case ObjLine:
+        bound_add(&e->obj.line.a, &LTM, &md->boundMin, &md->boundMax, &empty);
+        bound_add(&e->obj.line.b, &LTM, &md->boundMin, &md->boundMax, &empty);
+        depthTested &= e->obj.line.zBuffer != 0;
+        break;
+
+      case ObjPolygon:
+        for (int i = 0; i < e->obj.polygon.nVertex; i++)
+        {
+          bound_add(&e->obj.polygon.vertex[i], &LTM, &md->boundMin, &md->boundMax, &empty);
+        }
+        break;
+
+      case ObjMesh:
+        for (int i = 0; i < e->obj.mesh.nVertex && e->obj.mesh.nTriangle; i++)
+        {
+          bound_add(&e->obj.mesh.vertex[i], &LTM, &md->boundMin, &md->boundMax, &empty);
+        }
+        break;
+
+      case ObjMatrix:
+        matrix_multiply(&(e->obj.matrix), &LTM, &LTM);
+        break;
+
+      case ObjIdentity:
+        matrix_identity(&LTM);
+        break;
+
+      case ObjModule:
+      {
+        Point subMin, subMax, corner[8];
+        if (module_bounds(e->obj.module, &subMin, &subMax))
+        {
+          bound_corners(&subMin, &subMax, corner);
+          for (int i = 0; i < 8; i++)
+          {
+            bound_add(&corner[i], &LTM, &md->boundMin, &md->boundMax, &empty);
+          }
+          depthTested &= ((Module *)e->obj.module)->boundDepthTested;
+        }
+        break;
+      }
+
+      default:
+        break;
+      }
+    }
+
+    md->boundEmpty = empty;
+    md->boundDepthTested = depthTested;
+    md->boundDirty = 0;
+  }
+
+  if (min)
+    *min = md->boundMin;
+  if (max)
+    *max = md->boundMax;
+  return !md->boundEmpty;
+}
+
+// Test whether a module's bounding box lies entirely outside the view volume under VTM * GTM, or, when the image
+// has a hierarchical z-buffer, entirely behind what has already been drawn
+static int module_culled(Module *md, Matrix *VTM, Matrix *GTM, Image *src)
+{
+  Point min, max, corner[8], q[8];
+  Matrix M;
+  int codeAnd = ~0;
+
+  if (!module_bounds(md, &min, &max))
+  {
+    return 1; // nothing to draw
+  }
+
+  matrix_multiply(VTM, GTM, &M);
+  bound_corners(&min, &max, corner);
+  matrix_xformPoints(&M, corner, q, 8);
+  for (int i = 0; i < 8 && codeAnd; i++)
+  {
+    codeAnd &= clip_outcode(&q[i], src->rows, src->cols);
+  }
+  if (codeAnd)
+  {
+    return 1;
+  }
+  if (!src->zSeg || !md->boundDepthTested)
+  {
+    return 0;
+  }
+
+  // The depth is affine in the corners, so the nearest point of the box is one of them
+  double xmin = HUGE_VAL, xmax = -HUGE_VAL, ymin = HUGE_VAL, ymax = -HUGE_VAL;
+  float zmax = 0.0f;
+  for (int i = 0; i < 8; i++)
+  {
+    if (q[i].val[3] < CLIP_NEAR_EPSILON || q[i].val[2] <= 0.0)
+    {
+      return 0; // the box reaches behind the viewer
+    }
+    double x = q[i].val[0] / q[i].val[3];
+    double y = q[i].val[1] / q[i].val[3];
+    float z = 1.0 / q[i].val[2];
+    xmin = fmin(xmin, x);
+    xmax = fmax(xmax, x);
+    ymin = fmin(ymin, y);
+    ymax = fmax(ymax, y);
+    zmax = z > zmax ? z : zmax;
+  }
+
+  return image_occluded(src, (int)floor(ymin) - 1, (int)floor(xmin) - 1, (int)ceil(ymax) + 1, (int)ceil(xmax) + 1, zmax);
+}
+
 // Insert a point into a module
 void module_point(Module *md, Point *point)
 {
@@ -172,6 +423,13 @@ void module_polygon(Module *md, Polygon *polygon)
   module_insert(md, e);
 }
 
+// Insert an indexed triangle mesh into a module
+void module_mesh(Module *md, Mesh *mesh)
+{
+  Element *e = element_init(ObjMesh, mesh);
+  module_insert(md, e);
+}
+
 // Insert an identity matrix into a module
 void module_identity(Module *md)
 {
@@ -221,15 +479,130 @@ void module_shear2D(Module *md, double shx, double shy)
   module_insert(md, e);
 }
 
-// Draw the module
-void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src)
+// Draw an indexed mesh placed by GTM * LTM: every shared vertex is transformed, lit and projected once, then the
+// triangles are assembled from the transformed vertices and clipped only when they cross the view volume. cop is
+// the center of projection one-sided triangles are culled against, or NULL; raster queues the triangles, or NULL
+void module_drawMesh(Mesh *mesh, Matrix *LTM, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src, Point *cop, Rasterizer *raster)
 {
-  if (!md || !VTM || !GTM || !ds || !src)
+  int n = mesh->nVertex;
+  int gouraud = ds->shade == ShadeGouraud && lighting;
+  int perPixel = (ds->shade == ShadePhong || ds->shade == ShadeDeferred) && lighting && mesh->normal;
+  int cull = cop && mesh->oneSided && ds->shade != ShadeFrame && mesh->normal;
+  Matrix M;
+
+  if (n < 3 || mesh->nTriangle < 1)
   {
-    printf("Null argument passed to module_draw\n");
     return;
   }
 
+  Arena *arena = arena_frame();
+  ArenaMark mark = arena_mark(arena);
+
+  Point *world = (Point *)arena_alloc(arena, n * sizeof(Point));
+  Point *screen = (Point *)arena_alloc(arena, n * sizeof(Point));
+  Point *flat = (Point *)arena_alloc(arena, n * sizeof(Point));
+  unsigned char *code = (unsigned char *)arena_alloc(arena, n);
+  Vector *normal = mesh->normal ? (Vector *)arena_alloc(arena, n * sizeof(Vector)) : NULL;
+  Color *color = gouraud ? (Color *)arena_alloc(arena, n * sizeof(Color)) : mesh->color;
+  unsigned char *away = cull ? (unsigned char *)arena_alloc(arena, n) : NULL;
+  if (!world || !screen || !flat || !code || (mesh->normal && !normal) || (gouraud && !color) || (cull && !away))
+  {
+    arena_release(arena, mark);
+    return;
+  }
+
+  // Per-vertex work, done once however many triangles share the vertex
+  matrix_multiply(GTM, LTM, &M);
+  matrix_xformPoints(&M, mesh->vertex, world, n);
+  if (normal)
+  {
+    matrix_xformVectors(&M, mesh->normal, normal, n);
+  }
+  if (cull)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      Vector V;
+      vector_subtract(cop, &world[i], &V);
+      away[i] = vector_dot(&normal[i], &V) <= 0.0;
+    }
+  }
+  if (gouraud)
+  {
+    lighting_shadeVertices(lighting, n, world, normal, &ds->viewer, &ds->body, &ds->surface, ds->surfaceCoeff, mesh->oneSided, color);
+  }
+  matrix_xformPoints(VTM, world, screen, n);
+  for (int i = 0; i < n; i++)
+  {
+    code[i] = clip_outcode(&screen[i], src->rows, src->cols);
+    flat[i] = screen[i];
+    point_normalize(&flat[i]);
+  }
+
+  // Assemble each triangle from the shared vertices
+  Point vertex[3], vertexWorld[3];
+  Vector triNormal[3];
+  Color triColor[3];
+  Polygon T;
+  T.oneSided = mesh->oneSided;
+  T.zBuffer = mesh->zBuffer;
+  T.nVertex = 3;
+  T.vertex = vertex;
+  T.color = color ? triColor : NULL;
+  T.normal = normal ? triNormal : NULL;
+  T.vertexWorld = perPixel ? vertexWorld : NULL;
+
+  for (int t = 0; t < mesh->nTriangle; t++)
+  {
+    const int *tri = &mesh->index[3 * t];
+    int a = tri[0], b = tri[1], c = tri[2];
+    if (code[a] & code[b] & code[c])
+    {
+      continue; // entirely outside one plane of the view volume
+    }
+    if (cull && away[a] && away[b] && away[c])
+    {
+      continue; // one-sided triangle facing away from the viewer
+    }
+
+    int inside = !(code[a] | code[b] | code[c]);
+    for (int j = 0; j < 3; j++)
+    {
+      vertex[j] = inside ? flat[tri[j]] : screen[tri[j]];
+      if (color)
+        triColor[j] = color[tri[j]];
+      if (normal)
+        triNormal[j] = normal[tri[j]];
+      if (perPixel)
+        vertexWorld[j] = world[tri[j]];
+    }
+
+    Polygon *Q = &T;
+    if (!inside)
+    {
+      Q = polygon_clip(&T, src->rows, src->cols); // clip to the view volume
+      if (!Q)
+      {
+        continue;
+      }
+      polygon_normalize(Q); // normalize by the homogeneous coordinate
+    }
+    if (raster)
+    {
+      rasterizer_submit(raster, Q, ds, lighting, src); // queue for the tile rasterizer
+    }
+    else
+    {
+      polygon_drawShade(Q, src, ds, lighting);
+    }
+  }
+
+  arena_release(arena, mark); // the transformed vertices are no longer needed
+}
+
+// Traverse the module, drawing primitives directly or queueing polygons on the rasterizer when one is given
+static void module_drawInternal(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src, Point *cop, Rasterizer *raster)
+{
   Matrix LTM, GTMpass;
   matrix_identity(&LTM); // set the matrix LTM to identity
 
@@ -262,6 +635,7 @@ void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *
       matrix_xformPoint(GTM, &Y, &X);  // Transform by GTM
       matrix_xformPoint(VTM, &X, &Y);  // Transform by VTM
       point_normalize(&Y);             // Normalize by the homogeneous coordinate
+      rasterizer_flush(raster, src);   // Keep the drawing order of queued polygons
       point_draw(&Y, src, ds->color);  // Draw the point
       break;
     }
@@ -273,33 +647,75 @@ void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *
       matrix_xformLine(&LTM, &L);  // Transform by LTM
       matrix_xformLine(GTM, &L);   // Transform by GTM
       matrix_xformLine(VTM, &L);   // Transform by VTM
-      line_normalize(&L);          // Normalize by the homogeneous coordinate
-      printf("drawing line (%.2f %.2f) to (%.2f %.2f)\n",
-             L.a.val[0], L.a.val[1], L.b.val[0], L.b.val[1]);
+      if (!line_clip(&L, src->rows, src->cols)) // Clip to the view volume and normalize
+      {
+        break;
+      }
+      rasterizer_flush(raster, src); // Keep the drawing order of queued polygons
       line_draw(&L, src, ds->color); // Draw the line
       break;
     }
 
     case ObjPolygon:
     {
-      Polygon P;
-      polygon_init(&P);                  // initialize the polygon
-      polygon_copy(&P, &e->obj.polygon); // copy the polygon data
-      matrix_xformPolygon(&LTM, &P);     // transform by LTM
-      matrix_xformPolygon(GTM, &P);      // transform by GTM
+      Polygon P, *Q;
+      Arena *arena = arena_frame();
+      ArenaMark mark = arena_mark(arena);
+      if (polygon_copyArena(&P, &e->obj.polygon, arena, ds->shade == ShadeGouraud && lighting)) // copy into frame memory
+      {
+        arena_release(arena, mark);
+        break;
+      }
+      matrix_xformPolygon(&LTM, &P); // transform by LTM
+      matrix_xformPolygon(GTM, &P);  // transform by GTM
+      if (cop && P.oneSided && ds->shade != ShadeFrame && polygon_backFacing(&P, cop))
+      {
+        arena_release(arena, mark); // one-sided polygon facing away from the viewer
+        break;
+      }
       if (ds->shade == ShadeGouraud)
       {
         polygon_shade(&P, ds, lighting);
       }
-      matrix_xformPolygon(VTM, &P); // transform by VTM
-      polygon_normalize(&P);        // normalize by the homogeneous coordinate
-      fprintf(stdout, "Shading polygon\n");
-      polygon_print(&P, stdout); // print the polygon data
-      polygon_drawShade(&P, src, ds, lighting);
+      if ((ds->shade == ShadePhong || ds->shade == ShadeDeferred) && lighting && P.normal)
+      {
+        // Per-pixel lighting needs the world-space positions and normals
+        P.vertexWorld = (Point *)arena_alloc(arena, P.nVertex * sizeof(Point));
+        if (!P.vertexWorld)
+        {
+          arena_release(arena, mark);
+          break;
+        }
+        memcpy(P.vertexWorld, P.vertex, P.nVertex * sizeof(Point));
+        matrix_xformPoints(VTM, P.vertex, P.vertex, P.nVertex); // transform only the vertices by VTM
+      }
+      else
+      {
+        matrix_xformPolygon(VTM, &P); // transform by VTM
+      }
+      Q = polygon_clip(&P, src->rows, src->cols); // clip to the view volume
+      if (Q)
+      {
+        polygon_normalize(Q); // normalize by the homogeneous coordinate
+        if (raster)
+        {
+          rasterizer_submit(raster, Q, ds, lighting, src); // queue for the tile rasterizer
+        }
+        else
+        {
+          polygon_drawShade(Q, src, ds, lighting);
+        }
+      }
+      arena_release(arena, mark); // the copy is no longer needed
+
 
       break;
     }
 
+    case ObjMesh:
+      module_drawMesh(&e->obj.mesh, &LTM, VTM, GTM, ds, lighting, src, cop, raster);
+      break;
+
     case ObjMatrix:
       matrix_multiply(&(e->obj.matrix), &LTM, &LTM); // update LTM
       break;
@@ -311,9 +727,13 @@ void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *
     case ObjModule:
     {
       DrawState tempDS;
-      matrix_multiply(GTM, &LTM, &GTMpass);                              // GTM * LTM
-      drawstate_copy(&tempDS, ds);                                       // copy the draw state
-      module_draw(e->obj.module, VTM, &GTMpass, &tempDS, lighting, src); // recursive call
+      matrix_multiply(GTM, &LTM, &GTMpass); // GTM * LTM
+      if (module_culled(e->obj.module, VTM, &GTMpass, src))
+      {
+        break; // the whole subtree is outside the view volume
+      }
+      drawstate_copy(&tempDS, ds);                                                            // copy the draw state
+      module_drawInternal(e->obj.module, VTM, &GTMpass, &tempDS, lighting, src, cop, raster); // recursive call
       break;
     }
 
@@ -324,6 +744,57 @@ void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *
   }
 }
 
+// Draw the module. Deferred shading only fills the image's G-buffer; light it with lighting_resolveGBuffer once the
+// whole frame is drawn
+void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src)
+{
+  if (!md || !VTM || !GTM || !ds || !src)
+  {
+    printf("Null argument passed to module_draw\n");
+    return;
+  }
+
+  Point cop;
+  int perspective = matrix_centerOfProjection(VTM, &cop);
+  int deferred = ds->shade == ShadeDeferred && lighting;
+  if (deferred && !src->gbuf && image_attachGBuffer(src, 1))
+  {
+    return;
+  }
+  if (lighting)
+  {
+    lighting_prepare(lighting); // pick up any lights moved since the last draw
+  }
+  module_drawInternal(md, VTM, GTM, ds, lighting, src, perspective ? &cop : NULL, NULL);
+  arena_reset(arena_frame());
+}
+
+// Draw the module by binning its polygons into screen tiles and rasterizing the tiles on the rasterizer's threads.
+// Deferred shading only fills the G-buffer; rasterizer_shadeGBuffer lights it on the same threads once per frame
+void module_drawParallel(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src, Rasterizer *raster)
+{
+  if (!md || !VTM || !GTM || !ds || !src || !raster)
+  {
+    printf("Null argument passed to module_drawParallel\n");
+    return;
+  }
+
+  Point cop;
+  int perspective = matrix_centerOfProjection(VTM, &cop);
+  int deferred = ds->shade == ShadeDeferred && lighting;
+  if (deferred && !src->gbuf && image_attachGBuffer(src, 1))
+  {
+    return;
+  }
+  if (lighting)
+  {
+    lighting_prepare(lighting); // pick up any lights moved since the last draw
+  }
+  module_drawInternal(md, VTM, GTM, ds, lighting, src, perspective ? &cop : NULL, raster);
+  rasterizer_flush(raster, src);
+  arena_reset(arena_frame());
+}
+
 // Insert a 3D translation into a module
 void module_translate(Module *md, double tx, double ty, double tz)
 {
@@ -529,6 +1000,7 @@ void module_cube(Module *md, int solid)
     polygon_init(&p);
     Vector normals[6];
     polygon_init(&p);
+    polygon_setSided(&p, 1); // closed with outward normals, so back faces can be culled
 
     // Define normals for each face
     vector_set(&normals[0], 0, 0, -1); // Front face
@@ -634,6 +1106,7 @@ void module_cylinder(Module *mod, int sides, int solid)
   int i;
 
   polygon_init(&p);
+  polygon_setSided(&p, solid); // closed with outward normals, so back faces can be culled
   point_set3D(&xtop, 0, 0.5, 0.0);
   point_set3D(&xbot, 0, -0.5, 0.0);
 
@@ -737,6 +1210,7 @@ void module_sphere(Module *md, int slices, int stacks, int solid)
   int i, j;
 
   polygon_init(&p);
+  polygon_setSided(&p, solid); // closed with outward normals, so back faces can be culled
 
   for (i = 0; i < stacks; i++)
   {
@@ -873,6 +1347,7 @@ void module_torus(Module *md, float majorRadius, float minorRadius, int uSteps,
   float dv = 2.0 * M_PI / vSteps;
 
   polygon_init(&p);
+  polygon_setSided(&p, solid); // closed with outward normals, so back faces can be culled
 
   for (int i = 0; i < uSteps; i++)
   {
@@ -0,0 +1,294 @@
+// These functions provide Perlin noise generators with their own permutation tables, summed over octaves and
+// evaluated a vector of samples at a time, so several noise images can be made at once on different threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "noise.h"
+
+typedef float NoiseVec __attribute__((vector_size(NOISE_LANES * sizeof(float))));
+typedef int NoiseInt __attribute__((vector_size(NOISE_LANES * sizeof(int))));
+
+// Build the row kernel for AVX2 as well and pick it at load time when the processor has it; FMA is left out so
+// the vector and scalar paths give the same values
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define NOISE_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define NOISE_TARGETS
+#endif
+
+// The vector helpers must be inlined into each clone: a call would pass the vectors differently in the two
+#define NOISE_INLINE __attribute__((always_inline))
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// Gradient vectors for 3D Perlin noise; 2D noise uses their x and y components
+static const float grad3[12][3] = {
+    {1, 1, 0}, {-1, 1, 0}, {1, -1, 0}, {-1, -1, 0},
+    {1, 0, 1}, {-1, 0, 1}, {1, 0, -1}, {-1, 0, -1},
+    {0, 1, 1}, {0, -1, 1}, {0, 1, -1}, {0, -1, -1}};
+
+// Structure to represent one noise_fill job split into bands of rows
+typedef struct
+{
+  Image *dst;
+  const Noise *noise;
+  const NoiseParams *params;
+} NoiseJob;
+
+// Return the next value of a generator's private random sequence
+static unsigned int noise_random(unsigned int *state)
+{
+  unsigned int z = (*state += 0x9e3779b9u);
+  z = (z ^ (z >> 16)) * 0x85ebca6bu;
+  z = (z ^ (z >> 13)) * 0xc2b2ae35u;
+  return z ^ (z >> 16);
+}
+
+// Shuffle the permutation table of a generator from the seed
+void noise_init(Noise *n, unsigned int seed)
+{
+  unsigned int state = seed;
+
+  for (int i = 0; i < 256; i++)
+  {
+    n->perm[i] = i;
+  }
+  for (int i = 255; i > 0; i--)
+  {
+    int j = noise_random(&state) % (i + 1);
+    unsigned char swap = n->perm[i];
+    n->perm[i] = n->perm[j];
+    n->perm[j] = swap;
+  }
+  for (int i = 0; i < 256; i++)
+  {
+    n->perm[256 + i] = n->perm[i]; // repeat the table so lookups never wrap
+  }
+  for (int i = 0; i < 512; i++)
+  {
+    n->gradient[i] = n->perm[i] % 12;
+  }
+}
+
+// Set the default parameters: one octave with a cell every 32 pixels, doubling in frequency and halving in
+// amplitude from one octave to the next, filled on the calling thread
+void noise_params(NoiseParams *p)
+{
+  p->octaves = 1;
+  p->frequency = 1.0f / 32.0f;
+  p->lacunarity = 2.0f;
+  p->gain = 0.5f;
+  p->turbulence = 0;
+  p->threeD = 0;
+  p->z = 0.0f;
+  p->pool = NULL;
+}
+
+// Smoothing curve applied to the position within a cell
+static inline float noise_fade(float t)
+{
+  return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+// Linear interpolation from a to b
+static inline float noise_lerp(float t, float a, float b)
+{
+  return a + t * (b - a);
+}
+
+// Dot product of the gradient picked by hash with the offset from its corner
+static inline float noise_grad(const Noise *n, int hash, float x, float y, float z)
+{
+  const float *g = grad3[n->gradient[hash]];
+  return g[0] * x + g[1] * y + g[2] * z;
+}
+
+// Noise at (x, y, z); 2D noise is the slice z = 0, where only the four corners at z = 0 contribute
+static float noise_point(const Noise *n, float x, float y, float z, int threeD)
+{
+  const unsigned char *perm = n->perm;
+  float fx = floorf(x), fy = floorf(y), fz = floorf(z);
+  int X = (int)fx & 255, Y = (int)fy & 255, Z = (int)fz & 255;
+  x -= fx;
+  y -= fy;
+  z -= fz;
+  float u = noise_fade(x), v = noise_fade(y);
+
+  // Hash coordinates of the cell corners
+  int A = perm[X] + Y, AA = perm[A] + Z, AB = perm[A + 1] + Z;
+  int B = perm[X + 1] + Y, BA = perm[B] + Z, BB = perm[B + 1] + Z;
+
+  float near = noise_lerp(v, noise_lerp(u, noise_grad(n, AA, x, y, z), noise_grad(n, BA, x - 1, y, z)),
+                          noise_lerp(u, noise_grad(n, AB, x, y - 1, z), noise_grad(n, BB, x - 1, y - 1, z)));
+  if (!threeD)
+  {
+    return near;
+  }
+  float far = noise_lerp(v, noise_lerp(u, noise_grad(n, AA + 1, x, y, z - 1), noise_grad(n, BA + 1, x - 1, y, z - 1)),
+                         noise_lerp(u, noise_grad(n, AB + 1, x, y - 1, z - 1), noise_grad(n, BB + 1, x - 1, y - 1, z - 1)));
+  return noise_lerp(noise_fade(z), near, far);
+}
+
+// Return 2D Perlin noise at (x, y), in noise cells
+float noise_2D(const Noise *n, float x, float y)
+{
+  return noise_point(n, x, y, 0.0f, 0);
+}
+
+// Return 3D Perlin noise at (x, y, z), in noise cells
+float noise_3D(const Noise *n, float x, float y, float z)
+{
+  return noise_point(n, x, y, z, 1);
+}
+
+// Return the octave sum of the noise at (x, y), in noise cells of the first octave
+float noise_fbm(const Noise *n, const NoiseParams *p, float x, float y)
+{
+  float sum = 0.0f, amplitude = 1.0f, frequency = 1.0f;
+
+  for (int o = 0; o < p->octaves; o++)
+  {
+    float value = noise_point(n, x * frequency, y * frequency, p->z * frequency, p->threeD);
+    sum += amplitude * (p->turbulence ? fabsf(value) : value);
+    amplitude *= p->gain;
+    frequency *= p->lacunarity;
+  }
+  return sum;
+}
+
+// Vector forms of the helpers above, one sample per lane
+
+static inline NOISE_INLINE NoiseVec noise_fadeLanes(NoiseVec t)
+{
+  return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static inline NOISE_INLINE NoiseVec noise_lerpLanes(NoiseVec t, NoiseVec a, NoiseVec b)
+{
+  return a + t * (b - a);
+}
+
+// Split the samples into integer cells, rounding down, and the position within them
+static inline NOISE_INLINE NoiseInt noise_floorLanes(NoiseVec x, NoiseVec *frac)
+{
+  NoiseInt i = __builtin_convertvector(x, NoiseInt);
+  i += (NoiseInt)(x < __builtin_convertvector(i, NoiseVec)); // truncation rounded negative values up
+  *frac = x - __builtin_convertvector(i, NoiseVec);
+  return i;
+}
+
+// Noise of NOISE_LANES samples; the hashing looks up tables lane by lane, the rest runs on whole vectors
+static inline NOISE_INLINE NoiseVec noise_lanes(const Noise *n, NoiseVec x, NoiseVec y, NoiseVec z, int threeD)
+{
+  const unsigned char *perm = n->perm;
+  NoiseVec gx[8], gy[8], gz[8]; // gradient of each cell corner, z = 0 corners first
+  NoiseInt X = noise_floorLanes(x, &x) & 255;
+  NoiseInt Y = noise_floorLanes(y, &y) & 255;
+  NoiseInt Z = noise_floorLanes(z, &z) & 255;
+  int corners = threeD ? 8 : 4;
+
+  for (int l = 0; l < NOISE_LANES; l++)
+  {
+    int A = perm[X[l]] + Y[l], B = perm[X[l] + 1] + Y[l];
+    int hash[4] = {perm[A] + Z[l], perm[B] + Z[l], perm[A + 1] + Z[l], perm[B + 1] + Z[l]};
+    for (int c = 0; c < corners; c++)
+    {
+      const float *g = grad3[n->gradient[hash[c & 3] + (c >> 2)]];
+      gx[c][l] = g[0];
+      gy[c][l] = g[1];
+      gz[c][l] = g[2];
+    }
+  }
+
+  // Corner c sits at x + (c & 1), y + ((c >> 1) & 1), z + (c >> 2)
+  NoiseVec x1 = x - 1, y1 = y - 1, z1 = z - 1;
+  NoiseVec u = noise_fadeLanes(x), v = noise_fadeLanes(y);
+  NoiseVec near = noise_lerpLanes(v, noise_lerpLanes(u, gx[0] * x + gy[0] * y + gz[0] * z, gx[1] * x1 + gy[1] * y + gz[1] * z),
+                                  noise_lerpLanes(u, gx[2] * x + gy[2] * y1 + gz[2] * z, gx[3] * x1 + gy[3] * y1 + gz[3] * z));
+  if (!threeD)
+  {
+    return near;
+  }
+  NoiseVec far = noise_lerpLanes(v, noise_lerpLanes(u, gx[4] * x + gy[4] * y + gz[4] * z1, gx[5] * x1 + gy[5] * y + gz[5] * z1),
+                                 noise_lerpLanes(u, gx[6] * x + gy[6] * y1 + gz[6] * z1, gx[7] * x1 + gy[7] * y1 + gz[7] * z1));
+  return noise_lerpLanes(noise_fadeLanes(z), near, far);
+}
+
+// Fill out with count octave sums along a row: sample j is at (x0 + j * dx, y), in noise cells of the first octave
+NOISE_TARGETS
+void noise_row(const Noise *n, const NoiseParams *p, float x0, float y, float dx, int count, float *out)
+{
+  NoiseVec lane;
+  for (int l = 0; l < NOISE_LANES; l++)
+  {
+    lane[l] = l;
+  }
+
+  for (int j = 0; j < count; j += NOISE_LANES)
+  {
+    NoiseVec x = x0 + (lane + (float)j) * dx;
+    NoiseVec zero = {0};
+    NoiseVec sum = zero;
+    float amplitude = 1.0f, frequency = 1.0f;
+
+    for (int o = 0; o < p->octaves; o++)
+    {
+      NoiseVec value = noise_lanes(n, x * frequency, zero + y * frequency, zero + p->z * frequency, p->threeD);
+      if (p->turbulence)
+      {
+        value = (NoiseVec)((NoiseInt)value & 0x7fffffff); // clear the sign bits
+      }
+      sum += amplitude * value;
+      amplitude *= p->gain;
+      frequency *= p->lacunarity;
+    }
+
+    int m = count - j < NOISE_LANES ? count - j : NOISE_LANES;
+    for (int l = 0; l < m; l++)
+    {
+      out[j + l] = sum[l];
+    }
+  }
+}
+
+// Thread task filling one band of NOISE_BAND_ROWS rows
+static void noise_band(void *arg, int task)
+{
+  NoiseJob *job = (NoiseJob *)arg;
+  Image *dst = job->dst;
+  float frequency = job->params->frequency;
+  int rowEnd = (task + 1) * NOISE_BAND_ROWS < dst->rows ? (task + 1) * NOISE_BAND_ROWS : dst->rows;
+  float *row = (float *)malloc(dst->cols * sizeof(float));
+  if (!row)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return;
+  }
+
+  for (int i = task * NOISE_BAND_ROWS; i < rowEnd; i++)
+  {
+    noise_row(job->noise, job->params, 0.0f, i * frequency, frequency, dst->cols, row);
+    FPixel *span = image_span(dst, i, 0);
+    for (int j = 0; j < dst->cols; j++)
+    {
+      span[j].rgb[0] = span[j].rgb[1] = span[j].rgb[2] = row[j]; // grayscale
+    }
+    image_markSpan(dst, i, 0, dst->cols - 1);
+  }
+  free(row);
+}
+
+// Fill an image with grayscale noise, pixel (i, j) sampling (j, i) * frequency, on the parameters' pool if any
+void noise_fill(Image *dst, const Noise *n, const NoiseParams *p)
+{
+  if (!dst || !n || !p)
+  {
+    printf("Null argument passed to noise_fill\n");
+    return;
+  }
+
+  NoiseJob job = {dst, n, p};
+  threadpool_run(p->pool, (dst->rows + NOISE_BAND_ROWS - 1) / NOISE_BAND_ROWS, noise_band, &job);
+}
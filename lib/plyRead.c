@@ -11,317 +11,829 @@
 
 	Blender can export to PLY files (but doesn't seem to save colors)
 
+	The file is memory mapped and parsed in place. ascii, binary_little_endian
+	and binary_big_endian files are supported, and the vertex and face
+	properties are read in whatever order and with whatever types the header
+	declares. Elements other than vertex and face are skipped.
+
 */
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "plyRead.h"
 
-#define MaxVertices (10)
+// Largest number of elements a header may declare
+#define PLY_MAX_ELEMENTS 16
+
+// Longest ASCII value, in characters
+#define PLY_MAX_TOKEN 64
+
+// Where a vertex property is stored
+enum
+{
+	slot_skip = -1,
+	slot_x,
+	slot_y,
+	slot_z,
+	slot_nx,
+	slot_ny,
+	slot_nz,
+	slot_red,
+	slot_green,
+	slot_blue,
+	slot_indices // the vertex list of a face
+};
+
+typedef enum
+{
+	format_ascii,
+	format_binary_little_endian,
+	format_binary_big_endian
+} ply_format;
+
+// An element declared in the header, with its properties in file order
+typedef struct
+{
+	char name[32];
+	long count;
+	ply_property *props;
+	ply_property *tail;
+} ply_element;
+
+// Read position in the mapped file
+typedef struct
+{
+	const unsigned char *cur;
+	const unsigned char *end;
+	ply_format format;
+	int swap;  // binary values have the opposite byte order to this machine
+	int error; // set when the data runs out or a value cannot be parsed
+} ply_cursor;
+
+// Vertex and face arrays parsed from a PLY body, before they become polygons or a mesh
+typedef struct
+{
+	Point *vertex;
+	Vector *normal;
+	Color *color;
+	int *faceStart; // offset of each face's indices, numPoly + 1 entries
+	int *faceIndex; // vertex indices of all faces
+	long numVertex;
+	long numPoly;
+	int hasNormals;
+	int hasColors;
+} ply_data;
 
 ply_type plyType(char *buffer)
 {
-	if (!strcmp(buffer, "float32"))
+	if (!strcmp(buffer, "float32") || !strcmp(buffer, "float"))
 		return (type_float32);
 
-	if (!strcmp(buffer, "uint8"))
+	if (!strcmp(buffer, "uint8") || !strcmp(buffer, "uchar"))
 		return (type_uint8);
 
-	if (!strcmp(buffer, "int32"))
+	if (!strcmp(buffer, "int32") || !strcmp(buffer, "int"))
 		return (type_int32);
 
+	if (!strcmp(buffer, "int8") || !strcmp(buffer, "char"))
+		return (type_int8);
+
+	if (!strcmp(buffer, "int16") || !strcmp(buffer, "short"))
+		return (type_int16);
+
+	if (!strcmp(buffer, "uint16") || !strcmp(buffer, "ushort"))
+		return (type_uint16);
+
+	if (!strcmp(buffer, "uint32") || !strcmp(buffer, "uint"))
+		return (type_uint32);
+
+	if (!strcmp(buffer, "float64") || !strcmp(buffer, "double"))
+		return (type_float64);
+
 	if (!strcmp(buffer, "list"))
 		return (type_list);
 
 	return (type_none);
 }
 
-int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int estNormals)
+// Size in bytes of a binary value of the given type
+static inline int plyTypeSize(ply_type type)
 {
-	char buffer[256];
-	Point *vertex;
-	Vector *normal;
-	//  Point *texture;
-	Color *color;
-	Polygon *p;
-	int numPoly;
-	int numVertex;
-	int vertexProp = 0;
-	int faceProp = 0;
-	ply_property *vertexproplist = NULL;
-	ply_property *vertexproptail = NULL;
-	ply_property *faceproplist = NULL;
-	ply_property *faceproptail = NULL;
-	int nv;
-	int vid[MaxVertices];
-	int i, j;
-	Color tcolor;
-
-	// first line ought to be "ply"
-	// format ought to be "ascii 1.0"
-	// comment lines are ignored
-
-	// element creates an element structure and specifies how many
-	// vertex is meaningful
-	// float32 is %f
-	// uint8 is %c
-	// int32 is %d
-	// x, y, z, nx, ny, nz, s, t, red, green, blue all have meaning
-
-	// element face is meaningful
-	// property list means # of elements, followed by type
-	// vertex_indices means make polygons out of them
-
-	// end_header means the first element type starts
-
-	int doneWithHeader = 0;
-	FILE *fp = fopen(filename, "r");
-	if (fp)
+	switch (type)
+	{
+	case type_int8:
+	case type_uint8:
+		return (1);
+	case type_int16:
+	case type_uint16:
+		return (2);
+	case type_int32:
+	case type_uint32:
+	case type_float32:
+		return (4);
+	case type_float64:
+		return (8);
+	default:
+		return (0);
+	}
+}
+
+// Where a property with the given name is stored, for the vertex or face element
+static int plySlot(const char *name, int face)
+{
+	static const char *vertexNames[] = {"x", "y", "z", "nx", "ny", "nz", "red", "green", "blue"};
+
+	if (face)
+		return (!strcmp(name, "vertex_indices") || !strcmp(name, "vertex_index") ? slot_indices : slot_skip);
+
+	for (int i = 0; i < (int)(sizeof(vertexNames) / sizeof(vertexNames[0])); i++)
+	{
+		if (!strcmp(name, vertexNames[i]))
+			return (i);
+	}
+	return (slot_skip);
+}
+
+// Read the next whitespace-separated ASCII value
+static double plyAsciiValue(ply_cursor *c)
+{
+	static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	                               1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+	char token[PLY_MAX_TOKEN];
+	const unsigned char *start;
+	size_t n, i = 0;
+	int64_t m = 0;
+	int digits = 0, scale = 0, neg = 0;
+
+	while (c->cur < c->end && isspace(*c->cur))
+		c->cur++;
+	start = c->cur;
+	while (c->cur < c->end && !isspace(*c->cur))
+		c->cur++;
+	n = c->cur - start;
+	if (n == 0 || n >= PLY_MAX_TOKEN)
+	{
+		c->error = 1;
+		return (0.0);
+	}
+
+	// Plain decimals with at most 15 digits are exact integers scaled by an exact power of ten, so a single
+	// multiply or divide rounds them the same way strtod does; anything else goes to strtod
+	if (start[0] == '-' || start[0] == '+')
+	{
+		neg = start[0] == '-';
+		i = 1;
+	}
+	for (; i < n && isdigit(start[i]); i++, digits++)
+		m = m * 10 + (start[i] - '0');
+	if (i < n && start[i] == '.')
+	{
+		for (i++; i < n && isdigit(start[i]); i++, digits++, scale++)
+			m = m * 10 + (start[i] - '0');
+	}
+	if (i < n && (start[i] == 'e' || start[i] == 'E') && digits)
+	{
+		int eneg = 0, e = 0, edigits = 0;
+		i++;
+		if (i < n && (start[i] == '-' || start[i] == '+'))
+			eneg = start[i++] == '-';
+		for (; i < n && isdigit(start[i]) && edigits < 4; i++, edigits++)
+			e = e * 10 + (start[i] - '0');
+		scale -= eneg ? -e : e;
+		if (!edigits)
+			digits = 0; // malformed exponent
+	}
+	if (i == n && digits && digits <= 15 && scale >= -22 && scale <= 22)
+	{
+		double d = scale >= 0 ? (double)m / pow10[scale] : (double)m * pow10[-scale];
+		return (neg ? -d : d);
+	}
+
+	char *stop;
+	memcpy(token, start, n);
+	token[n] = '\0';
+	double d = strtod(token, &stop);
+	if (*stop != '\0')
+		c->error = 1;
+	return (d);
+}
+
+// Convert the binary value of the given type at src, reversing its bytes if swap is set
+static inline double plyBinaryValue(const unsigned char *src, ply_type type, int swap)
+{
+	switch (type)
+	{
+	case type_int8:
+		return ((int8_t)src[0]);
+	case type_uint8:
+		return (src[0]);
+	case type_int16:
+	case type_uint16:
+	{
+		uint16_t u;
+		memcpy(&u, src, sizeof(u));
+		if (swap)
+			u = __builtin_bswap16(u);
+		return (type == type_int16 ? (double)(int16_t)u : (double)u);
+	}
+	case type_int32:
+	case type_uint32:
+	case type_float32:
+	{
+		uint32_t u;
+		float f;
+		memcpy(&u, src, sizeof(u));
+		if (swap)
+			u = __builtin_bswap32(u);
+		if (type == type_int32)
+			return ((int32_t)u);
+		if (type == type_uint32)
+			return (u);
+		memcpy(&f, &u, sizeof(f));
+		return (f);
+	}
+	case type_float64:
+	{
+		uint64_t u;
+		double d;
+		memcpy(&u, src, sizeof(u));
+		if (swap)
+			u = __builtin_bswap64(u);
+		memcpy(&d, &u, sizeof(d));
+		return (d);
+	}
+	default:
+		return (0.0);
+	}
+}
+
+// Read the next value of the given type
+static inline double plyValue(ply_cursor *c, ply_type type)
+{
+	if (c->format == format_ascii)
+		return (plyAsciiValue(c));
+
+	int size = plyTypeSize(type);
+	if (size == 0 || c->end - c->cur < size)
 	{
-		// check if it's a .ply file
-		fscanf(fp, "%s", buffer);
-		if (strcmp(buffer, "ply"))
+		c->error = 1;
+		return (0.0);
+	}
+	c->cur += size;
+	return (plyBinaryValue(c->cur - size, type, c->swap));
+}
+
+// Copy the next header word into buffer; returns its length, or 0 at the end of the data
+static int plyWord(ply_cursor *c, char *buffer, int size)
+{
+	int n = 0;
+
+	while (c->cur < c->end && isspace(*c->cur))
+		c->cur++;
+	while (c->cur < c->end && !isspace(*c->cur))
+	{
+		if (n < size - 1)
+			buffer[n++] = *c->cur;
+		c->cur++;
+	}
+	buffer[n] = '\0';
+	return (n);
+}
+
+// Skip to the start of the next header line
+static void plySkipLine(ply_cursor *c)
+{
+	while (c->cur < c->end && *c->cur != '\n')
+		c->cur++;
+	if (c->cur < c->end)
+		c->cur++;
+}
+
+// Free the property lists of the header elements
+static void plyFreeElements(ply_element *element, int nElements)
+{
+	for (int i = 0; i < nElements; i++)
+	{
+		while (element[i].props != NULL)
 		{
-			printf("%s doesn't look like a .ply file\n", filename);
-			fclose(fp);
-			return (-1);
+			ply_property *q = (ply_property *)element[i].props->next;
+			free(element[i].props);
+			element[i].props = q;
 		}
+	}
+}
 
-		while (!doneWithHeader)
-		{
-			fscanf(fp, "%s", buffer);
-			switch (buffer[0])
-			{
-			case 'f':
-				// format statement
-				for (; fgetc(fp) != '\n';)
-					;
-				break;
-
-			case 'c':
-				// comment
-				for (; fgetc(fp) != '\n';)
-					;
-				break;
-
-			case 'p':
-				// property statement
-				{
-					ply_property *prop = malloc(sizeof(ply_property));
-					prop->listCardType = type_none;
-					prop->listDataType = type_none;
-					prop->next = NULL;
-
-					fscanf(fp, "%s", buffer); // get the data type
-					prop->type = plyType(buffer);
-					if (prop->type == type_list)
-					{
-						fscanf(fp, "%s", buffer); // get the first data type
-						prop->listCardType = plyType(buffer);
-						fscanf(fp, "%s", buffer); // get the first data type
-						prop->listDataType = plyType(buffer);
-					}
-					else if (prop->type == type_none)
-					{
-						printf("Unrecognized property type %s", buffer);
-						fclose(fp);
-						return (-1);
-					}
-					printf("Read property type %d\n", prop->type);
+// Parse the header; returns 0 on success and leaves the cursor at the first element
+static int plyHeader(ply_cursor *c, const char *filename, ply_element *element, int *nElements)
+{
+	char buffer[256];
+	ply_element *current = NULL;
+	int machineLittle;
+	uint16_t one = 1;
 
-					fscanf(fp, "%s", prop->name);
-					printf("Read property name %s\n", prop->name);
+	machineLittle = *(unsigned char *)&one == 1;
+	*nElements = 0;
 
-					// add the property entry to the list
-					if (vertexProp)
-					{
-						if (vertexproplist == NULL)
-						{
-							vertexproplist = prop;
-							vertexproptail = prop;
-						}
-						else
-						{
-							vertexproptail->next = prop;
-							vertexproptail = prop;
-						}
-					}
-					else if (faceProp)
-					{
-						if (faceproplist == NULL)
-						{
-							faceproplist = prop;
-							faceproptail = prop;
-						}
-						else
-						{
-							faceproptail->next = prop;
-							faceproptail = prop;
-						}
-					}
-				}
-				break;
+	// check if it's a .ply file
+	plyWord(c, buffer, sizeof(buffer));
+	if (strcmp(buffer, "ply"))
+	{
+		printf("%s doesn't look like a .ply file\n", filename);
+		return (-1);
+	}
+	plySkipLine(c);
 
-			case 'e':
-				if (!strcmp(buffer, "end_header"))
-				{
-					doneWithHeader = 1;
-					break;
-				}
+	while (plyWord(c, buffer, sizeof(buffer)))
+	{
+		if (!strcmp(buffer, "end_header"))
+		{
+			plySkipLine(c);
+			return (0);
+		}
+		else if (!strcmp(buffer, "format"))
+		{
+			plyWord(c, buffer, sizeof(buffer));
+			if (!strcmp(buffer, "ascii"))
+				c->format = format_ascii;
+			else if (!strcmp(buffer, "binary_little_endian"))
+				c->format = format_binary_little_endian;
+			else if (!strcmp(buffer, "binary_big_endian"))
+				c->format = format_binary_big_endian;
+			else
+			{
+				printf("Unrecognized PLY format %s\n", buffer);
+				return (-1);
+			}
+			c->swap = c->format != format_ascii && (c->format == format_binary_little_endian) != machineLittle;
+		}
+		else if (!strcmp(buffer, "element"))
+		{
+			if (*nElements == PLY_MAX_ELEMENTS)
+			{
+				printf("More than %d elements in %s\n", PLY_MAX_ELEMENTS, filename);
+				return (-1);
+			}
+			current = &element[(*nElements)++];
+			current->props = NULL;
+			current->tail = NULL;
+			plyWord(c, current->name, sizeof(current->name));
+			plyWord(c, buffer, sizeof(buffer));
+			current->count = atol(buffer);
+			if (current->count < 0)
+			{
+				printf("Bad element count %s\n", buffer);
+				return (-1);
+			}
+		}
+		else if (!strcmp(buffer, "property"))
+		{
+			if (!current)
+			{
+				printf("Property before any element in %s\n", filename);
+				return (-1);
+			}
 
-				// otherwise it's an element statement
-				fscanf(fp, "%s", buffer);
-				if (!strcmp(buffer, "vertex"))
-				{
-					printf("Read element vertex\n");
-					vertexProp = 1;
-					faceProp = 0;
-					fscanf(fp, "%d", &numVertex);
-				}
-				else if (!strcmp(buffer, "face"))
+			ply_property *prop = malloc(sizeof(ply_property));
+			if (!prop)
+			{
+				printf("Unable to allocate a PLY property\n");
+				return (-1);
+			}
+			prop->listCardType = type_none;
+			prop->listDataType = type_none;
+			prop->next = NULL;
+
+			// add the property entry to the element's list
+			if (current->props == NULL)
+				current->props = prop;
+			else
+				current->tail->next = prop;
+			current->tail = prop;
+
+			plyWord(c, buffer, sizeof(buffer)); // get the data type
+			prop->type = plyType(buffer);
+			if (prop->type == type_list)
+			{
+				plyWord(c, buffer, sizeof(buffer)); // get the count type
+				prop->listCardType = plyType(buffer);
+				plyWord(c, buffer, sizeof(buffer)); // get the item type
+				prop->listDataType = plyType(buffer);
+				if (prop->listCardType == type_none || prop->listCardType == type_list ||
+				    prop->listDataType == type_none || prop->listDataType == type_list)
 				{
-					printf("Read element face\n");
-					faceProp = 1;
-					vertexProp = 0;
-					fscanf(fp, "%d", &numPoly);
+					printf("Unrecognized list property type %s\n", buffer);
+					return (-1);
 				}
-				break;
-
-			default: // don't know what to do with it
-				for (; fgetc(fp) != '\n';)
-					;
-				break;
 			}
+			else if (prop->type == type_none)
+			{
+				printf("Unrecognized property type %s\n", buffer);
+				return (-1);
+			}
+
+			plyWord(c, prop->name, sizeof(prop->name));
+			prop->slot = plySlot(prop->name, !strcmp(current->name, "face"));
 		}
-		// finished with the header
-		vertex = malloc(sizeof(Point) * numVertex);
-		normal = malloc(sizeof(Vector) * numVertex);
-		// texture
-		color = malloc(sizeof(Color) * numVertex); // apparently not written by Blender
-
-		// read the vertices
-		for (i = 0; i < numVertex; i++)
+		else
 		{
-			for (j = 0; j < 3; j++)
-				fscanf(fp, "%lf", &(vertex[i].val[j]));
-			vertex[i].val[3] = 1.0;
+			// comment, obj_info, or a statement we don't know what to do with
+			plySkipLine(c);
+		}
+	}
+
+	printf("%s has no end_header\n", filename);
+	return (-1);
+}
+
+// Estimate the normal of a polygon from its first three vertices
+static void plyEstimateNormal(Polygon *p)
+{
+	Vector tx, ty, tn;
+
+	tx.val[0] = p->vertex[0].val[0] - p->vertex[1].val[0];
+	tx.val[1] = p->vertex[0].val[1] - p->vertex[1].val[1];
+	tx.val[2] = p->vertex[0].val[2] - p->vertex[1].val[2];
+
+	ty.val[0] = p->vertex[2].val[0] - p->vertex[1].val[0];
+	ty.val[1] = p->vertex[2].val[1] - p->vertex[1].val[1];
+	ty.val[2] = p->vertex[2].val[2] - p->vertex[1].val[2];
+
+	vector_cross(&tx, &ty, &tn);
+	vector_normalize(&tn);
+
+	for (int j = 0; j < p->nVertex; j++)
+		p->normal[j] = tn;
+}
 
-			for (j = 0; j < 3; j++)
-				fscanf(fp, "%lf", &(normal[i].val[j]));
-			normal[i].val[3] = 0.0;
+// Free the arrays of parsed PLY data
+static void plyFreeData(ply_data *d)
+{
+	free(d->vertex);
+	free(d->normal);
+	free(d->color);
+	free(d->faceStart);
+	free(d->faceIndex);
+	memset(d, 0, sizeof(ply_data));
+}
 
-			for (j = 0; j < 2; j++)
-				fscanf(fp, "%*f");
+// Read the memory-mapped file body into vertex and face arrays and validate the indices; returns 0 on success
+static int plyBody(ply_cursor *c, ply_element *element, int nElements, ply_data *d)
+{
+	Point *vertex = NULL;
+	Vector *normal = NULL;
+	Color *color = NULL;
+	int *faceStart = NULL; // offset of each face's indices, numPoly + 1 entries
+	int *faceIndex = NULL; // vertex indices of all faces
+	long numVertex = 0, numPoly = 0, nIndex = 0, capIndex = 0;
+	int hasNormals = 0, hasColors = 0;
+	long i;
+	int j;
+
+	memset(d, 0, sizeof(ply_data));
+
+	for (int e = 0; e < nElements && !c->error; e++)
+	{
+		ply_element *el = &element[e];
+		int isVertex = !strcmp(el->name, "vertex");
+		int isFace = !strcmp(el->name, "face");
 
-			for (j = 0; j < 3; j++)
+		if (isVertex)
+		{
+			numVertex = el->count;
+			vertex = malloc(sizeof(Point) * (numVertex ? numVertex : 1));
+			normal = malloc(sizeof(Vector) * (numVertex ? numVertex : 1));
+			color = malloc(sizeof(Color) * (numVertex ? numVertex : 1));
+			if (!vertex || !normal || !color)
+			{
+				printf("Unable to allocate %ld vertices\n", numVertex);
+				goto fail;
+			}
+			for (ply_property *prop = el->props; prop; prop = prop->next)
 			{
-				fscanf(fp, "%f", &(color[i].c[j]));
-				color[i].c[j] /= 255.0;
+				hasNormals |= prop->slot == slot_nx;
+				hasColors |= prop->slot >= slot_red && prop->slot <= slot_blue;
+			}
+		}
+		else if (isFace)
+		{
+			numPoly = el->count;
+			faceStart = malloc(sizeof(int) * (numPoly + 1));
+			capIndex = numPoly * 4 + 16;
+			faceIndex = malloc(sizeof(int) * capIndex);
+			if (!faceStart || !faceIndex)
+			{
+				printf("Unable to allocate %ld faces\n", numPoly);
+				goto fail;
 			}
 		}
 
-		p = malloc(sizeof(Polygon) * numPoly);
-		*clist = malloc(sizeof(Color) * numPoly);
-
-		// read the faces and build the polygons
-		for (i = 0; i < numPoly; i++)
+		for (i = 0; i < el->count && !c->error; i++)
 		{
-			polygon_init(&(p[i]));
+			// a vertex without colors is white, one without normals faces nowhere until they are estimated
+			Real v[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 255.0, 255.0, 255.0};
+			int colorScale[3] = {1, 1, 1};
 
-			// read in the vertex indices
-			nv = 0;
-			fscanf(fp, "%d", &nv);
+			if (isFace)
+				faceStart[i] = nIndex;
 
-			if (nv > MaxVertices)
+			for (ply_property *prop = el->props; prop; prop = prop->next)
 			{
-				printf("Number of vertices is greater than MaxVertices (%d), terminating\n", nv);
-				exit(-1);
-			}
+				if (prop->type != type_list)
+				{
+					double value = plyValue(c, prop->type);
+					if (isVertex && prop->slot != slot_skip)
+					{
+						v[prop->slot] = value;
+						if (prop->slot >= slot_red && (prop->type == type_float32 || prop->type == type_float64))
+							colorScale[prop->slot - slot_red] = 0; // float colors are already in [0, 1]
+					}
+					continue;
+				}
 
-			for (j = 0; j < nv; j++)
-			{
-				fscanf(fp, "%d", &(vid[j]));
+				long n = (long)plyValue(c, prop->listCardType);
+				if (n < 0)
+				{
+					c->error = 1;
+					break;
+				}
+				if (isFace && prop->slot == slot_indices)
+				{
+					if (nIndex + n > capIndex)
+					{
+						while (nIndex + n > capIndex)
+							capIndex *= 2;
+						int *grown = realloc(faceIndex, sizeof(int) * capIndex);
+						if (!grown)
+						{
+							printf("Unable to allocate face indices\n");
+							goto fail;
+						}
+						faceIndex = grown;
+					}
+					for (long k = 0; k < n; k++)
+						faceIndex[nIndex++] = (int)plyValue(c, prop->listDataType);
+				}
+				else
+				{
+					for (long k = 0; k < n; k++)
+						plyValue(c, prop->listDataType);
+				}
 			}
 
-			// assign the polygon vertices and surface normals
-			// not setting vertexWorld right now, because no Phong shading
-
-			p[i].nVertex = nv;
-			//			p[i].zBufferFlag = 1;
-			p[i].normal = malloc(sizeof(Vector) * nv);
-			p[i].vertex = malloc(sizeof(Point) * nv);
-			tcolor.c[0] = tcolor.c[1] = tcolor.c[2] = 0.0;
-			//      printf("%d: ", nv);
-			for (j = 0; j < nv; j++)
+			if (isVertex)
 			{
-				//	printf("%d  ", vid[j]);
-				p[i].vertex[j] = vertex[vid[j]];
-				if (!estNormals)
+				point_set3D(&vertex[i], v[slot_x], v[slot_y], v[slot_z]);
+				vector_set(&normal[i], v[slot_nx], v[slot_ny], v[slot_nz]);
+				for (j = 0; j < 3; j++)
 				{
-					p[i].normal[j] = normal[vid[j]];
+					color[i].c[j] = v[slot_red + j];
+					if (colorScale[j])
+						color[i].c[j] /= 255.0;
 				}
-				tcolor.c[0] += color[vid[j]].c[0];
-				tcolor.c[1] += color[vid[j]].c[1];
-				tcolor.c[2] += color[vid[j]].c[2];
 			}
-			tcolor.c[0] /= (float)nv;
-			tcolor.c[1] /= (float)nv;
-			tcolor.c[2] /= (float)nv;
+		}
+	}
+
+	if (c->error)
+	{
+		printf("PLY data ended early or could not be parsed\n");
+		goto fail;
+	}
+	if (!faceStart)
+	{
+		printf("PLY file has no faces\n");
+		goto fail;
+	}
+	faceStart[numPoly] = nIndex;
 
-			if (estNormals)
+	for (i = 0; i < numPoly; i++)
+	{
+		for (j = faceStart[i]; j < faceStart[i + 1]; j++)
+		{
+			if (faceIndex[j] < 0 || faceIndex[j] >= numVertex)
 			{
-				Vector tx, ty, tn;
+				printf("Face %ld refers to vertex %d of %ld\n", i, faceIndex[j], numVertex);
+				goto fail;
+			}
+		}
+	}
 
-				tx.val[0] = p[i].vertex[0].val[0] - p[i].vertex[1].val[0];
-				tx.val[1] = p[i].vertex[0].val[1] - p[i].vertex[1].val[1];
-				tx.val[2] = p[i].vertex[0].val[2] - p[i].vertex[1].val[2];
+	d->vertex = vertex;
+	d->normal = normal;
+	d->color = color;
+	d->faceStart = faceStart;
+	d->faceIndex = faceIndex;
+	d->numVertex = numVertex;
+	d->numPoly = numPoly;
+	d->hasNormals = hasNormals;
+	d->hasColors = hasColors;
+	return (0);
 
-				ty.val[0] = p[i].vertex[2].val[0] - p[i].vertex[1].val[0];
-				ty.val[1] = p[i].vertex[2].val[1] - p[i].vertex[1].val[1];
-				ty.val[2] = p[i].vertex[2].val[2] - p[i].vertex[1].val[2];
+fail:
+	free(vertex);
+	free(normal);
+	free(color);
+	free(faceStart);
+	free(faceIndex);
+	return (-1);
+}
 
-				vector_cross(&tx, &ty, &tn);
-				vector_normalize(&tn);
+// Build one polygon per face, copying the shared vertices into each; returns 0 on success
+static int plyPolygons(ply_data *d, int *nPolygons, Polygon **plist, Color **clist, int estNormals)
+{
+	long numPoly = d->numPoly;
+	Polygon *p;
+	long i;
+	int j;
 
-				for (j = 0; j < nv; j++)
-					p[i].normal[j] = tn;
-			}
+	p = malloc(sizeof(Polygon) * (numPoly ? numPoly : 1));
+	*clist = malloc(sizeof(Color) * (numPoly ? numPoly : 1));
+	if (!p || !*clist)
+	{
+		printf("Unable to allocate %ld polygons\n", numPoly);
+		free(p);
+		free(*clist);
+		*clist = NULL;
+		return (-1);
+	}
 
-			printf("(%.2f %.2f %.2f)\n", tcolor.c[0], tcolor.c[1], tcolor.c[2]);
+	for (i = 0; i < numPoly; i++)
+	{
+		int nv = d->faceStart[i + 1] - d->faceStart[i];
+		int *vid = &d->faceIndex[d->faceStart[i]];
+		Color tcolor;
+
+		polygon_init(&(p[i]));
+		p[i].nVertex = nv;
+		p[i].normal = malloc(sizeof(Vector) * (nv ? nv : 1));
+		p[i].vertex = malloc(sizeof(Point) * (nv ? nv : 1));
+		if (!p[i].normal || !p[i].vertex)
+		{
+			printf("Unable to allocate polygon %ld\n", i);
+			for (; i >= 0; i--)
+				polygon_clear(&(p[i]));
+			free(p);
+			free(*clist);
+			*clist = NULL;
+			return (-1);
+		}
 
-			(*clist)[i] = tcolor;
+		tcolor.c[0] = tcolor.c[1] = tcolor.c[2] = 0.0;
+		for (j = 0; j < nv; j++)
+		{
+			p[i].vertex[j] = d->vertex[vid[j]];
+			p[i].normal[j] = d->normal[vid[j]];
+			tcolor.c[0] += d->color[vid[j]].c[0];
+			tcolor.c[1] += d->color[vid[j]].c[1];
+			tcolor.c[2] += d->color[vid[j]].c[2];
+		}
+		if (nv)
+		{
+			tcolor.c[0] /= (float)nv;
+			tcolor.c[1] /= (float)nv;
+			tcolor.c[2] /= (float)nv;
 		}
 
-		*nPolygons = numPoly;
-		*plist = p;
+		if ((estNormals || !d->hasNormals) && nv >= 3)
+			plyEstimateNormal(&(p[i]));
 
-		free(vertex);
-		free(normal);
-		//    free(texture);
-		free(color);
+		(*clist)[i] = tcolor;
+	}
 
-		{
-			ply_property *q;
+	*nPolygons = numPoly;
+	*plist = p;
+	return (0);
+}
 
-			while (vertexproplist != NULL)
-			{
-				q = (ply_property *)vertexproplist->next;
-				free(vertexproplist);
-				vertexproplist = q;
-			}
+// Build an indexed mesh that keeps the shared vertices, splitting faces into triangle fans; returns 0 on success
+static int plyMesh(ply_data *d, Mesh *mesh, int estNormals)
+{
+	long nTriangle = 0, t = 0;
+	long i;
+	int j;
 
-			while (faceproplist != NULL)
-			{
-				q = (ply_property *)faceproplist->next;
-				free(faceproplist);
-				faceproplist = q;
-			}
-		}
+	for (i = 0; i < d->numPoly; i++)
+	{
+		int nv = d->faceStart[i + 1] - d->faceStart[i];
+		if (nv >= 3)
+			nTriangle += nv - 2;
+	}
 
-		fclose(fp);
+	int *index = malloc(sizeof(int) * 3 * (nTriangle ? nTriangle : 1));
+	if (!index)
+	{
+		printf("Unable to allocate %ld triangles\n", nTriangle);
+		return (-1);
 	}
+	for (i = 0; i < d->numPoly; i++)
+	{
+		int *vid = &d->faceIndex[d->faceStart[i]];
+		int nv = d->faceStart[i + 1] - d->faceStart[i];
+		for (j = 1; j + 1 < nv; j++, t++)
+		{
+			index[3 * t] = vid[0];
+			index[3 * t + 1] = vid[j];
+			index[3 * t + 2] = vid[j + 1];
+		}
+	}
+
+	// the mesh takes over the parsed vertex arrays instead of copying them
+	mesh_clear(mesh);
+	mesh->nVertex = d->numVertex;
+	mesh->vertex = d->vertex;
+	mesh->normal = d->normal;
+	mesh->nTriangle = nTriangle;
+	mesh->index = index;
+	if (d->hasColors)
+		mesh->color = d->color;
 	else
+		free(d->color);
+	d->vertex = NULL;
+	d->normal = NULL;
+	d->color = NULL;
+
+	// estimated normals are averaged over the faces sharing each vertex
+	if (estNormals || !d->hasNormals)
+		return (mesh_computeNormals(mesh));
+	return (0);
+}
+
+// Map a PLY file and parse it into vertex and face arrays; returns 0 on success
+static int plyLoad(char filename[], ply_data *d)
+{
+	ply_element element[PLY_MAX_ELEMENTS];
+	int nElements = 0;
+	struct stat st;
+	ply_cursor c;
+	void *data;
+	int status;
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
 	{
 		printf("Unable to open %s\n", filename);
 		return (-1);
 	}
+	if (fstat(fd, &st) || st.st_size == 0)
+	{
+		printf("%s doesn't look like a .ply file\n", filename);
+		close(fd);
+		return (-1);
+	}
 
-	return (0);
+	// map the whole file and parse it in place
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		printf("Unable to map %s\n", filename);
+		return (-1);
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	c.cur = (const unsigned char *)data;
+	c.end = c.cur + st.st_size;
+	c.format = format_ascii;
+	c.swap = 0;
+	c.error = 0;
+
+	status = plyHeader(&c, filename, element, &nElements);
+	if (status == 0)
+		status = plyBody(&c, element, nElements, d);
+
+	plyFreeElements(element, nElements);
+	munmap(data, st.st_size);
+
+	return (status);
+}
+
+int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int estNormals)
+{
+	ply_data d;
+	int status;
+
+	if (plyLoad(filename, &d))
+		return (-1);
+	status = plyPolygons(&d, nPolygons, plist, clist, estNormals);
+	plyFreeData(&d);
+
+	return (status);
+}
+
+int readPLYMesh(char filename[], Mesh *mesh, int estNormals)
+{
+	ply_data d;
+	int status;
+
+	if (!mesh)
+		return (-1);
+	if (plyLoad(filename, &d))
+		return (-1);
+	status = plyMesh(&d, mesh, estNormals);
+	plyFreeData(&d);
+
+	return (status);
 }
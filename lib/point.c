@@ -4,7 +4,7 @@
 #include "point.h"
 
 // Set the first two values of the vector to x & y, the third value to 0.0, and the fourth value to 1.0.
-void point_set2D(Point *p, double x, double y)
+void point_set2D(Point *p, Real x, Real y)
 {
   p->val[0] = x;
   p->val[1] = y;
@@ -13,7 +13,7 @@ void point_set2D(Point *p, double x, double y)
 }
 
 // Set the point’s values to x & y & z, and the homogeneous coordinate to 1.0.
-void point_set3D(Point *p, double x, double y, double z)
+void point_set3D(Point *p, Real x, Real y, Real z)
 {
   p->val[0] = x;
   p->val[1] = y;
@@ -22,7 +22,7 @@ void point_set3D(Point *p, double x, double y, double z)
 }
 
 // Set the four values of the vector to x, y, z, and h, respectively.
-void point_set(Point *p, double x, double y, double z, double h)
+void point_set(Point *p, Real x, Real y, Real z, Real h)
 {
   p->val[0] = x;
   p->val[1] = y;
@@ -2,10 +2,10 @@
 // Written by Nicholas Ung 2024-06-04
 
 #include "polygon.h"
-#include "list.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 
 // Returns an allocated Polygon pointer initialized so that numVertex is 0 and vertex is NULL.
 Polygon *polygon_create(void)
@@ -40,6 +40,8 @@ void polygon_free(Polygon *p)
       free(p->color);
     if (p->normal)
       free(p->normal);
+    if (p->vertexWorld)
+      free(p->vertexWorld);
     free(p);
   }
 }
@@ -51,6 +53,7 @@ void polygon_init(Polygon *p)
   p->vertex = NULL; // Set the vertex list to NULL
   p->color = NULL;  // Set the color list to NULL
   p->normal = NULL; // Set the normal list to NULL
+  p->vertexWorld = NULL; // No world-space positions until a Phong draw adds them
   p->zBuffer = 0;   // Set the z-buffer flag to 0
   p->oneSided = 0;  // Set the one-sided flag to 0
 }
@@ -89,6 +92,11 @@ void polygon_clear(Polygon *p)
       free(p->normal);
       p->normal = NULL;
     }
+    if (p->vertexWorld)
+    {
+      free(p->vertexWorld);
+      p->vertexWorld = NULL;
+    }
     p->nVertex = 0;
     p->zBuffer = 0;
     p->oneSided = 1;
@@ -167,11 +175,49 @@ void polygon_copy(Polygon *to, Polygon *from)
     {
       polygon_setNormals(to, from->nVertex, from->normal);
     }
+    // World positions of the destination's old vertices would not match the copied ones
+    free(to->vertexWorld);
+    to->vertexWorld = NULL;
+    if (from->vertexWorld)
+    {
+      to->vertexWorld = (Point *)malloc(from->nVertex * sizeof(Point));
+      if (to->vertexWorld)
+      {
+        memcpy(to->vertexWorld, from->vertexWorld, from->nVertex * sizeof(Point));
+      }
+    }
     polygon_zBuffer(to, from->zBuffer);
     polygon_setSided(to, from->oneSided);
   }
 }
 
+// Copies a polygon into arrays taken from the arena, adding a color array when withColor is set
+// so shading does not have to allocate one. The copy must not be cleared; it lives until the
+// arena is released. Returns 0 on success
+int polygon_copyArena(Polygon *to, Polygon *from, Arena *arena, int withColor)
+{
+  int n = from->nVertex;
+
+  to->oneSided = from->oneSided;
+  to->zBuffer = from->zBuffer;
+  to->nVertex = n;
+  to->vertex = (Point *)arena_alloc(arena, n * sizeof(Point));
+  to->color = from->color || withColor ? (Color *)arena_alloc(arena, n * sizeof(Color)) : NULL;
+  to->normal = from->normal ? (Vector *)arena_alloc(arena, n * sizeof(Vector)) : NULL;
+  to->vertexWorld = NULL;
+  if (!to->vertex || (!to->color && (from->color || withColor)) || (!to->normal && from->normal))
+  {
+    return -1;
+  }
+
+  memcpy(to->vertex, from->vertex, n * sizeof(Point));
+  if (from->color)
+    memcpy(to->color, from->color, n * sizeof(Color));
+  if (from->normal)
+    memcpy(to->normal, from->normal, n * sizeof(Vector));
+  return 0;
+}
+
 // Prints polygon data to the stream designated by the FILE pointer.
 void polygon_print(Polygon *p, FILE *fp)
 {
@@ -235,6 +281,12 @@ void polygon_draw(Polygon *p, Image *src, Color color)
 Scanline Fill Algorithm
 ********************/
 
+// Number of attributes a Phong or deferred edge interpolates: world-space x, y, z and normal x, y, z
+#define PHONG_ATTRIBS 6
+
+// Number of visible fragments shaded together on a Phong span
+#define PHONG_BATCH 64
+
 // Structure for storing edge information
 typedef struct tEdge
 {
@@ -245,51 +297,81 @@ typedef struct tEdge
   float xIntersect, dxPerScan; // X intersection and its change per scanline
   float zIntersect, dzPerScan; // Z intersection and its change per scanline
   Color cIntersect, dcPerScan; // Color intersection and its change per scanline
-  struct tEdge *next;          // Pointer to the next edge
+  float aIntersect[PHONG_ATTRIBS]; // Phong attributes over depth at the intersection
+  float daPerScan[PHONG_ATTRIBS];  // change of the Phong attributes per scanline
 } Edge;
 
-// Compare edges by yStart for sorting
-static int compYStart(const void *a, const void *b)
+// Flat edge table reused between polygons so that scan conversion does no per-edge or per-scanline heap traffic
+typedef struct
 {
-  Edge *ea = (Edge *)a;
-  Edge *eb = (Edge *)b;
-  return (ea->yStart - eb->yStart);
-}
-
-// Compare edges by xIntersect for sorting
-static int compXIntersect(const void *a, const void *b)
+  Edge *edge;     // edge records, sorted by yStart
+  Edge **active;  // active edge table, kept sorted by xIntersect
+  int nEdges;     // number of edges in the table
+  int nActive;    // number of edges in the active edge table
+  int capacity;   // allocated length of edge and active
+  int constant;   // draw with the DrawState color instead of the interpolated colors
+  int depthTest;  // use the z-buffer
+  int phong;      // light every visible pixel from the interpolated world position and normal
+  int deferred;   // store the interpolated world position and normal in the G-buffer for lighting later
+  int attribs;    // whether the edges interpolate world positions and normals, for Phong or deferred shading
+  int oneSided;   // whether the polygon being drawn is lit from the front only
+} EdgeTable;
+
+// One edge table per thread, so tiles can be rasterized concurrently
+static _Thread_local EdgeTable edgeTable = {NULL, NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Make sure the edge table can hold n edges, growing it if necessary
+static int edgeTable_reserve(EdgeTable *et, int n)
 {
-  Edge *ea = (Edge *)a;
-  Edge *eb = (Edge *)b;
-  if (ea->xIntersect < eb->xIntersect)
-    return -1;
-  else if (ea->xIntersect > eb->xIntersect)
+  if (n <= et->capacity)
+  {
+    return 0;
+  }
+
+  int capacity = et->capacity ? et->capacity : 16;
+  while (capacity < n)
+  {
+    capacity *= 2;
+  }
+
+  Edge *edge = (Edge *)realloc(et->edge, capacity * sizeof(Edge));
+  if (!edge)
+  {
+    return 1;
+  }
+  et->edge = edge;
+
+  Edge **active = (Edge **)realloc(et->active, capacity * sizeof(Edge *));
+  if (!active)
+  {
     return 1;
+  }
+  et->active = active;
+  et->capacity = capacity;
+
   return 0;
 }
 
-// Create an edge structure from start to end points, considering depth and clipping
-static Edge *makeEdgeRec(Point start, Point end, Color c0, Color c1, Image *src, DrawState *ds)
+// Fill in an edge record from start to end points, considering depth and clipping; returns 0 if the edge is skipped
+// a0 and a1 hold the Phong attributes of the end points, or are NULL when the edge has none
+static int makeEdgeRec(Edge *edge, Point start, Point end, Color c0, Color c1, const float *a0, const float *a1, Image *src)
 {
-  Edge *edge;
   float dscan = end.val[1] - start.val[1];
 
-  // BAM you can check for lines that end < 0 and lines that start >= src->rows and return NULL
-  // If both vertices are outside the vertical bounds, skip this edge
-  if (start.val[1] == end.val[1] || start.val[1] < 0 || end.val[1] < 0 || start.val[1] >= src->rows || end.val[1] >= src->rows)
+  // Skip horizontal edges and edges entirely above or below the image
+  if (start.val[1] == end.val[1] || end.val[1] < 0 || start.val[1] >= src->rows)
   {
-    return NULL;
+    return 0;
   }
 
-  edge = (Edge *)malloc(sizeof(Edge));
   edge->x0 = start.val[0];
   edge->y0 = start.val[1];
   edge->x1 = end.val[0];
   edge->y1 = end.val[1];
   edge->z0 = 1.0 / start.val[2];
   edge->z1 = 1.0 / end.val[2];
-  edge->yStart = (int)(start.val[1] + 0.5);
-  edge->yEnd = (int)(end.val[1] + 0.5) - 1;
+  edge->yStart = (int)floor(start.val[1] + 0.5);
+  edge->yEnd = (int)floor(end.val[1] + 0.5) - 1;
 
   if (edge->yEnd >= src->rows)
   {
@@ -309,15 +391,34 @@ static Edge *makeEdgeRec(Point start, Point end, Color c0, Color c1, Image *src,
     edge->cIntersect.c[i] = c0.c[i] / start.val[2] + edge->dcPerScan.c[i] * ((float)(edge->yStart) + 0.5 - edge->y0);
   }
 
-  if (edge->y0 < 0)
-  { // BAM this would never execute given the initial clipping, but should work once they're gone
-    edge->xIntersect += edge->dxPerScan * ((float)(-edge->y0));
-    edge->zIntersect += edge->dzPerScan * ((float)(-edge->y0));
+  // Phong attributes are interpolated over depth like the colors
+  for (int i = 0; a0 && i < PHONG_ATTRIBS; i++)
+  {
+    edge->daPerScan[i] = (a1[i] / end.val[2] - a0[i] / start.val[2]) / dscan;
+    edge->aIntersect[i] = a0[i] / start.val[2] + edge->daPerScan[i] * ((float)(edge->yStart) + 0.5 - edge->y0);
+  }
+
+  // Edges starting above the image are advanced to the first row
+  if (edge->yStart < 0)
+  {
+    float skip = (float)(-edge->yStart);
+    edge->xIntersect += edge->dxPerScan * skip;
+    edge->zIntersect += edge->dzPerScan * skip;
     for (int i = 0; i < 3; i++)
     {
-      edge->cIntersect.c[i] += edge->dcPerScan.c[i] * ((float)(-edge->y0));
+      edge->cIntersect.c[i] += edge->dcPerScan.c[i] * skip;
+    }
+    for (int i = 0; a0 && i < PHONG_ATTRIBS; i++)
+    {
+      edge->aIntersect[i] += edge->daPerScan[i] * skip;
     }
-    edge->y0 = 0;
+    edge->yStart = 0;
+  }
+
+  // Edges that do not cross a scanline center are skipped
+  if (edge->yEnd < edge->yStart)
+  {
+    return 0;
   }
 
   // Checking for very bad edges is more subtle
@@ -330,85 +431,155 @@ static Edge *makeEdgeRec(Point start, Point end, Color c0, Color c1, Image *src,
     {
       edge->cIntersect.c[i] = c1.c[i] / edge->z1;
     }
+    for (int i = 0; a0 && i < PHONG_ATTRIBS; i++)
+    {
+      edge->aIntersect[i] = a1[i] / end.val[2];
+    }
   }
 
-  return edge;
+  return 1;
+}
+
+// Gather the world-space position and normal of vertex i for Phong interpolation
+static void polygon_phongAttribs(Polygon *p, int i, float *a)
+{
+  for (int k = 0; k < 3; k++)
+  {
+    a[k] = p->vertexWorld[i].val[k];
+    a[k + 3] = p->normal[i].val[k];
+  }
 }
 
-// Create a sorted edge list from the polygon vertices
-static LinkedList *setupEdgeList(Polygon *p, Image *src, DrawState *ds)
+// Build the edge table from the polygon vertices, sorted by yStart; returns the number of edges
+static int setupEdgeList(EdgeTable *et, Polygon *p, Image *src, DrawState *ds, Lighting *lighting)
 {
-  LinkedList *edges = ll_new(); // Create new linked list for edges
   Point v1, v2;
   Color c1, c2;
-  int i;
+  float a1[PHONG_ATTRIBS], a2[PHONG_ATTRIBS];
+  int i, j;
+
+  et->nEdges = 0;
+  et->nActive = 0;
+  if (p->nVertex < 2 || edgeTable_reserve(et, p->nVertex))
+  {
+    return 0;
+  }
+
+  // Polygons without per-vertex colors are drawn with the DrawState color
+  et->constant = !p->color || ds->shade == ShadeConstant;
+  et->oneSided = p->oneSided;
+  color_set(&c1, 0.0, 0.0, 0.0);
+  color_set(&c2, 0.0, 0.0, 0.0);
+
+  // 2D polygons have no depth, so they are drawn without the z-buffer
+  et->depthTest = 1;
+  for (i = 0; i < p->nVertex; i++)
+  {
+    if (p->vertex[i].val[2] <= 0.0)
+    {
+      et->depthTest = 0;
+      break;
+    }
+  }
+
+  // Deferred samples are matched against the z-buffer when they are lit, so they need depth
+  et->phong = ds->shade == ShadePhong && lighting && p->vertexWorld && p->normal;
+  et->deferred = ds->shade == ShadeDeferred && src->gbuf && et->depthTest && p->vertexWorld && p->normal;
 
+  et->attribs = et->phong || et->deferred;
   v1 = p->vertex[p->nVertex - 1]; // Start with the last vertex
-  if (p->color)
+  if (!et->constant)
     c1 = p->color[p->nVertex - 1]; // Start with the last color
+  if (et->attribs)
+    polygon_phongAttribs(p, p->nVertex - 1, a1);
 
   for (i = 0; i < p->nVertex; i++)
   {
     v2 = p->vertex[i]; // Get current vertex
-    c2 = p->color[i];  // Get current color
-
-    // Clip vertices to image vertical bounds
-    if (v1.val[1] < 0)
-      v1.val[1] = 0;
-    if (v2.val[1] < 0)
-      v2.val[1] = 0;
-    if (v1.val[1] >= src->rows)
-      v1.val[1] = src->rows - 1;
-    if (v2.val[1] >= src->rows)
-      v2.val[1] = src->rows - 1;
+    if (!et->constant)
+      c2 = p->color[i]; // Get current color
+    if (et->attribs)
+      polygon_phongAttribs(p, i, a2);
 
     // Create edge if not horizontal
-    if ((int)(v1.val[1]) != (int)(v2.val[1]))
+    if (v1.val[1] != v2.val[1])
     {
-      Edge *edge;
+      Edge *edge = &et->edge[et->nEdges];
+      int made;
       if (v1.val[1] < v2.val[1])
-        edge = makeEdgeRec(v1, v2, c1, c2, src, ds);
+        made = makeEdgeRec(edge, v1, v2, c1, c2, et->attribs ? a1 : NULL, et->attribs ? a2 : NULL, src);
       else
-        edge = makeEdgeRec(v2, v1, c2, c1, src, ds);
-      if (edge)
-        ll_insert(edges, edge, compYStart);
+        made = makeEdgeRec(edge, v2, v1, c2, c1, et->attribs ? a2 : NULL, et->attribs ? a1 : NULL, src);
+
+      if (made)
+      {
+        // Insertion sort by yStart; polygons only have a handful of edges
+        Edge tmp = *edge;
+        for (j = et->nEdges; j > 0 && et->edge[j - 1].yStart > tmp.yStart; j--)
+        {
+          et->edge[j] = et->edge[j - 1];
+        }
+        et->edge[j] = tmp;
+        et->nEdges++;
+      }
     }
 
     v1 = v2; // Move to the next vertex
     c1 = c2; // Move to the next color
+    memcpy(a1, a2, sizeof(a1));
   }
 
-  // Delete empty edge list
-  if (ll_empty(edges))
+  return et->nEdges;
+}
+
+// Structure to represent visible Phong fragments waiting to be lit together
+typedef struct
+{
+  int n;                     // number of queued fragments
+  int col[PHONG_BATCH];      // image column of each fragment
+  Point world[PHONG_BATCH];  // world-space position
+  Vector normal[PHONG_BATCH]; // world-space normal
+  Color color[PHONG_BATCH];  // lit color
+} PhongBatch;
+
+// Light the queued fragments of a scanline and write them to the image
+static void phongBatch_flush(PhongBatch *b, FPixel *pixel, EdgeTable *et, DrawState *ds, Lighting *lighting)
+{
+  if (!b->n)
   {
-    ll_delete(edges, NULL);
-    edges = NULL;
+    return;
   }
 
-  return edges; // Return the edge list
+  lighting_shadeVertices(lighting, b->n, b->world, b->normal, &ds->viewer, &ds->body, &ds->surface, ds->surfaceCoeff, et->oneSided, b->color);
+  for (int j = 0; j < b->n; j++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      pixel[b->col[j]].rgb[k] = b->color[j].c[k];
+    }
+  }
+  b->n = 0;
 }
 
-// Draw one scanline of a polygon
-static void fillScan(int scan, LinkedList *active, Image *src, DrawState *ds, Lighting *lighting)
+// Draw one scanline of a polygon, limited to columns [colStart, colEnd)
+static void fillScan(int scan, EdgeTable *et, Image *src, DrawState *ds, Lighting *lighting, int colStart, int colEnd)
 {
   Edge *p1, *p2;
-  int i, f;
+  int i, f, e;
 
-  p1 = ll_head(active);
-
-  while (p1)
+  for (e = 0; e < et->nActive; e += 2)
   {
-    p2 = ll_next(active);
+    p1 = et->active[e];
 
-    if (!p2)
+    if (e + 1 >= et->nActive)
     {
       printf("Edges not in pairs\n");
       break;
     }
+    p2 = et->active[e + 1];
 
     if (p2->xIntersect == p1->xIntersect)
     {
-      p1 = ll_next(active);
       continue;
     }
 
@@ -431,6 +602,14 @@ static void fillScan(int scan, LinkedList *active, Image *src, DrawState *ds, Li
       dColorPerColumn.c[k] = (p2->cIntersect.c[k] - p1->cIntersect.c[k]) / (p2->xIntersect - p1->xIntersect);
     }
 
+    // Phong attributes per column
+    float curA[PHONG_ATTRIBS], dAPerColumn[PHONG_ATTRIBS];
+    for (int k = 0; et->attribs && k < PHONG_ATTRIBS; k++)
+    {
+      curA[k] = p1->aIntersect[k];
+      dAPerColumn[k] = (p2->aIntersect[k] - p1->aIntersect[k]) / (p2->xIntersect - p1->xIntersect);
+    }
+
     if ((int)(p1->xIntersect - 0.5) < 0)
     {
       curZ += dzPerColumn * (-p1->xIntersect);
@@ -438,108 +617,222 @@ static void fillScan(int scan, LinkedList *active, Image *src, DrawState *ds, Li
       {
         curColor.c[k] += dColorPerColumn.c[k] * (-p1->xIntersect);
       }
+      for (int k = 0; et->attribs && k < PHONG_ATTRIBS; k++)
+      {
+        curA[k] += dAPerColumn[k] * (-p1->xIntersect);
+      }
     }
 
+    // Interpolants are computed from the span start rather than accumulated, so a span split across tiles matches the whole span exactly
+    int first = i;
+    float startZ = curZ;
+    Color startColor = curColor;
+
+    // Restrict the span to the requested columns
+    if (i < colStart)
+      i = colStart;
+    if (f >= colEnd)
+      f = colEnd - 1;
+
+    float avgZ = (p1->zIntersect + p2->zIntersect) / 2;
+
+    // The last column of a span narrower than a pixel lies past its end, so the tested depth is held between the span's ends
+    float zLo = p1->zIntersect < p2->zIntersect ? p1->zIntersect : p2->zIntersect;
+    float zHi = p1->zIntersect < p2->zIntersect ? p2->zIntersect : p1->zIntersect;
+    FPixel *pixel = image_span(src, scan, 0);
+    float *depth = image_zspan(src, scan, 0);
+    GSample *gbuf = et->deferred ? image_gspan(src, scan, 0) : NULL;
+    float *zseg = et->depthTest && src->zSeg ? image_zsegments(src, scan) : NULL;
+    int spanStart = i;
+    int written0 = f + 1, written1 = i - 1; // columns whose depth changed
+    if (i <= f)
+    {
+      image_markSpan(src, scan, i, f);
+    }
+    PhongBatch phong;
+    phong.n = 0;
     for (; i <= f; i++)
     {
-      float avgZ = (p1->zIntersect + p2->zIntersect) / 2;
-      if (curZ > image_getz(src, scan, i) && curZ - 0.0001 * avgZ > image_getz(src, scan, i) && curZ < 1000)
+      float t = (float)(i - first);
+      curZ = startZ + dzPerColumn * t;
+      float fragZ = curZ < zLo ? zLo : curZ > zHi ? zHi : curZ;
+
+      // Skip the rest of a segment when the span is nowhere nearer than the segment's farthest pixel
+      if (zseg && (i == spanStart || !(i & (IMAGE_HIZ_SIZE - 1))))
       {
-        image_setz(src, scan, i, curZ);
+        int end = (i | (IMAGE_HIZ_SIZE - 1)) < f ? (i | (IMAGE_HIZ_SIZE - 1)) : f;
+        float endZ = startZ + dzPerColumn * (float)(end - first);
+        endZ = endZ < zLo ? zLo : endZ > zHi ? zHi : endZ;
+        if (fragZ <= zseg[i >> IMAGE_HIZ_SHIFT] && endZ <= zseg[i >> IMAGE_HIZ_SHIFT])
+        {
+          i = end;
+          continue;
+        }
+      }
 
-        // Compute the actual color by multiplying by the depth value
-        Color finalColor;
-        for (int k = 0; k < 3; k++)
+      if (et->depthTest)
+      {
+        float z = depth[i];
+        if (!(fragZ > z && fragZ - 0.0001 * avgZ > z && fragZ < 1000))
         {
-          finalColor.c[k] = curColor.c[k] / curZ;
+          continue;
         }
+        depth[i] = fragZ;
+        if (i < written0)
+          written0 = i;
+        written1 = i;
+      }
 
-        // Clamp color values to avoid artifacts
+      // Only fragments that pass the depth test are lit
+      if (et->deferred)
+      {
+        GSample *g = &gbuf[i];
+        g->z = fragZ;
         for (int k = 0; k < 3; k++)
         {
-          finalColor.c[k] = fmin(fmax(finalColor.c[k], 0.0), 1.0);
+          g->world[k] = (curA[k] + dAPerColumn[k] * t) / curZ;
+          g->normal[k] = (curA[k + 3] + dAPerColumn[k + 3] * t) / curZ;
+          g->body[k] = ds->body.c[k];
+          g->surface[k] = ds->surface.c[k];
         }
-
-        image_setColor(src, scan, i, finalColor);
+        g->coeff = ds->surfaceCoeff;
+        g->oneSided = et->oneSided;
       }
-      curZ += dzPerColumn;
-      for (int k = 0; k < 3; k++)
+      else if (et->phong)
+      {
+        for (int k = 0; k < 3; k++)
+        {
+          phong.world[phong.n].val[k] = (curA[k] + dAPerColumn[k] * t) / curZ;
+          phong.normal[phong.n].val[k] = (curA[k + 3] + dAPerColumn[k + 3] * t) / curZ;
+        }
+        phong.world[phong.n].val[3] = 1.0;
+        phong.normal[phong.n].val[3] = 0.0;
+        phong.col[phong.n++] = i;
+        if (phong.n == PHONG_BATCH)
+        {
+          phongBatch_flush(&phong, pixel, et, ds, lighting);
+        }
+      }
+      else if (et->constant)
       {
-        curColor.c[k] += dColorPerColumn.c[k];
+        for (int k = 0; k < 3; k++)
+        {
+          pixel[i].rgb[k] = ds->color.c[k];
+        }
       }
+      else
+      {
+        // Compute the actual color by multiplying by the depth value, clamped to avoid artifacts
+        for (int k = 0; k < 3; k++)
+        {
+          curColor.c[k] = startColor.c[k] + dColorPerColumn.c[k] * t;
+          pixel[i].rgb[k] = fmin(fmax(curColor.c[k] / curZ, 0.0), 1.0);
+        }
+      }
+    }
+    phongBatch_flush(&phong, pixel, et, ds, lighting);
+    if (zseg && written0 <= written1)
+    {
+      image_updateDepth(src, scan, written0, written1);
     }
-    p1 = ll_next(active);
   }
 }
 
-// Update the active edge list for the next scanline
-static void updateActiveList(LinkedList *active, int scan)
+// Update the active edge table in place for the next scanline
+static void updateActiveList(EdgeTable *et, int scan)
 {
-  LinkedList *tmplist = ll_new();
   Edge *tedge;
+  int i, j, n = 0;
 
-  for (tedge = ll_pop(active); tedge != NULL; tedge = ll_pop(active))
+  // Drop finished edges and advance the rest
+  for (i = 0; i < et->nActive; i++)
   {
+    tedge = et->active[i];
     if (tedge->yEnd > scan)
     {
       tedge->xIntersect += tedge->dxPerScan;
       tedge->zIntersect += tedge->dzPerScan;
-      // **New**: Update color interpolation
       for (int k = 0; k < 3; k++)
       {
         tedge->cIntersect.c[k] += tedge->dcPerScan.c[k];
       }
+      for (int k = 0; et->attribs && k < PHONG_ATTRIBS; k++)
+      {
+        tedge->aIntersect[k] += tedge->daPerScan[k];
+      }
 
       if ((tedge->dxPerScan < 0.0 && tedge->xIntersect < tedge->x1) || (tedge->dxPerScan > 0.0 && tedge->xIntersect > tedge->x1))
       {
         tedge->xIntersect = tedge->x1;
         tedge->zIntersect = 1.0 / tedge->z1;
-        // **New**: Update color interpolation
         for (int k = 0; k < 3; k++)
         {
           tedge->cIntersect.c[k] += tedge->dcPerScan.c[k];
         }
+        for (int k = 0; et->attribs && k < PHONG_ATTRIBS; k++)
+        {
+          tedge->aIntersect[k] += tedge->daPerScan[k];
+        }
       }
 
-      ll_insert(tmplist, tedge, compXIntersect);
+      et->active[n++] = tedge;
     }
   }
+  et->nActive = n;
 
-  while ((tedge = ll_pop(tmplist)) != NULL)
+  // The table is almost sorted from the previous scanline, so an insertion sort is linear in practice
+  for (i = 1; i < n; i++)
   {
-    ll_insert(active, tedge, compXIntersect);
+    tedge = et->active[i];
+    for (j = i; j > 0 && et->active[j - 1]->xIntersect > tedge->xIntersect; j--)
+    {
+      et->active[j] = et->active[j - 1];
+    }
+    et->active[j] = tedge;
   }
-
-  ll_delete(tmplist, NULL);
 }
 
-// Process the edge list and fill polygons using the scanline algorithm
-static int processEdgeList(LinkedList *edges, Image *src, DrawState *ds, Lighting *lighting)
+// Insert an edge into the active edge table, keeping it sorted by xIntersect
+static void insertActive(EdgeTable *et, Edge *edge)
 {
-  LinkedList *active = ll_new();
-  Edge *current;
-  int scan = 0;
+  int j;
+  for (j = et->nActive; j > 0 && et->active[j - 1]->xIntersect > edge->xIntersect; j--)
+  {
+    et->active[j] = et->active[j - 1];
+  }
+  et->active[j] = edge;
+  et->nActive++;
+}
 
-  current = ll_head(edges);
+// Process the edge table and fill polygons using the scanline algorithm, limited to the given rows and columns
+static int processEdgeList(EdgeTable *et, Image *src, DrawState *ds, Lighting *lighting, int rowStart, int colStart, int rowEnd, int colEnd)
+{
+  int next = 0;
+  int scan;
 
-  for (scan = current->yStart; scan < src->rows; scan++)
+  for (scan = et->edge[0].yStart; scan < rowEnd; scan++)
   {
-    while (current != NULL && current->yStart == scan)
+    while (next < et->nEdges && et->edge[next].yStart == scan)
     {
-      ll_insert(active, current, compXIntersect);
-      current = ll_next(edges);
+      insertActive(et, &et->edge[next]);
+      next++;
     }
 
-    if (ll_empty(active))
+    if (et->nActive == 0)
     {
-      break;
+      // Skip ahead to the next edge, or stop if there are none left
+      if (next >= et->nEdges)
+        break;
+      scan = et->edge[next].yStart - 1;
+      continue;
     }
 
-    fillScan(scan, active, src, ds, lighting);
-    updateActiveList(active, scan);
+    // Rows above the requested ones still advance the edges so every tile sees the same intersections
+    if (scan >= rowStart)
+      fillScan(scan, et, src, ds, lighting, colStart, colEnd);
+    updateActiveList(et, scan);
   }
 
-  ll_delete(active, NULL);
   return 0;
 }
 
@@ -553,34 +846,104 @@ void polygon_shade(Polygon *p, DrawState *ds, Lighting *lighting)
       p->color = (Color *)malloc(p->nVertex * sizeof(Color));
     }
 
-    for (int i = 0; i < p->nVertex; i++)
+    lighting_shadeVertices(lighting, p->nVertex, p->vertex, p->normal, &ds->viewer, &ds->body, &ds->surface, ds->surfaceCoeff, p->oneSided, p->color);
+  }
+}
+
+// Test whether every vertex normal of the polygon points away from the viewer
+int polygon_backFacing(Polygon *p, Point *viewer)
+{
+  if (!p->normal)
+  {
+    return 0;
+  }
+
+  for (int i = 0; i < p->nVertex; i++)
+  {
+    Vector V;
+    vector_subtract(viewer, &p->vertex[i], &V);
+    if (vector_dot(&p->normal[i], &V) > 0.0)
     {
-      Vector temp;
-      vector_subtract(&ds->viewer, &p->vertex[i], &temp);
-      lighting_shading(lighting, &p->normal[i], &temp, &p->vertex[i], &ds->body, &ds->surface, ds->surfaceCoeff, p->oneSided, &p->color[i]);
+      return 0;
     }
   }
+  return 1;
+}
+
+// Test whether the part of a screen-space polygon in rows [rowStart, rowEnd) and columns [colStart, colEnd) is
+// hidden everywhere by the hierarchical z-buffer, using its screen bounding box and nearest vertex
+static int polygon_occluded(Polygon *p, Image *src, int rowStart, int colStart, int rowEnd, int colEnd)
+{
+  if (p->nVertex < 1)
+  {
+    return 0;
+  }
+
+  float zmax = 0.0f;
+  double xmin = p->vertex[0].val[0], xmax = xmin;
+  double ymin = p->vertex[0].val[1], ymax = ymin;
+
+  for (int i = 0; i < p->nVertex; i++)
+  {
+    if (p->vertex[i].val[2] <= 0.0)
+    {
+      return 0; // 2D polygons are drawn without the z-buffer
+    }
+    float z = 1.0 / p->vertex[i].val[2];
+    zmax = z > zmax ? z : zmax;
+    xmin = fmin(xmin, p->vertex[i].val[0]);
+    xmax = fmax(xmax, p->vertex[i].val[0]);
+    ymin = fmin(ymin, p->vertex[i].val[1]);
+    ymax = fmax(ymax, p->vertex[i].val[1]);
+  }
+
+  // Pad by a pixel to cover the scanline rounding
+  int r0 = (int)fmax(floor(ymin) - 1, rowStart);
+  int r1 = (int)fmin(ceil(ymax) + 1, rowEnd - 1);
+  int c0 = (int)fmax(floor(xmin) - 1, colStart);
+  int c1 = (int)fmin(ceil(xmax) + 1, colEnd - 1);
+  return image_occluded(src, r0, c0, r1, c1, zmax);
 }
 
 // Draw a filled polygon with shading using the scanline z-buffer algorithm
 void polygon_drawShade(Polygon *p, Image *src, DrawState *ds, Lighting *lighting)
 {
-  LinkedList *edges = setupEdgeList(p, src, ds);
-  if (!edges)
+  if (src)
+    polygon_drawShadeTile(p, src, ds, lighting, 0, 0, src->rows, src->cols);
+}
+
+// Draw the part of a shaded polygon that falls in rows [rowStart, rowEnd) and columns [colStart, colEnd)
+void polygon_drawShadeTile(Polygon *p, Image *src, DrawState *ds, Lighting *lighting, int rowStart, int colStart, int rowEnd, int colEnd)
+{
+  if (!p || !src || !ds)
+    return;
+  if (rowStart < 0)
+    rowStart = 0;
+  if (colStart < 0)
+    colStart = 0;
+  if (rowEnd > src->rows)
+    rowEnd = src->rows;
+  if (colEnd > src->cols)
+    colEnd = src->cols;
+  if (rowStart >= rowEnd || colStart >= colEnd)
+    return;
+  if (src->zSeg && polygon_occluded(p, src, rowStart, colStart, rowEnd, colEnd))
+    return;
+  if (!setupEdgeList(&edgeTable, p, src, ds, lighting))
     return;
-  processEdgeList(edges, src, ds, lighting);
-  ll_delete(edges, (void (*)(const void *))free);
+  processEdgeList(&edgeTable, src, ds, lighting, rowStart, colStart, rowEnd, colEnd);
 }
 
 // Draw a filled polygon with constant shading
 void polygon_drawFill(Polygon *p, Image *src, Color c)
 {
-  DrawState *ds = drawstate_create();
-  ds->shade = ShadeConstant;
-  ds->color = c;
+  DrawState ds;
+  drawstate_init(&ds);
+  ds.shade = ShadeConstant;
+  ds.color = c;
 
   Lighting *lighting = NULL;
-  polygon_drawShade(p, src, ds, lighting);
+  polygon_drawShade(p, src, &ds, lighting);
 }
 
 /****************************************
@@ -0,0 +1,338 @@
+// These functions bin screen-space polygons into tiles and rasterize the tiles in parallel.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "raster.h"
+
+// Create a rasterizer with nThreads threads (<= 0 for one per processor) and square tiles of tileSize pixels,
+// rounded up to whole image tiles so neighboring raster tiles never share a dirty flag or a Hi-Z segment
+Rasterizer *rasterizer_create(int nThreads, int tileSize)
+{
+  Rasterizer *r = (Rasterizer *)malloc(sizeof(Rasterizer));
+  if (!r)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return NULL;
+  }
+
+  r->pool = threadpool_create(nThreads);
+  r->tileSize = tileSize > 0 ? tileSize : RASTER_TILE_SIZE;
+  r->tileSize = (r->tileSize + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE * IMAGE_TILE_SIZE;
+  r->rows = 0;
+  r->cols = 0;
+  r->tilesX = 0;
+  r->tilesY = 0;
+  r->item = NULL;
+  r->nItems = 0;
+  r->itemCapacity = 0;
+  r->vertex = NULL;
+  r->color = NULL;
+  r->world = NULL;
+  r->normal = NULL;
+  r->nVertex = 0;
+  r->vertexCapacity = 0;
+  r->bin = NULL;
+  r->binCount = NULL;
+  r->binCapacity = NULL;
+  r->target = NULL;
+  return r;
+}
+
+// Free the tile bins
+static void rasterizer_freeBins(Rasterizer *r)
+{
+  for (int i = 0; i < r->tilesX * r->tilesY; i++)
+  {
+    free(r->bin[i]);
+  }
+  free(r->bin);
+  free(r->binCount);
+  free(r->binCapacity);
+  r->bin = NULL;
+  r->binCount = NULL;
+  r->binCapacity = NULL;
+  r->tilesX = 0;
+  r->tilesY = 0;
+}
+
+// Delete a rasterizer and stop its threads
+void rasterizer_delete(Rasterizer *r)
+{
+  if (!r)
+  {
+    return;
+  }
+  rasterizer_freeBins(r);
+  threadpool_delete(r->pool);
+  free(r->item);
+  free(r->vertex);
+  free(r->color);
+  free(r->world);
+  free(r->normal);
+  free(r);
+}
+
+// Lay out the tile bins for an image of the given size
+static int rasterizer_layout(Rasterizer *r, int rows, int cols)
+{
+  rasterizer_freeBins(r);
+  r->rows = rows;
+  r->cols = cols;
+  r->tilesX = (cols + r->tileSize - 1) / r->tileSize;
+  r->tilesY = (rows + r->tileSize - 1) / r->tileSize;
+
+  int nTiles = r->tilesX * r->tilesY;
+  r->bin = (int **)calloc(nTiles, sizeof(int *));
+  r->binCount = (int *)calloc(nTiles, sizeof(int));
+  r->binCapacity = (int *)calloc(nTiles, sizeof(int));
+  if (!r->bin || !r->binCount || !r->binCapacity)
+  {
+    rasterizer_freeBins(r);
+    return 1;
+  }
+  return 0;
+}
+
+// Make room for one more item index in a tile's bin; returns 0 on success
+static int rasterizer_reserveBin(Rasterizer *r, int tile)
+{
+  if (r->binCount[tile] == r->binCapacity[tile])
+  {
+    int capacity = r->binCapacity[tile] ? r->binCapacity[tile] * 2 : 16;
+    int *bin = (int *)realloc(r->bin[tile], capacity * sizeof(int));
+    if (!bin)
+    {
+      return 1;
+    }
+    r->bin[tile] = bin;
+    r->binCapacity[tile] = capacity;
+  }
+  return 0;
+}
+
+// Draw a polygon that could not be queued straight into src, after the queued ones so the drawing order is kept
+static void rasterizer_drawNow(Rasterizer *r, Polygon *p, DrawState *ds, Lighting *lighting, Image *src)
+{
+  fprintf(stderr, "Memory allocation failed, drawing the polygon without the rasterizer\n");
+  rasterizer_flush(r, r->target);
+  polygon_drawShade(p, src, ds, lighting);
+}
+
+// Queue a normalized, screen-space polygon for rasterization into src; lighting is used by Phong polygons. If the
+// queue cannot grow, the polygon is drawn at once instead
+void rasterizer_submit(Rasterizer *r, Polygon *p, DrawState *ds, Lighting *lighting, Image *src)
+{
+  if (!r || !p || !ds || !src || p->nVertex < 3)
+  {
+    return;
+  }
+
+  // Pending polygons belong to the previous image, so finish them first
+  if (r->nItems && src != r->target)
+  {
+    rasterizer_flush(r, r->target);
+  }
+  r->target = src;
+
+  // A different image size needs a new tile layout
+  if (src->rows != r->rows || src->cols != r->cols || !r->bin)
+  {
+    if (rasterizer_layout(r, src->rows, src->cols))
+    {
+      polygon_drawShade(p, src, ds, lighting); // nothing can be queued, and nothing is pending
+      return;
+    }
+  }
+
+  // Screen bounding box, padded by a pixel to cover the scanline rounding
+  double xmin = p->vertex[0].val[0], xmax = xmin;
+  double ymin = p->vertex[0].val[1], ymax = ymin;
+  for (int i = 1; i < p->nVertex; i++)
+  {
+    xmin = fmin(xmin, p->vertex[i].val[0]);
+    xmax = fmax(xmax, p->vertex[i].val[0]);
+    ymin = fmin(ymin, p->vertex[i].val[1]);
+    ymax = fmax(ymax, p->vertex[i].val[1]);
+  }
+  if (xmax < -1 || ymax < -1 || xmin > src->cols || ymin > src->rows)
+  {
+    return;
+  }
+  int tx0 = (int)fmax(xmin - 1, 0) / r->tileSize;
+  int tx1 = (int)fmin(xmax + 1, src->cols - 1) / r->tileSize;
+  int ty0 = (int)fmax(ymin - 1, 0) / r->tileSize;
+  int ty1 = (int)fmin(ymax + 1, src->rows - 1) / r->tileSize;
+
+  // Copy the polygon into the pools
+  if (r->nItems == r->itemCapacity)
+  {
+    int capacity = r->itemCapacity ? r->itemCapacity * 2 : 256;
+    RasterItem *item = (RasterItem *)realloc(r->item, capacity * sizeof(RasterItem));
+    if (!item)
+    {
+      rasterizer_drawNow(r, p, ds, lighting, src);
+      return;
+    }
+    r->item = item;
+    r->itemCapacity = capacity;
+  }
+  if (r->nVertex + p->nVertex > r->vertexCapacity)
+  {
+    int capacity = r->vertexCapacity ? r->vertexCapacity * 2 : 1024;
+    while (capacity < r->nVertex + p->nVertex)
+    {
+      capacity *= 2;
+    }
+    Point *vertex = (Point *)realloc(r->vertex, capacity * sizeof(Point));
+    if (!vertex)
+    {
+      rasterizer_drawNow(r, p, ds, lighting, src);
+      return;
+    }
+    r->vertex = vertex;
+    Color *color = (Color *)realloc(r->color, capacity * sizeof(Color));
+    if (!color)
+    {
+      rasterizer_drawNow(r, p, ds, lighting, src);
+      return;
+    }
+    r->color = color;
+    Point *world = (Point *)realloc(r->world, capacity * sizeof(Point));
+    if (!world)
+    {
+      rasterizer_drawNow(r, p, ds, lighting, src);
+      return;
+    }
+    r->world = world;
+    Vector *normal = (Vector *)realloc(r->normal, capacity * sizeof(Vector));
+    if (!normal)
+    {
+      rasterizer_drawNow(r, p, ds, lighting, src);
+      return;
+    }
+    r->normal = normal;
+    r->vertexCapacity = capacity;
+  }
+
+  for (int ty = ty0; ty <= ty1; ty++)
+  {
+    for (int tx = tx0; tx <= tx1; tx++)
+    {
+      if (rasterizer_reserveBin(r, ty * r->tilesX + tx))
+      {
+        rasterizer_drawNow(r, p, ds, lighting, src);
+        return;
+      }
+    }
+  }
+
+  RasterItem *item = &r->item[r->nItems];
+  item->nVertex = p->nVertex;
+  item->first = r->nVertex;
+  item->hasColor = p->color != NULL;
+  item->hasPhong = (ds->shade == ShadePhong || ds->shade == ShadeDeferred) && lighting && p->vertexWorld && p->normal;
+  item->oneSided = p->oneSided;
+  item->lighting = lighting;
+  drawstate_copy(&item->ds, ds);
+  for (int i = 0; i < p->nVertex; i++)
+  {
+    r->vertex[r->nVertex + i] = p->vertex[i];
+    if (p->color)
+    {
+      r->color[r->nVertex + i] = p->color[i];
+    }
+    if (item->hasPhong)
+    {
+      r->world[r->nVertex + i] = p->vertexWorld[i];
+      r->normal[r->nVertex + i] = p->normal[i];
+    }
+  }
+  r->nVertex += p->nVertex;
+
+  for (int ty = ty0; ty <= ty1; ty++)
+  {
+    for (int tx = tx0; tx <= tx1; tx++)
+    {
+      int tile = ty * r->tilesX + tx;
+      r->bin[tile][r->binCount[tile]++] = r->nItems;
+    }
+  }
+  r->nItems++;
+}
+
+// Rasterize every polygon binned into one tile; tiles cover disjoint pixels so no locking is needed
+static void rasterizer_drawTile(void *arg, int tile)
+{
+  Rasterizer *r = (Rasterizer *)arg;
+  int row = (tile / r->tilesX) * r->tileSize;
+  int col = (tile % r->tilesX) * r->tileSize;
+
+  for (int i = 0; i < r->binCount[tile]; i++)
+  {
+    RasterItem *item = &r->item[r->bin[tile][i]];
+    Polygon p;
+    polygon_init(&p);
+    p.nVertex = item->nVertex;
+    p.vertex = &r->vertex[item->first];
+    p.color = item->hasColor ? &r->color[item->first] : NULL;
+    p.oneSided = item->oneSided;
+    if (item->hasPhong)
+    {
+      p.vertexWorld = &r->world[item->first];
+      p.normal = &r->normal[item->first];
+    }
+    polygon_drawShadeTile(&p, r->target, &item->ds, item->lighting, row, col, row + r->tileSize, col + r->tileSize);
+  }
+}
+
+// Rasterize all queued polygons into src and empty the queue
+void rasterizer_flush(Rasterizer *r, Image *src)
+{
+  if (!r || !r->nItems)
+  {
+    return;
+  }
+
+  r->target = src;
+  threadpool_run(r->pool, r->tilesX * r->tilesY, rasterizer_drawTile, r);
+
+  for (int i = 0; i < r->tilesX * r->tilesY; i++)
+  {
+    r->binCount[i] = 0;
+  }
+  r->nItems = 0;
+  r->nVertex = 0;
+}
+
+// Structure to represent a deferred lighting pass split into bands of tile rows
+typedef struct
+{
+  Image *src;         // image holding the G-buffer
+  Lighting *lighting; // lights
+  Point *viewer;      // viewer position
+  int rows;           // rows per band
+} GBufferPass;
+
+// Light the deferred samples of one band of rows
+static void rasterizer_shadeBand(void *arg, int band)
+{
+  GBufferPass *pass = (GBufferPass *)arg;
+  lighting_shadeGBuffer(pass->lighting, pass->src, pass->viewer, band * pass->rows, (band + 1) * pass->rows);
+}
+
+// Light the deferred samples of src on the rasterizer's threads; call once per frame, after the last draw
+void rasterizer_shadeGBuffer(Rasterizer *r, Image *src, Lighting *lighting, Point *viewer)
+{
+  if (!r || !src || !src->gbuf || !lighting)
+  {
+    return;
+  }
+
+  GBufferPass pass;
+  pass.src = src;
+  pass.lighting = lighting;
+  pass.viewer = viewer;
+  pass.rows = r->tileSize;
+  threadpool_run(r->pool, (src->rows + pass.rows - 1) / pass.rows, rasterizer_shadeBand, &pass);
+}
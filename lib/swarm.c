@@ -1,7 +1,18 @@
 #include "swarm.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
+// Structure to represent one steer_swarm job split into chunks of sorted agents
+typedef struct
+{
+  Agent *swarm;
+  SwarmGrid *grid;
+  const SwarmParams *params;
+  int reach; // cells searched on each side of an agent's cell
+} SwarmJob;
+
 // Initialize the swarm
 void initialize_swarm(Agent *swarm, int numAgents, int cols, int rows)
 {
@@ -69,3 +80,405 @@ void render_swarm(Agent *swarm, int numAgents, Module *m, Module *figure)
     module_module(m, figure); // insert the figure into the module
   }
 }
+
+// Return the cell coordinate of a position along one axis
+static inline int swarm_cell(float x, float inverseSize)
+{
+  return (int)floorf(x * inverseSize);
+}
+
+// Return the bucket a cell hashes to. The hash is linear in x, so each row of cells along x lands in consecutive
+// buckets and a neighborhood is read as a few contiguous runs of agents.
+static inline int swarm_hash(int x, int y, int z, int mask)
+{
+  return ((unsigned int)x + (unsigned int)y * 0x9e3779b1u + (unsigned int)z * 0x85ebca77u) & mask;
+}
+
+// Add the bucket run [lo, hi] to runs, skipping it if it holds no agents. Returns the new number of runs.
+static int swarm_addRun(const SwarmGrid *grid, int *runs, int n, int lo, int hi)
+{
+  if (grid->start[lo] != grid->start[hi + 1])
+  {
+    runs[2 * n] = lo;
+    runs[2 * n + 1] = hi;
+    n++;
+  }
+  return n;
+}
+
+// Fill runs with the bucket runs, as lo and hi pairs, holding the cells within reach of cell (x, y, z). Each row of
+// cells is one run, split where it wraps around the table; where rows hash onto overlapping buckets, the buckets
+// already listed are left out so their agents are not visited twice. Returns the number of runs.
+static int swarm_runs(const SwarmGrid *grid, int x, int y, int z, int reach, int *runs)
+{
+  int mask = grid->nBuckets - 1, side = 2 * reach + 1, n = 0;
+
+  // A row as long as the table covers every bucket, so the whole table is one run
+  if (side >= grid->nBuckets)
+  {
+    return swarm_addRun(grid, runs, n, 0, mask);
+  }
+
+  for (int dz = -reach; dz <= reach; dz++)
+  {
+    for (int dy = -reach; dy <= reach; dy++)
+    {
+      int lo = swarm_hash(x - reach, y + dy, z + dz, mask);
+      int wrap = lo + side - 2 - mask; // last bucket of the piece wrapped around to the start of the table
+      int piece[2][2] = {{lo, lo + side - 1 < mask ? lo + side - 1 : mask}, {0, wrap < mask ? wrap : mask}};
+
+      for (int p = 0; p < 2 && piece[p][0] <= piece[p][1]; p++)
+      {
+        int overlap = 0;
+        for (int r = 0; r < n && !overlap; r++)
+        {
+          overlap = runs[2 * r] <= piece[p][1] && piece[p][0] <= runs[2 * r + 1];
+        }
+        if (!overlap)
+        {
+          n = swarm_addRun(grid, runs, n, piece[p][0], piece[p][1]);
+          continue;
+        }
+
+        // Rare: add the buckets of the piece no earlier run covers one at a time
+        int listed = n;
+        for (int b = piece[p][0]; b <= piece[p][1]; b++)
+        {
+          int covered = 0;
+          for (int r = 0; r < listed && !covered; r++)
+          {
+            covered = runs[2 * r] <= b && b <= runs[2 * r + 1];
+          }
+          if (!covered)
+          {
+            n = swarm_addRun(grid, runs, n, b, b);
+          }
+        }
+      }
+    }
+  }
+  return n;
+}
+
+// Return the cells searched on each side of a cell to cover radius
+static int swarm_reach(const SwarmGrid *grid, float radius)
+{
+  int reach = (int)ceilf(radius / grid->cellSize);
+  return reach > 0 ? reach : 1;
+}
+
+// Initialize an empty grid whose cells are cellSize on a side; neighbor queries are cheapest with a radius of
+// about one cell. Returns 0 on success.
+int swarm_gridInit(SwarmGrid *grid, float cellSize)
+{
+  if (!grid || !(cellSize > 0))
+  {
+    printf("Invalid arguments passed to swarm_gridInit\n");
+    return 1;
+  }
+  memset(grid, 0, sizeof(SwarmGrid));
+  grid->cellSize = cellSize;
+  return 0;
+}
+
+// Rebuild the grid from the current positions: hash each agent's cell, then counting-sort the agents by bucket.
+// Returns 0 on success.
+int swarm_gridBuild(SwarmGrid *grid, const Agent *swarm, int numAgents)
+{
+  if (!grid || (!swarm && numAgents > 0) || numAgents < 0)
+  {
+    printf("Invalid arguments passed to swarm_gridBuild\n");
+    return 1;
+  }
+
+  int nBuckets = 64;
+  while (nBuckets < 2 * numAgents)
+  {
+    nBuckets *= 2;
+  }
+  if (numAgents > grid->capacity || nBuckets > grid->nBuckets)
+  {
+    int capacity = numAgents > grid->capacity ? numAgents : grid->capacity;
+    int *start = (int *)realloc(grid->start, (nBuckets + 1) * sizeof(int));
+    if (start)
+      grid->start = start;
+    int *order = (int *)realloc(grid->order, capacity * sizeof(int));
+    if (order)
+      grid->order = order;
+    int *slot = (int *)realloc(grid->slot, capacity * sizeof(int));
+    if (slot)
+      grid->slot = slot;
+    float *pos = (float *)realloc(grid->pos, capacity * 3 * sizeof(float));
+    if (pos)
+      grid->pos = pos;
+    float *vel = (float *)realloc(grid->vel, capacity * 3 * sizeof(float));
+    if (vel)
+      grid->vel = vel;
+    float *limit = (float *)realloc(grid->limit, capacity * 2 * sizeof(float));
+    if (limit)
+      grid->limit = limit;
+    float *acc = (float *)realloc(grid->acc, capacity * 3 * sizeof(float));
+    if (acc)
+      grid->acc = acc;
+    if (!start || !order || !slot || !pos || !vel || !limit || !acc)
+    {
+      fprintf(stderr, "Unable to allocate the swarm grid\n");
+      grid->nAgents = 0;
+      return 1;
+    }
+    grid->capacity = capacity;
+  }
+  grid->nBuckets = nBuckets;
+  grid->nAgents = numAgents;
+
+  // Count the agents of each bucket, then turn the counts into the end of each bucket's run
+  float inverseSize = 1.0f / grid->cellSize;
+  memset(grid->start, 0, (nBuckets + 1) * sizeof(int));
+  for (int i = 0; i < numAgents; i++)
+  {
+    const Real *p = swarm[i].position.val;
+    int b = swarm_hash(swarm_cell(p[0], inverseSize), swarm_cell(p[1], inverseSize), swarm_cell(p[2], inverseSize),
+                       nBuckets - 1);
+    grid->slot[i] = b;
+    grid->start[b]++;
+  }
+  for (int b = 0, sum = 0; b <= nBuckets; b++)
+  {
+    sum += grid->start[b];
+    grid->start[b] = sum;
+  }
+
+  // Place the agents from the back, which leaves each bucket's entry at the start of its run
+  for (int i = numAgents - 1; i >= 0; i--)
+  {
+    int k = --grid->start[grid->slot[i]];
+    grid->slot[i] = k;
+    grid->order[k] = i;
+    for (int a = 0; a < 3; a++)
+    {
+      grid->pos[3 * k + a] = swarm[i].position.val[a];
+      grid->vel[3 * k + a] = swarm[i].velocity.val[a];
+    }
+    grid->limit[2 * k] = swarm[i].maxSpeed;
+    grid->limit[2 * k + 1] = swarm[i].maxForce;
+  }
+  return 0;
+}
+
+// Find the agents within radius of center, as of the last build. Fills neighbors with up to maxNeighbors agent
+// indices and returns how many it found.
+int swarm_gridQuery(const SwarmGrid *grid, const Point *center, float radius, int *neighbors, int maxNeighbors)
+{
+  if (!grid || !grid->start || !center || !neighbors || grid->nAgents == 0)
+  {
+    return 0;
+  }
+
+  float inverseSize = 1.0f / grid->cellSize;
+  float x = center->val[0], y = center->val[1], z = center->val[2];
+  float radius2 = radius * radius;
+  int reach = swarm_reach(grid, radius);
+  int *runs = (int *)malloc(2 * (2 * reach + 1) * (2 * reach + 1) * (2 * reach + 1) * sizeof(int));
+  if (!runs)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return 0;
+  }
+  int nRuns = swarm_runs(grid, swarm_cell(x, inverseSize), swarm_cell(y, inverseSize), swarm_cell(z, inverseSize),
+                         reach, runs);
+
+  int n = 0;
+  for (int r = 0; r < nRuns && n < maxNeighbors; r++)
+  {
+    for (int k = grid->start[runs[2 * r]]; k < grid->start[runs[2 * r + 1] + 1] && n < maxNeighbors; k++)
+    {
+      const float *p = grid->pos + 3 * k;
+      float dx = p[0] - x, dy = p[1] - y, dz = p[2] - z;
+      if (dx * dx + dy * dy + dz * dz <= radius2)
+      {
+        neighbors[n++] = grid->order[k];
+      }
+    }
+  }
+  free(runs);
+  return n;
+}
+
+// Free the arrays of a grid
+void swarm_gridFree(SwarmGrid *grid)
+{
+  if (grid)
+  {
+    free(grid->start);
+    free(grid->order);
+    free(grid->slot);
+    free(grid->pos);
+    free(grid->vel);
+    free(grid->limit);
+    free(grid->acc);
+    float cellSize = grid->cellSize;
+    memset(grid, 0, sizeof(SwarmGrid));
+    grid->cellSize = cellSize;
+  }
+}
+
+// Set the default steering parameters, in the units of initialize_swarm
+void swarm_params(SwarmParams *p)
+{
+  p->neighborRadius = 3.0f;
+  p->separationRadius = 1.5f;
+  p->separation = 1.5f;
+  p->alignment = 1.0f;
+  p->cohesion = 1.0f;
+  p->boundRadius = 0.0f;
+  p->maxNeighbors = 32;
+  p->pool = NULL;
+}
+
+// Add to acc weight times the Reynolds steering force toward direction: the change from velocity to full speed
+// along direction, limited to maxForce
+static void swarm_steer(float *acc, const float *direction, const float *velocity, float maxSpeed, float maxForce,
+                        float weight)
+{
+  float length = sqrtf(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+  float force[3];
+
+  if (length == 0.0f)
+  {
+    return;
+  }
+  for (int a = 0; a < 3; a++)
+  {
+    force[a] = direction[a] * (maxSpeed / length) - velocity[a];
+  }
+  length = sqrtf(force[0] * force[0] + force[1] * force[1] + force[2] * force[2]);
+  float scale = length > maxForce ? maxForce / length : 1.0f;
+  for (int a = 0; a < 3; a++)
+  {
+    acc[a] += weight * scale * force[a];
+  }
+}
+
+// Thread task steering one chunk of SWARM_CHUNK agents, in grid order so neighboring agents share their cell's
+// bucket runs and read nearby memory; the forces go to the grid's sorted accelerations
+static void swarm_steerChunk(void *arg, int task)
+{
+  SwarmJob *job = (SwarmJob *)arg;
+  SwarmGrid *grid = job->grid;
+  const SwarmParams *params = job->params;
+  float inverseSize = 1.0f / grid->cellSize;
+  float neighbor2 = params->neighborRadius * params->neighborRadius;
+  float separation2 = params->separationRadius * params->separationRadius;
+  int maxNeighbors = params->maxNeighbors > 0 ? params->maxNeighbors : grid->nAgents;
+  int end = (task + 1) * SWARM_CHUNK < grid->nAgents ? (task + 1) * SWARM_CHUNK : grid->nAgents;
+  int side = 2 * job->reach + 1;
+  int *runs = (int *)malloc(2 * side * side * side * sizeof(int));
+  int nRuns = 0, cell[3] = {0, 0, 0}, haveCell = 0;
+
+  if (!runs)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return;
+  }
+
+  for (int k = task * SWARM_CHUNK; k < end; k++)
+  {
+    const float *p = grid->pos + 3 * k;
+    const float *v = grid->vel + 3 * k;
+    float maxSpeed = grid->limit[2 * k], maxForce = grid->limit[2 * k + 1];
+    int x = swarm_cell(p[0], inverseSize), y = swarm_cell(p[1], inverseSize), z = swarm_cell(p[2], inverseSize);
+
+    if (!haveCell || x != cell[0] || y != cell[1] || z != cell[2])
+    {
+      nRuns = swarm_runs(grid, x, y, z, job->reach, runs);
+      cell[0] = x;
+      cell[1] = y;
+      cell[2] = z;
+      haveCell = 1;
+    }
+
+    // Sum the positions and velocities of the flockmates, and their pushes away from the agent
+    float sumP[3] = {0, 0, 0}, sumV[3] = {0, 0, 0}, push[3] = {0, 0, 0};
+    int count = 0, crowded = 0;
+    for (int r = 0; r < nRuns && count < maxNeighbors; r++)
+    {
+      int mEnd = grid->start[runs[2 * r + 1] + 1];
+      for (int m = grid->start[runs[2 * r]]; m < mEnd && count < maxNeighbors; m++)
+      {
+        const float *q = grid->pos + 3 * m;
+        float d[3] = {p[0] - q[0], p[1] - q[1], p[2] - q[2]};
+        float d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        if (d2 > neighbor2 || m == k)
+        {
+          continue;
+        }
+        const float *w = grid->vel + 3 * m;
+        for (int a = 0; a < 3; a++)
+        {
+          sumP[a] += q[a];
+          sumV[a] += w[a];
+        }
+        count++;
+        if (d2 < separation2 && d2 > 0.0f)
+        {
+          for (int a = 0; a < 3; a++)
+          {
+            push[a] += d[a] / d2; // away from the flockmate, harder the closer it is
+          }
+          crowded++;
+        }
+      }
+    }
+
+    float acc[3] = {0, 0, 0};
+    if (crowded)
+    {
+      swarm_steer(acc, push, v, maxSpeed, maxForce, params->separation);
+    }
+    if (count)
+    {
+      float toCenter[3];
+      for (int a = 0; a < 3; a++)
+      {
+        toCenter[a] = sumP[a] / count - p[a];
+      }
+      swarm_steer(acc, sumV, v, maxSpeed, maxForce, params->alignment);
+      swarm_steer(acc, toCenter, v, maxSpeed, maxForce, params->cohesion);
+    }
+    if (params->boundRadius > 0 && p[0] * p[0] + p[1] * p[1] + p[2] * p[2] > params->boundRadius * params->boundRadius)
+    {
+      float home[3] = {-p[0], -p[1], -p[2]};
+      swarm_steer(acc, home, v, maxSpeed, maxForce, 1.0f);
+    }
+    for (int a = 0; a < 3; a++)
+    {
+      grid->acc[3 * k + a] = acc[a];
+    }
+  }
+  free(runs);
+}
+
+// Add the boids steering forces (separation, alignment and cohesion with the flockmates found through the grid)
+// to each agent's acceleration. The grid must have been built from the swarm's current positions; update_swarm
+// then applies the accelerations.
+void steer_swarm(Agent *swarm, int numAgents, SwarmGrid *grid, const SwarmParams *p)
+{
+  if (!swarm || !grid || !p || grid->nAgents != numAgents)
+  {
+    printf("steer_swarm needs a grid built from the swarm\n");
+    return;
+  }
+
+  SwarmJob job = {swarm, grid, p, swarm_reach(grid, p->neighborRadius)};
+  threadpool_run(p->pool, (numAgents + SWARM_CHUNK - 1) / SWARM_CHUNK, swarm_steerChunk, &job);
+
+  // Hand the forces back in agent order, so the agents are walked through once in memory order
+  for (int i = 0; i < numAgents; i++)
+  {
+    const float *acc = grid->acc + 3 * grid->slot[i];
+    for (int a = 0; a < 3; a++)
+    {
+      swarm[i].acceleration.val[a] += acc[a];
+    }
+  }
+}
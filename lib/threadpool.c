@@ -0,0 +1,161 @@
+// These functions provide a pool of worker threads that share the tasks of a job.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+// Hand out tasks of the current job until there are none left; called with the lock held
+static void threadpool_work(ThreadPool *pool)
+{
+  while (pool->nextTask < pool->nTasks)
+  {
+    int task = pool->nextTask++;
+    ThreadTask func = pool->func;
+    void *arg = pool->arg;
+
+    pthread_mutex_unlock(&pool->lock);
+    func(arg, task);
+    pthread_mutex_lock(&pool->lock);
+
+    pool->nFinished++;
+    if (pool->nFinished == pool->nTasks)
+    {
+      pthread_cond_broadcast(&pool->done);
+    }
+  }
+}
+
+// Worker thread loop: sleep until a job is posted, then help finish it
+static void *threadpool_worker(void *data)
+{
+  ThreadPool *pool = (ThreadPool *)data;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1)
+  {
+    while (pool->job == seen && !pool->quit)
+    {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    if (pool->quit)
+    {
+      break;
+    }
+    seen = pool->job;
+    threadpool_work(pool);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+// Returns the number of online processors, or 1 if it cannot be determined
+int threadpool_cpuCount(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+// Create a pool with nThreads threads (the calling thread counts as one); nThreads <= 0 uses one per processor
+ThreadPool *threadpool_create(int nThreads)
+{
+  ThreadPool *pool = (ThreadPool *)malloc(sizeof(ThreadPool));
+  if (!pool)
+  {
+    fprintf(stderr, "Memory allocation failed\n");
+    return NULL;
+  }
+
+  if (nThreads <= 0)
+  {
+    nThreads = threadpool_cpuCount();
+  }
+
+  pool->nThreads = 1;
+  pool->threads = (pthread_t *)malloc(nThreads * sizeof(pthread_t));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->func = NULL;
+  pool->arg = NULL;
+  pool->nTasks = 0;
+  pool->nextTask = 0;
+  pool->nFinished = 0;
+  pool->job = 0;
+  pool->quit = 0;
+
+  // Start the workers; if a thread cannot be created the pool just runs with fewer
+  for (int i = 0; pool->threads && i < nThreads - 1; i++)
+  {
+    if (pthread_create(&pool->threads[i], NULL, threadpool_worker, pool) != 0)
+    {
+      break;
+    }
+    pool->nThreads++;
+  }
+
+  return pool;
+}
+
+// Stop the worker threads and free the pool
+void threadpool_delete(ThreadPool *pool)
+{
+  if (!pool)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->nThreads - 1; i++)
+  {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->done);
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool);
+}
+
+// Run func(arg, task) for every task in [0, nTasks) on the pool and wait for all of them to finish
+void threadpool_run(ThreadPool *pool, int nTasks, ThreadTask func, void *arg)
+{
+  if (nTasks <= 0)
+  {
+    return;
+  }
+
+  // Without a pool or workers, just run the tasks in order
+  if (!pool || pool->nThreads == 1)
+  {
+    for (int i = 0; i < nTasks; i++)
+    {
+      func(arg, i);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->func = func;
+  pool->arg = arg;
+  pool->nTasks = nTasks;
+  pool->nextTask = 0;
+  pool->nFinished = 0;
+  pool->job++;
+  pthread_cond_broadcast(&pool->wake);
+
+  // The calling thread works on the job too
+  threadpool_work(pool);
+  while (pool->nFinished < pool->nTasks)
+  {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -5,7 +5,7 @@
 #include <math.h>
 
 // Sets the vector data to the specified values.
-void vector_set(Vector *v, double x, double y, double z)
+void vector_set(Vector *v, Real x, Real y, Real z)
 {
   v->val[0] = x;
   v->val[1] = y;
@@ -29,7 +29,7 @@ void vector_copy(Vector *dest, Vector *src)
 }
 
 // Returns the length of the vector.
-double vector_length(Vector *v)
+Real vector_length(Vector *v)
 {
   return sqrt(v->val[0] * v->val[0] + v->val[1] * v->val[1] + v->val[2] * v->val[2]);
 }
@@ -37,7 +37,7 @@ double vector_length(Vector *v)
 // Normalizes the vector.
 void vector_normalize(Vector *v)
 {
-  double length = vector_length(v);
+  Real length = vector_length(v);
   if (length > 0)
   {
     for (int i = 0; i < 3; i++)
@@ -48,7 +48,7 @@ void vector_normalize(Vector *v)
 }
 
 // Returns the dot product of the two vectors.
-double vector_dot(Vector *a, Vector *b)
+Real vector_dot(Vector *a, Vector *b)
 {
   return a->val[0] * b->val[0] + a->val[1] * b->val[1] + a->val[2] * b->val[2];
 }
@@ -0,0 +1,196 @@
+/*
+  Benchmark for the escape-time fractal renderer.
+
+  Renders the full Mandelbrot set, a zoom on the boundary, a view that is
+  mostly inside the set and a Julia set with a per-pixel complex loop like
+  the original one, then with the vector renderer on one thread, without
+  and with periodicity checking, then with rectangle subdivision, and
+  finally on every processor. The pixels subdivision gets wrong are
+  counted, and a progressive render is refined under a time budget.
+  Last, frames of a deep zoom are computed with perturbation from one
+  reference orbit, from a width of 4e-3 down to 4e-27, and their cost per
+  iteration is compared with the direct renderer's on the first frame.
+
+  Usage: fractalspeed [maxIterations]
+*/
+
+#include <complex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "image.h"
+#include "fractals.h"
+
+// Returns the current time in seconds
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The per-pixel loop the renderer replaced, with cabs() and one point at a time
+static void naive(Image *dst, FractalParams *p, double re0, double im0, double width)
+{
+  double step = width / dst->cols;
+  for (int i = 0; i < dst->rows; i++)
+  {
+    for (int j = 0; j < dst->cols; j++)
+    {
+      double complex c = (re0 + j * step) + (im0 - i * step) * I;
+      double complex z = 0;
+      int k;
+      if (p->type == FractalJulia)
+      {
+        z = c;
+        c = p->cx + p->cy * I;
+      }
+      for (k = 0; k < p->maxIterations; k++)
+      {
+        if (cabs(z) > 2.0)
+          break;
+        z = z * z + c;
+      }
+      FPixel color = {{k == p->maxIterations ? 0.0f : 1.0f, 0.0f, 0.0f}};
+      image_setf(dst, i, j, color);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const int Rows = 600;
+  const int Cols = 800;
+  int maxIterations = argc > 1 ? atoi(argv[1]) : 1000;
+  Image *src = image_create(Rows, Cols);
+  ThreadPool *pool = threadpool_create(0);
+  FractalParams p;
+
+  struct
+  {
+    const char *name;
+    FractalType type;
+    double re0, im0, width;
+  } view[] = {
+      {"full set", FractalMandelbrot, -2.5, 1.5, 4.0},
+      {"seahorse valley", FractalMandelbrot, -0.7530, 0.1002, 0.006},
+      {"period-3 bulb", FractalMandelbrot, -0.25, 0.84, 0.25},
+      {"julia", FractalJulia, -1.8, 1.35, 3.6},
+  };
+  int nViews = sizeof(view) / sizeof(view[0]);
+  int *exact = (int *)malloc(Rows * Cols * sizeof(int));
+  int *counts = (int *)malloc(Rows * Cols * sizeof(int));
+
+  printf("%d x %d, %d iterations\n", Cols, Rows, maxIterations);
+  for (int v = 0; v < nViews; v++)
+  {
+    double t[5], start, step = view[v].width / Cols;
+    char filename[64];
+    int wrong = 0;
+
+    fractal_params(&p, view[v].type);
+    p.maxIterations = maxIterations;
+
+    start = now();
+    naive(src, &p, view[v].re0, view[v].im0, view[v].width);
+    t[0] = now() - start;
+
+    p.pool = NULL;
+    p.periodicity = 0;
+    p.subdivide = 0;
+    start = now();
+    fractal_render(src, &p, view[v].re0, view[v].im0, view[v].width);
+    t[1] = now() - start;
+
+    p.periodicity = 1;
+    start = now();
+    fractal_render(src, &p, view[v].re0, view[v].im0, view[v].width);
+    t[2] = now() - start;
+    fractal_counts(&p, view[v].re0, view[v].im0, step, -step, Rows, Cols, exact);
+
+    p.subdivide = 1;
+    start = now();
+    fractal_render(src, &p, view[v].re0, view[v].im0, view[v].width);
+    t[3] = now() - start;
+    fractal_counts(&p, view[v].re0, view[v].im0, step, -step, Rows, Cols, counts);
+    for (int k = 0; k < Rows * Cols; k++)
+      wrong += counts[k] != exact[k];
+
+    p.pool = pool;
+    start = now();
+    fractal_render(src, &p, view[v].re0, view[v].im0, view[v].width);
+    t[4] = now() - start;
+
+    sprintf(filename, "fractalspeed-%d.ppm", v);
+    image_write(src, filename);
+
+    printf("%-16s per pixel %8.1f ms | 1 thread %8.1f ms, periodicity %8.1f ms, subdivision %8.1f ms (%d wrong)"
+           " | all threads %8.1f ms (%.1fx)\n",
+           view[v].name, t[0] * 1000, t[1] * 1000, t[2] * 1000, t[3] * 1000, wrong, t[4] * 1000, t[0] / t[4]);
+  }
+
+  // Refine a progressive render of the boundary zoom 5 ms at a time, as an interactive viewer would between frames
+  FractalProgress progress;
+  fractal_params(&p, FractalMandelbrot);
+  p.maxIterations = maxIterations;
+  p.pool = pool;
+  p.subdivide = 1; // a viewer can show a few wrong pixels for a faster first pass
+  if (fractal_progressiveInit(&progress, &p, Rows, Cols, view[1].re0, view[1].im0, view[1].width) == 0)
+  {
+    double start = now();
+    int block, frames = 0;
+    do
+    {
+      block = fractal_progressiveRefine(&progress, src, 0.005);
+      frames++;
+    } while (block > 1);
+    printf("progressive      %d refinements of 5 ms, complete after %8.1f ms\n", frames, (now() - start) * 1000);
+    image_write(src, "fractalspeed-progressive.ppm");
+    fractal_progressiveFree(&progress);
+  }
+
+  // Zoom toward one point, reusing its reference orbit for every frame; deep frames need many iterations, so they
+  // are smaller
+  const int DeepRows = 150;
+  const int DeepCols = 200;
+  FractalOrbit orbit;
+  FractalReal re = fractal_real("-0.743643887037158704752191506114774");
+  FractalReal im = fractal_real("0.131825904205311970493132056385139");
+  fractal_params(&p, FractalMandelbrot);
+  p.maxIterations = 20000;
+  p.pool = pool;
+  p.periodicity = 0; // not used by deep zooms
+  p.subdivide = 0;   // so every counted iteration is computed
+  if (fractal_orbit(&orbit, re, im, p.maxIterations) == 0)
+  {
+    for (double width = 4e-3; width > 1e-27; width *= 1e-3)
+    {
+      double step = width / DeepCols, start, t[2] = {0.0, 0.0};
+      long long iterations = 0;
+
+      start = now();
+      fractal_countsDeep(&p, &orbit, -0.5 * width, 0.5 * step * DeepRows, step, -step, DeepRows, DeepCols, counts);
+      t[1] = now() - start;
+      for (int k = 0; k < DeepRows * DeepCols; k++)
+        iterations += counts[k];
+
+      if (width > 1e-3)
+      {
+        start = now();
+        fractal_counts(&p, re.hi - 0.5 * width, im.hi + 0.5 * step * DeepRows, step, -step, DeepRows, DeepCols, exact);
+        t[0] = now() - start;
+      }
+      printf("deep zoom        width %8.0e %8.1f ms, %6.2f ns per iteration", width, t[1] * 1000, t[1] * 1e9 / iterations);
+      if (t[0] > 0)
+        printf(" (direct %6.2f ns)", t[0] * 1e9 / iterations);
+      printf("\n");
+    }
+    fractal_orbitFree(&orbit);
+  }
+
+  free(exact);
+  free(counts);
+  image_free(src);
+  threadpool_delete(pool);
+  return 0;
+}
@@ -0,0 +1,87 @@
+/*
+  Renders a 600-frame zoom animation into the seahorse valley twice: each
+  frame from scratch with fractal_counts, then through a FractalCache that
+  keeps escape iterations from frame to frame. Prints the iterations and
+  time each way, and writes every 100th cached frame.
+
+  Usage: zoomtest [frames]
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "image.h"
+#include "fractals.h"
+
+// Returns the current time in seconds
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+  const int Rows = 480;
+  const int Cols = 640;
+  const double CenterRe = -0.743643887037151;
+  const double CenterIm = 0.131825904205330;
+  int frames = argc > 1 ? atoi(argv[1]) : 600;
+  double zoom = pow(1e-6, 1.0 / frames); // from a width of 4 down to 4e-6
+  Image *src = image_create(Rows, Cols);
+  int *counts = (int *)malloc(Rows * Cols * sizeof(int));
+  ThreadPool *pool = threadpool_create(0);
+  FractalParams p;
+  FractalCache cache;
+  long long iterations = 0;
+  double width, start, t[2];
+
+  fractal_params(&p, FractalMandelbrot);
+  p.maxIterations = 1000;
+  p.pool = pool;
+
+  // From scratch, every pixel of every frame
+  start = now();
+  width = 4.0;
+  for (int f = 0; f < frames; f++, width *= zoom)
+  {
+    double step = width / Cols;
+    fractal_counts(&p, CenterRe - 0.5 * width, CenterIm + 0.5 * step * Rows, step, -step, Rows, Cols, counts);
+    fractal_color(src, counts, p.maxIterations);
+    for (int k = 0; k < Rows * Cols; k++)
+      iterations += counts[k];
+  }
+  t[0] = now() - start;
+
+  // Through the cache
+  if (fractal_cacheInit(&cache, &p, NULL, 0))
+    return 1;
+  start = now();
+  width = 4.0;
+  for (int f = 0; f < frames; f++, width *= zoom)
+  {
+    double step = width / Cols;
+    fractal_cacheRender(&cache, src, CenterRe - 0.5 * width, CenterIm + 0.5 * step * Rows, width);
+    if (f % 100 == 99)
+    {
+      char filename[64];
+      sprintf(filename, "zoom-%03d.ppm", f + 1);
+      image_write(src, filename);
+    }
+  }
+  t[1] = now() - start;
+
+  printf("%d frames of %d x %d\n", frames, Cols, Rows);
+  printf("from scratch %12lld samples %14lld iterations %8.1f ms\n", (long long)frames * Rows * Cols, iterations,
+         t[0] * 1000);
+  printf("cached       %12lld samples %14lld iterations %8.1f ms (%d tiles held)\n", cache.samples,
+         cache.iterations, t[1] * 1000, cache.nTiles);
+
+  fractal_cacheFree(&cache);
+  free(counts);
+  image_free(src);
+  threadpool_delete(pool);
+  return 0;
+}
@@ -0,0 +1,142 @@
+/*
+  Benchmark for the hierarchical z-buffer.
+
+  A corridor of walls, each with a row of spheres in front of it, is drawn
+  with and without the hierarchical z-buffer, once front to back and once
+  back to front. Front to back is the case the hierarchical z-buffer helps:
+  most of the scene is hidden behind the first walls. The frames with and
+  without it are written out and should match.
+
+  Usage: hizspeed [passes]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+
+#define WALLS 30
+
+// Returns the current time in seconds
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Build the corridor, with the nearest wall first when frontToBack is set
+static Module *buildScene(Module *wall, Module *ball, int frontToBack)
+{
+  Color Grey, Blue;
+  color_set(&Grey, 0.6, 0.6, 0.6);
+  color_set(&Blue, 0.2, 0.4, 0.9);
+
+  Module *scene = module_create();
+  module_bodyColor(scene, &Blue);
+  module_surfaceColor(scene, &Grey);
+  module_surfaceCoeff(scene, 20);
+  for (int i = 0; i < WALLS; i++)
+  {
+    int k = frontToBack ? i : WALLS - 1 - i;
+    module_identity(scene);
+    module_translate(scene, k % 3 - 1, 0, k * 0.8);
+    module_module(scene, wall);
+    for (int j = 0; j < 4; j++)
+    {
+      module_identity(scene);
+      module_scale(scene, 0.3, 0.3, 0.3);
+      module_translate(scene, j - 1.5, 1, k * 0.8 - 0.5);
+      module_module(scene, ball);
+    }
+  }
+  return scene;
+}
+
+// Draw the scene passes times; returns the seconds per frame
+static double timeScene(Module *scene, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *light, Image *src, int passes)
+{
+  double start = now();
+  for (int i = 0; i < passes; i++)
+  {
+    image_reset(src);
+    module_draw(scene, VTM, GTM, ds, light, src);
+  }
+  return (now() - start) / passes;
+}
+
+int main(int argc, char *argv[])
+{
+  const int Rows = 480;
+  const int Cols = 640;
+  int passes = argc > 1 ? atoi(argv[1]) : 10;
+  Image *src;
+  View3D view;
+  Matrix VTM, GTM;
+  Color White, Dim;
+  char filename[64];
+
+  if (passes < 1)
+    passes = 1;
+
+  color_set(&White, 1.0, 1.0, 1.0);
+  color_set(&Dim, 0.15, 0.15, 0.15);
+
+  // set up the view looking down the corridor
+  point_set3D(&(view.vrp), 0, 2, -8);
+  vector_set(&(view.vpn), 0, -2, 8);
+  vector_set(&(view.vup), 0, 1, 0);
+  view.d = 2.0;
+  view.du = 1.6;
+  view.dv = 1.2;
+  view.f = 0.0;
+  view.b = 40;
+  view.screenx = Cols;
+  view.screeny = Rows;
+  matrix_setView3D(&VTM, &view);
+  matrix_identity(&GTM);
+
+  Module *wall = module_create();
+  module_scale(wall, 4, 3, 0.2);
+  module_cube(wall, 1);
+
+  Module *ball = module_create();
+  module_sphere(ball, 24, 16, 1);
+
+  DrawState *ds = drawstate_create();
+  point_copy(&(ds->viewer), &(view.vrp));
+  ds->shade = ShadeGouraud;
+
+  Lighting *light = lighting_create();
+  Point pos;
+  point_set3D(&pos, 4, 6, -6);
+  lighting_add(light, LightAmbient, &Dim, NULL, NULL, 0, 0);
+  lighting_add(light, LightPoint, &White, NULL, &pos, 0, 0);
+
+  src = image_create(Rows, Cols);
+
+  printf("%d passes of %d x %d, Gouraud shading\n", passes, Cols, Rows);
+  for (int order = 1; order >= 0; order--)
+  {
+    Module *scene = buildScene(wall, ball, order);
+    double t[2];
+    for (int hiz = 0; hiz < 2; hiz++)
+    {
+      image_trackDepth(src, hiz);
+      t[hiz] = timeScene(scene, &VTM, &GTM, ds, light, src, passes);
+      sprintf(filename, "hizspeed-%s-%s.ppm", order ? "front" : "back", hiz ? "hiz" : "flat");
+      image_write(src, filename);
+    }
+    printf("%s: %8.3f ms per frame without, %8.3f ms with the hierarchical z-buffer (%.2fx)\n",
+           order ? "front to back" : "back to front", t[0] * 1000.0, t[1] * 1000.0, t[0] / t[1]);
+    module_delete(scene);
+  }
+
+  image_free(src);
+  free(ds);
+  lighting_delete(light);
+  module_delete(ball);
+  module_delete(wall);
+
+  return 0;
+}
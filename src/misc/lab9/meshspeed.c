@@ -0,0 +1,222 @@
+/*
+  Benchmark for indexed meshes.
+
+  The same triangles are drawn once as separate polygons, each carrying its
+  own copies of its vertices, and once as an indexed mesh whose shared
+  vertices are transformed and lit once per frame. The surface is a wavy
+  grid by default, or the faces of a PLY file given on the command line.
+  The mesh is also compiled into a display list, which keeps it indexed.
+  The frames of the three versions are written out and should match.
+
+  Usage: meshspeed [passes] [file.ply]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+
+#define GRID 200
+
+// Returns the current time in seconds
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Build a GRID x GRID wavy sheet in [-1, 1] x [-1, 1] as an indexed mesh
+static void buildGrid(Mesh *mesh)
+{
+  int nv = (GRID + 1) * (GRID + 1);
+  Point *vertex = (Point *)malloc(nv * sizeof(Point));
+  int *index = (int *)malloc(6 * GRID * GRID * sizeof(int));
+  int t = 0;
+
+  for (int i = 0; i <= GRID; i++)
+  {
+    for (int j = 0; j <= GRID; j++)
+    {
+      double x = 2.0 * j / GRID - 1.0;
+      double y = 2.0 * i / GRID - 1.0;
+      point_set3D(&vertex[i * (GRID + 1) + j], x, y, 0.1 * sin(6 * x) * cos(5 * y));
+    }
+  }
+  for (int i = 0; i < GRID; i++)
+  {
+    for (int j = 0; j < GRID; j++)
+    {
+      int a = i * (GRID + 1) + j;
+      int b = a + 1, c = a + GRID + 1, d = c + 1;
+      index[t++] = a;
+      index[t++] = b;
+      index[t++] = d;
+      index[t++] = a;
+      index[t++] = d;
+      index[t++] = c;
+    }
+  }
+
+  mesh_set(mesh, nv, vertex, NULL, NULL, 2 * GRID * GRID, index);
+  mesh_computeNormals(mesh);
+  free(vertex);
+  free(index);
+}
+
+// Add every triangle of the mesh to the module as its own polygon
+static void addTriangles(Module *md, Mesh *mesh)
+{
+  Polygon p;
+  Point vertex[3];
+  Vector normal[3];
+
+  polygon_init(&p);
+  for (int t = 0; t < mesh->nTriangle; t++)
+  {
+    for (int j = 0; j < 3; j++)
+    {
+      vertex[j] = mesh->vertex[mesh->index[3 * t + j]];
+      normal[j] = mesh->normal[mesh->index[3 * t + j]];
+    }
+    polygon_set(&p, 3, vertex);
+    polygon_setNormals(&p, 3, normal);
+    polygon_setSided(&p, mesh->oneSided);
+    module_polygon(md, &p);
+    polygon_clear(&p);
+  }
+}
+
+// Draw the scene passes times; returns the seconds per frame
+static double timeScene(Module *scene, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *light, Image *src, int passes)
+{
+  double start = now();
+  for (int i = 0; i < passes; i++)
+  {
+    image_reset(src);
+    module_draw(scene, VTM, GTM, ds, light, src);
+  }
+  return (now() - start) / passes;
+}
+
+// Draw the display list passes times; returns the seconds per frame
+static double timeList(DisplayList *dl, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *light, Image *src, int passes)
+{
+  double start = now();
+  for (int i = 0; i < passes; i++)
+  {
+    image_reset(src);
+    displaylist_draw(dl, VTM, GTM, ds, light, src);
+  }
+  return (now() - start) / passes;
+}
+
+int main(int argc, char *argv[])
+{
+  const int Rows = 600;
+  const int Cols = 600;
+  int passes = argc > 1 ? atoi(argv[1]) : 5;
+  Image *src;
+  View3D view;
+  Matrix VTM, GTM;
+  Color White, Dim, Grey, Blue;
+  Mesh mesh;
+  char filename[64];
+
+  if (passes < 1)
+    passes = 1;
+
+  mesh_init(&mesh);
+  if (argc > 2)
+  {
+    if (readPLYMesh(argv[2], &mesh, 0))
+    {
+      printf("Unable to read %s\n", argv[2]);
+      return -1;
+    }
+  }
+  else
+  {
+    buildGrid(&mesh);
+  }
+
+  color_set(&White, 1.0, 1.0, 1.0);
+  color_set(&Dim, 0.15, 0.15, 0.15);
+  color_set(&Grey, 0.5, 0.5, 0.5);
+  color_set(&Blue, 0.3, 0.5, 0.9);
+
+  // look at the unit box around the origin, or the model's bounds
+  Point min, max;
+  Module *meshModule = module_create();
+  module_mesh(meshModule, &mesh);
+  module_bounds(meshModule, &min, &max);
+  double size = fmax(max.val[0] - min.val[0], fmax(max.val[1] - min.val[1], max.val[2] - min.val[2]));
+  if (size <= 0.0)
+    size = 1.0;
+
+  point_set3D(&(view.vrp), (min.val[0] + max.val[0]) / 2, (min.val[1] + max.val[1]) / 2 + 0.8 * size, (min.val[2] + max.val[2]) / 2 - 1.6 * size);
+  vector_set(&(view.vpn), 0, -0.8, 1.6);
+  vector_set(&(view.vup), 0, 1, 0);
+  view.d = 2.0;
+  view.du = 1.6;
+  view.dv = 1.6;
+  view.f = 0.0;
+  view.b = 10 * size;
+  view.screenx = Cols;
+  view.screeny = Rows;
+  matrix_setView3D(&VTM, &view);
+  matrix_identity(&GTM);
+
+  Module *polyModule = module_create();
+  addTriangles(polyModule, &mesh);
+
+  DrawState *ds = drawstate_create();
+  point_copy(&(ds->viewer), &(view.vrp));
+
+  Lighting *light = lighting_create();
+  Point pos;
+  point_set3D(&pos, size, 2 * size, -2 * size);
+  lighting_add(light, LightAmbient, &Dim, NULL, NULL, 0, 0);
+  lighting_add(light, LightPoint, &White, NULL, &pos, 0, 0);
+
+  src = image_create(Rows, Cols);
+
+  printf("%d passes of %d x %d, %d vertices, %d triangles\n", passes, Cols, Rows, mesh.nVertex, mesh.nTriangle);
+  printf("vertex transforms per frame: %d as polygons, %d as a mesh\n", 3 * mesh.nTriangle, mesh.nVertex);
+  for (int shade = 0; shade < 2; shade++)
+  {
+    double t[3];
+    ds->shade = shade ? ShadePhong : ShadeGouraud;
+    for (int indexed = 0; indexed < 2; indexed++)
+    {
+      Module *scene = module_create();
+      module_bodyColor(scene, &Blue);
+      module_surfaceColor(scene, &Grey);
+      module_surfaceCoeff(scene, 20);
+      module_module(scene, indexed ? meshModule : polyModule);
+      t[indexed] = timeScene(scene, &VTM, &GTM, ds, light, src, passes);
+      sprintf(filename, "meshspeed-%s-%s.ppm", shade ? "phong" : "gouraud", indexed ? "mesh" : "polygons");
+      image_write(src, filename);
+      if (indexed)
+      {
+        DisplayList *dl = module_compile(scene, NULL, ds);
+        t[2] = timeList(dl, &VTM, &GTM, ds, light, src, passes);
+        sprintf(filename, "meshspeed-%s-list.ppm", shade ? "phong" : "gouraud");
+        image_write(src, filename);
+        displaylist_delete(dl);
+      }
+      module_delete(scene); // leaves the shared submodule alone
+    }
+    printf("%-8s %8.3f ms per frame as polygons, %8.3f ms as a mesh (%.2fx), %8.3f ms compiled\n",
+           shade ? "Phong:" : "Gouraud:", t[0] * 1000.0, t[1] * 1000.0, t[0] / t[1], t[2] * 1000.0);
+  }
+
+  image_free(src);
+  free(ds);
+  lighting_delete(light);
+  module_delete(polyModule);
+  module_delete(meshModule);
+  mesh_clear(&mesh);
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+/*
+  Benchmark comparing Gouraud, Phong and deferred shading throughput.
+
+  The same lit module is drawn repeatedly with each shading method and the
+  time per frame is reported. The last frame of each method is written out
+  so they can be compared; deferred and Phong frames should match.
+
+  Usage: phongspeed [passes]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+
+// Returns the current time in seconds
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Draw the scene passes times with the given shading method; returns the seconds per frame
+static double timeShading(Module *scene, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *light, Image *src, ShadeMethod shade, int passes)
+{
+  ds->shade = shade;
+
+  double start = now();
+  for (int i = 0; i < passes; i++)
+  {
+    image_reset(src);
+    module_draw(scene, VTM, GTM, ds, light, src);
+    if (shade == ShadeDeferred)
+    {
+      lighting_resolveGBuffer(light, src, &ds->viewer); // light the frame once it is drawn
+    }
+  }
+  return (now() - start) / passes;
+}
+
+int main(int argc, char *argv[])
+{
+  const int Rows = 480;
+  const int Cols = 640;
+  int passes = argc > 1 ? atoi(argv[1]) : 20;
+  Image *src;
+  View3D view;
+  Matrix VTM, GTM;
+  Color White, Grey, Dim, Blue, Gold;
+
+  if (passes < 1)
+    passes = 1;
+
+  color_set(&White, 1.0, 1.0, 1.0);
+  color_set(&Grey, 0.6, 0.6, 0.6);
+  color_set(&Dim, 0.15, 0.15, 0.15);
+  color_set(&Blue, 0.2, 0.4, 0.9);
+  color_set(&Gold, 0.9, 0.7, 0.1);
+
+  // set up the view
+  point_set3D(&(view.vrp), 0, 2, -8);
+  vector_set(&(view.vpn), 0, -2, 8);
+  vector_set(&(view.vup), 0, 1, 0);
+  view.d = 2.0;
+  view.du = 1.6;
+  view.dv = 1.2;
+  view.f = 0.0;
+  view.b = 20;
+  view.screenx = Cols;
+  view.screeny = Rows;
+  matrix_setView3D(&VTM, &view);
+  matrix_identity(&GTM);
+
+  // a coarsely tessellated torus around a sphere, where Phong highlights differ most from Gouraud
+  Module *scene = module_create();
+  module_bodyColor(scene, &Blue);
+  module_surfaceColor(scene, &Grey);
+  module_surfaceCoeff(scene, 40);
+  module_rotateX(scene, cos(1.2), sin(1.2));
+  module_torus(scene, 2.0, 0.6, 24, 12, 1);
+  module_identity(scene);
+  module_bodyColor(scene, &Gold);
+  module_scale(scene, 1.1, 1.1, 1.1);
+  module_sphere(scene, 16, 12, 1);
+
+  DrawState *ds = drawstate_create();
+  point_copy(&(ds->viewer), &(view.vrp));
+
+  Lighting *light = lighting_create();
+  Point pos1, pos2;
+  point_set3D(&pos1, 4, 6, -6);
+  point_set3D(&pos2, -5, 1, -4);
+  lighting_add(light, LightAmbient, &Dim, NULL, NULL, 0, 0);
+  lighting_add(light, LightPoint, &White, NULL, &pos1, 0, 0);
+  lighting_add(light, LightPoint, &Grey, NULL, &pos2, 0, 0);
+
+  src = image_create(Rows, Cols);
+
+  double gouraud = timeShading(scene, &VTM, &GTM, ds, light, src, ShadeGouraud, passes);
+  image_write(src, "phongspeed-gouraud.ppm");
+  double phong = timeShading(scene, &VTM, &GTM, ds, light, src, ShadePhong, passes);
+  image_write(src, "phongspeed-phong.ppm");
+  double deferred = timeShading(scene, &VTM, &GTM, ds, light, src, ShadeDeferred, passes);
+  image_write(src, "phongspeed-deferred.ppm");
+
+  printf("%d passes of %d x %d\n", passes, Cols, Rows);
+  printf("Gouraud: %8.3f ms per frame (%6.1f frames per second)\n", gouraud * 1000.0, 1.0 / gouraud);
+  printf("Phong:   %8.3f ms per frame (%6.1f frames per second)\n", phong * 1000.0, 1.0 / phong);
+  printf("Deferred:%8.3f ms per frame (%6.1f frames per second)\n", deferred * 1000.0, 1.0 / deferred);
+  printf("Phong costs %.2fx Gouraud, deferred %.2fx\n", phong / gouraud, deferred / gouraud);
+
+  image_free(src);
+  free(ds);
+  lighting_delete(light);
+  module_delete(scene);
+
+  return 0;
+}
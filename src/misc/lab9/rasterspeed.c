@@ -0,0 +1,187 @@
+/*
+  Benchmark for the tile-binned parallel rasterizer.
+
+  A grid of lit spheres and cubes is drawn with module_draw and with
+  module_drawParallel for flat, Gouraud, Phong and deferred shading. The
+  pixels the two disagree on are counted for raster tiles of 13, 20 and 64
+  pixels, then the time per frame is reported for module_draw, for the
+  rasterizer on one thread and for the rasterizer on every processor.
+
+  Usage: rasterspeed [passes] [threads]
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+
+// Returns the current time in seconds
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Draw one frame, with module_draw when raster is NULL; deferred frames are lit once drawn
+static void drawFrame(Module *scene, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *light, Image *src,
+                      Rasterizer *raster)
+{
+  image_reset(src);
+  if (raster)
+  {
+    module_drawParallel(scene, VTM, GTM, ds, light, src, raster);
+    if (ds->shade == ShadeDeferred)
+      rasterizer_shadeGBuffer(raster, src, light, &ds->viewer);
+  }
+  else
+  {
+    module_draw(scene, VTM, GTM, ds, light, src);
+    if (ds->shade == ShadeDeferred)
+      lighting_resolveGBuffer(light, src, &ds->viewer);
+  }
+}
+
+// Draw the scene passes times; returns the seconds per frame
+static double timeFrames(Module *scene, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *light, Image *src,
+                         Rasterizer *raster, int passes)
+{
+  double start = now();
+  for (int i = 0; i < passes; i++)
+    drawFrame(scene, VTM, GTM, ds, light, src, raster);
+  return (now() - start) / passes;
+}
+
+// Returns the number of pixels whose colors differ between a and b
+static int countDifferent(Image *a, Image *b)
+{
+  int n = 0;
+  for (int i = 0; i < a->rows; i++)
+  {
+    for (int j = 0; j < a->cols; j++)
+    {
+      FPixel x = image_getf(a, i, j);
+      FPixel y = image_getf(b, i, j);
+      n += x.rgb[0] != y.rgb[0] || x.rgb[1] != y.rgb[1] || x.rgb[2] != y.rgb[2];
+    }
+  }
+  return n;
+}
+
+int main(int argc, char *argv[])
+{
+  const int Rows = 600;
+  const int Cols = 800;
+  int passes = argc > 1 ? atoi(argv[1]) : 10;
+  int threads = argc > 2 ? atoi(argv[2]) : 0;
+  const int TileSizes[] = {13, 20, 64};
+  const ShadeMethod Shades[] = {ShadeFlat, ShadeGouraud, ShadePhong, ShadeDeferred};
+  const char *Names[] = {"Flat", "Gouraud", "Phong", "Deferred"};
+  View3D view;
+  Matrix VTM, GTM;
+  Color White, Grey, Dim, Blue, Gold;
+
+  if (passes < 1)
+    passes = 1;
+
+  color_set(&White, 1.0, 1.0, 1.0);
+  color_set(&Grey, 0.6, 0.6, 0.6);
+  color_set(&Dim, 0.15, 0.15, 0.15);
+  color_set(&Blue, 0.2, 0.4, 0.9);
+  color_set(&Gold, 0.9, 0.7, 0.1);
+
+  // set up the view
+  point_set3D(&(view.vrp), 0, 6, -14);
+  vector_set(&(view.vpn), 0, -6, 14);
+  vector_set(&(view.vup), 0, 1, 0);
+  view.d = 2.0;
+  view.du = 1.6;
+  view.dv = 1.2;
+  view.f = 0.0;
+  view.b = 40;
+  view.screenx = Cols;
+  view.screeny = Rows;
+  matrix_setView3D(&VTM, &view);
+  matrix_identity(&GTM);
+
+  // a 7 x 7 grid of alternating spheres and cubes, so polygons of every size land across tile borders
+  Module *scene = module_create();
+  module_surfaceColor(scene, &Grey);
+  module_surfaceCoeff(scene, 30);
+  for (int i = 0; i < 7; i++)
+  {
+    for (int j = 0; j < 7; j++)
+    {
+      module_identity(scene);
+      module_translate(scene, 1.6 * (j - 3), 0, 1.6 * (i - 3));
+      if ((i + j) % 2)
+      {
+        module_bodyColor(scene, &Blue);
+        module_rotateY(scene, cos(0.4 * i), sin(0.4 * i));
+        module_cube(scene, 1);
+      }
+      else
+      {
+        module_bodyColor(scene, &Gold);
+        module_scale(scene, 0.7, 0.7, 0.7);
+        module_sphere(scene, 20, 14, 1);
+      }
+    }
+  }
+
+  DrawState *ds = drawstate_create();
+  point_copy(&(ds->viewer), &(view.vrp));
+
+  Lighting *light = lighting_create();
+  Point pos1, pos2;
+  point_set3D(&pos1, 6, 10, -8);
+  point_set3D(&pos2, -8, 3, -6);
+  lighting_add(light, LightAmbient, &Dim, NULL, NULL, 0, 0);
+  lighting_add(light, LightPoint, &White, NULL, &pos1, 0, 0);
+  lighting_add(light, LightPoint, &Grey, NULL, &pos2, 0, 0);
+
+  Image *serial = image_create(Rows, Cols);
+  Image *parallel = image_create(Rows, Cols);
+
+  // The rasterizer must match module_draw pixel for pixel whatever the tile size
+  printf("%d x %d, pixels differing from module_draw:\n", Cols, Rows);
+  for (int t = 0; t < (int)(sizeof(TileSizes) / sizeof(TileSizes[0])); t++)
+  {
+    Rasterizer *raster = rasterizer_create(threads, TileSizes[t]);
+    printf("  tile %2d (%2d):", TileSizes[t], raster->tileSize);
+    for (int s = 0; s < 4; s++)
+    {
+      ds->shade = Shades[s];
+      drawFrame(scene, &VTM, &GTM, ds, light, serial, NULL);
+      drawFrame(scene, &VTM, &GTM, ds, light, parallel, raster);
+      printf(" %s %d", Names[s], countDifferent(serial, parallel));
+    }
+    printf("\n");
+    rasterizer_delete(raster);
+  }
+
+  Rasterizer *one = rasterizer_create(1, RASTER_TILE_SIZE);
+  Rasterizer *all = rasterizer_create(threads, RASTER_TILE_SIZE);
+  printf("%d passes, ms per frame: module_draw | rasterizer on 1 thread | on %d threads (speedup over 1 thread)\n",
+         passes, all->pool->nThreads);
+  for (int s = 0; s < 4; s++)
+  {
+    ds->shade = Shades[s];
+    double t0 = timeFrames(scene, &VTM, &GTM, ds, light, serial, NULL, passes);
+    double t1 = timeFrames(scene, &VTM, &GTM, ds, light, parallel, one, passes);
+    double tn = timeFrames(scene, &VTM, &GTM, ds, light, parallel, all, passes);
+    printf("%-9s %8.3f | %8.3f | %8.3f (%.2fx)\n", Names[s], t0 * 1000, t1 * 1000, tn * 1000, t1 / tn);
+  }
+  image_write(parallel, "rasterspeed.ppm");
+
+  rasterizer_delete(one);
+  rasterizer_delete(all);
+  image_free(serial);
+  image_free(parallel);
+  free(ds);
+  lighting_delete(light);
+  module_delete(scene);
+
+  return 0;
+}
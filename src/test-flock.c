@@ -0,0 +1,114 @@
+/*
+  Steps a large flock with the spatial-hash grid and boids rules and
+  times each part of a step. Checks the grid's neighbor queries against
+  a brute-force search first.
+
+  Usage: test-flock [agents] [steps]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "swarm.h"
+
+#define MAX_SPEED 0.05
+
+// Returns the current time in seconds
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Returns the number of agents within radius of agent i, searching all of them
+static int brute_force(const Agent *swarm, int numAgents, int i, float radius)
+{
+  int n = 0;
+  for (int j = 0; j < numAgents; j++)
+  {
+    float d[3];
+    for (int a = 0; a < 3; a++)
+      d[a] = (float)swarm[j].position.val[a] - (float)swarm[i].position.val[a];
+    n += d[0] * d[0] + d[1] * d[1] + d[2] * d[2] <= radius * radius;
+  }
+  return n;
+}
+
+int main(int argc, char *argv[])
+{
+  int numAgents = argc > 1 ? atoi(argv[1]) : 100000;
+  int steps = argc > 2 ? atoi(argv[2]) : 20;
+  Agent *swarm = (Agent *)malloc(numAgents * sizeof(Agent));
+  int *neighbors = (int *)malloc(numAgents * sizeof(int));
+  ThreadPool *pool = threadpool_create(0);
+  SwarmParams params;
+  SwarmGrid grid;
+  double t[3] = {0, 0, 0}, start;
+  int wrong = 0;
+
+  if (!swarm || !neighbors)
+  {
+    fprintf(stderr, "Unable to allocate %d agents\n", numAgents);
+    return 1;
+  }
+
+  // Spread the agents over a volume that grows with their number, about one per 20 cubic units, so each starts
+  // with a few flockmates
+  double spread = cbrt(numAgents / 5000.0);
+  srand(42);
+  initialize_swarm(swarm, numAgents, 1280 * spread, 720 * spread);
+  swarm_params(&params);
+  params.pool = pool;
+  swarm_gridInit(&grid, params.neighborRadius);
+
+  // Compare a sample of the queries with a brute-force search
+  swarm_gridBuild(&grid, swarm, numAgents);
+  for (int i = 0; i < numAgents; i += numAgents / 100 + 1)
+  {
+    int n = swarm_gridQuery(&grid, &swarm[i].position, params.neighborRadius, neighbors, numAgents);
+    wrong += n != brute_force(swarm, numAgents, i, params.neighborRadius);
+  }
+  printf("%d agents, %d queries checked against brute force: %d wrong\n", numAgents, numAgents / (numAgents / 100 + 1), wrong);
+
+  // Cells much smaller than the radius, so a row of the neighborhood is longer than the hash table
+  SwarmGrid small;
+  int few = numAgents < 10 ? numAgents : 10;
+  wrong = 0;
+  swarm_gridInit(&small, 0.05f);
+  swarm_gridBuild(&small, swarm, few);
+  for (int i = 0; i < few; i++)
+  {
+    int n = swarm_gridQuery(&small, &swarm[i].position, params.neighborRadius, neighbors, numAgents);
+    wrong += n != brute_force(swarm, few, i, params.neighborRadius);
+  }
+  steer_swarm(swarm, few, &small, &params);
+  printf("%d agents on %g-unit cells, %d queries checked against brute force: %d wrong\n", few, small.cellSize, few,
+         wrong);
+  swarm_gridFree(&small);
+
+  for (int step = 0; step < steps; step++)
+  {
+    start = now();
+    swarm_gridBuild(&grid, swarm, numAgents);
+    t[0] += now() - start;
+
+    start = now();
+    steer_swarm(swarm, numAgents, &grid, &params);
+    t[1] += now() - start;
+
+    start = now();
+    update_swarm(swarm, numAgents, MAX_SPEED);
+    t[2] += now() - start;
+  }
+
+  printf("per step on %d threads: grid %.2f ms, steering %.2f ms, update %.2f ms, total %.2f ms\n", pool->nThreads,
+         t[0] * 1000 / steps, t[1] * 1000 / steps, t[2] * 1000 / steps, (t[0] + t[1] + t[2]) * 1000 / steps);
+
+  swarm_gridFree(&grid);
+  threadpool_delete(pool);
+  free(neighbors);
+  free(swarm);
+  return 0;
+}
@@ -3,9 +3,11 @@
 #include <math.h>
 #include "graphics.h"
 #include "swarm.h"
+#include "gif.h"
+#include "framewriter.h"
 
-#define NUM_AGENTS 9
-#define MAX_SPEED 0.05
+#define NUM_AGENTS 64
+#define MAX_SPEED 0.5
 
 /*
   Adds to the module a unit cylinder, aligned along the Y-axis
@@ -150,7 +152,7 @@ int main(int argc, char *argv[])
 {
 
   Image *src;
-  Module *scene;
+  DisplayList *ship;
   Module *engine;
   Module *wing;
   Module *wings;
@@ -362,6 +364,7 @@ int main(int argc, char *argv[])
 
   // image
   src = image_create(view.screeny, view.screenx);
+  image_trackTiles(src, 1); // the ships cover little of the frame, so only clear what they touched
   ds = drawstate_create();
   point_copy(&(ds->viewer), &(view.vrp));
   ds->shade = ShadeGouraud;
@@ -369,10 +372,25 @@ int main(int argc, char *argv[])
   light = lighting_create();
   lighting_add(light, LightPoint, &White, NULL, &(view.vrp), 0.0, 0.0);
 
-  // Initialize and set up the swarm
-  scene = module_create();
+  // Compile the ship once; every agent redraws it under its own transform
+  ship = module_compile(body, NULL, ds);
+
+  // Initialize and set up the swarm; the ships are large, so flockmates are found and kept farther apart
   Agent swarm[NUM_AGENTS];
+  SwarmParams flocking;
+  SwarmGrid grid;
   initialize_swarm(swarm, NUM_AGENTS, view.screenx, view.screeny);
+  swarm_params(&flocking);
+  flocking.neighborRadius = 20.0;
+  flocking.separationRadius = 10.0;
+  flocking.boundRadius = 30.0; // keep the flock in view
+  swarm_gridInit(&grid, flocking.neighborRadius);
+
+  // Encode the animation while it renders
+  GifWriter *gif = gif_begin("swarm.gif", view.screeny, view.screenx, 5);
+
+  // Write frames on a background thread so the next frame renders while the last one is saved
+  FrameWriter *writer = framewriter_create(view.screeny, view.screenx, FRAMEWRITER_BUFFERS, gif);
 
   // Run the swarm simulation and render
   for (int frame = 0; frame < 41; frame++)
@@ -380,32 +398,44 @@ int main(int argc, char *argv[])
     // Clear the image for the next frame
     image_reset(src);
 
-    // Update swarm
+    // Steer each agent with its flockmates, then move the swarm
+    swarm_gridBuild(&grid, swarm, NUM_AGENTS);
+    steer_swarm(swarm, NUM_AGENTS, &grid, &flocking);
     update_swarm(swarm, NUM_AGENTS, MAX_SPEED);
 
-    // Clear the module and add the updated swarm to it
-    module_clear(scene);
-    render_swarm(swarm, NUM_AGENTS, scene, body);
-
-    matrix_identity(&gtm);
-
-    // Draw the module
-    module_draw(scene, &vtm, &gtm, ds, light, src);
+    // Draw a ship at each agent's position
+    for (i = 0; i < NUM_AGENTS; i++)
+    {
+      matrix_identity(&gtm);
+      matrix_scale(&gtm, 0.4, 0.4, 0.4);
+      matrix_translate(&gtm, swarm[i].position.val[0], swarm[i].position.val[1], swarm[i].position.val[2]);
+      displaylist_draw(ship, &vtm, &gtm, ds, light, src);
+    }
 
     // Write out the image for each frame (optional)
     char filename[20];
     sprintf(filename, "frame-%02d.ppm", frame);
-    image_write(src, filename);
+    if (writer)
+      framewriter_write(writer, src, filename);
+    else
+    {
+      image_write(src, filename);
+      if (gif)
+        gif_addFrame(gif, src);
+    }
   }
+  framewriter_delete(writer);
+  gif_end(gif);
 
   // Cleanup
+  swarm_gridFree(&grid);
   module_delete(wing);
   module_delete(wings);
   module_delete(laser);
   module_delete(body);
   module_delete(engine);
   lighting_delete(light);
-  module_delete(scene);
+  displaylist_delete(ship);
   image_free(src);
 
   return 0;